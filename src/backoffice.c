@@ -538,6 +538,9 @@ void backoffice_work(void){
   /* Here is where the actual work of the backoffice happens */
   alert_backoffice(0);
   smtp_cleanup();
+  search_backoffice();
+  codeidx_backoffice();
+  cache_backoffice();
 }
 
 /*
@@ -103,6 +103,158 @@ void hyperlinked_path(
   }
 }
 
+/*
+** A directory index holds every file of a single check-in, sorted by
+** full pathname, together with the hash of each file artifact and the
+** time it last changed.  The index is built once per check-in and kept
+** in the cache database (see cache.c).  Listing one directory then
+** costs a binary search plus a walk over that directory, rather than a
+** pass over the whole manifest and a recomputation of file ages.
+**
+** The serialized form is a DirIndexHdr, an array of nFile offsets of
+** the entries, and then the entries.  Each entry is the mtime as a
+** double followed by the zero-terminated name and hash.  Values are in
+** host byte order as the cache is never shared with another machine.
+*/
+#define DIRINDEX_MAGIC 0x44495831    /* "DIX1" */
+typedef struct DirIndexHdr DirIndexHdr;
+struct DirIndexHdr {
+  int magic;             /* DIRINDEX_MAGIC */
+  int nFile;             /* Number of files in the check-in */
+};
+typedef struct DirIndex DirIndex;
+struct DirIndex {
+  Blob x;                /* The serialized index */
+  int nFile;             /* Number of files */
+  const int *aOff;       /* Offset of each entry within x */
+};
+
+/* Accessors for the i-th entry of a directory index */
+static const char *dirindex_entry(DirIndex *p, int i){
+  return blob_buffer(&p->x) + p->aOff[i];
+}
+static const char *dirindex_name(DirIndex *p, int i){
+  return dirindex_entry(p, i) + sizeof(double);
+}
+static const char *dirindex_uuid(DirIndex *p, int i){
+  const char *z = dirindex_name(p, i);
+  return z + strlen(z) + 1;
+}
+
+/*
+** Return the index of the first entry whose name is not less than zKey.
+*/
+static int dirindex_search(DirIndex *p, const char *zKey){
+  int lo = 0, hi = p->nFile;
+  while( lo<hi ){
+    int mid = (lo+hi)/2;
+    if( strcmp(dirindex_name(p, mid), zKey)<0 ){
+      lo = mid+1;
+    }else{
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/*
+** Check the serialized index in p->x and set up the other fields of p.
+** Return false if the content is not a valid index.
+*/
+static int dirindex_setup(DirIndex *p){
+  const char *z = blob_buffer(&p->x);
+  int n = blob_size(&p->x);
+  DirIndexHdr hdr;
+  int i, iMin;
+
+  if( n<(int)sizeof(hdr) ) return 0;
+  memcpy(&hdr, z, sizeof(hdr));
+  if( hdr.magic!=DIRINDEX_MAGIC || hdr.nFile<0 ) return 0;
+  iMin = (int)sizeof(hdr) + hdr.nFile*(int)sizeof(int);
+  if( hdr.nFile>(n-(int)sizeof(hdr))/(int)sizeof(int) ) return 0;
+  if( hdr.nFile>0 && z[n-1]!=0 ) return 0;
+  p->nFile = hdr.nFile;
+  p->aOff = (const int*)&z[sizeof(hdr)];
+  for(i=0; i<p->nFile; i++){
+    if( p->aOff[i]<iMin || p->aOff[i]>n-(int)sizeof(double)-2 ) return 0;
+  }
+  return 1;
+}
+
+/*
+** Compare two directory index entries by name, ignoring case as the
+** "nocase" collating sequence does.
+*/
+static int dirindexEntryCmp(const void *a, const void *b){
+  const char *zA = *(const char**)a + sizeof(double);
+  const char *zB = *(const char**)b + sizeof(double);
+  int c = sqlite3_stricmp(zA, zB);
+  return c ? c : strcmp(zA, zB);
+}
+
+/*
+** Fill in p with the directory index for check-in rid, either from the
+** cache or by building the index and saving it there.  Return false,
+** and leave p empty, if the repository has no cache: building the
+** index needs the file ages, which costs more than a single listing
+** without the index.
+**
+** The index is kept as a cache fragment.  Its key includes the version
+** of the repository content, as an amended check-in date, or a removed
+** tag, changes the file ages.
+*/
+static int dirindex_load(DirIndex *p, int rid, const char *zUuid){
+  char *zKey;
+  DirIndexHdr hdr;
+  Blob aOff, entries;
+  Stmt q;
+  int n;
+
+  memset(p, 0, sizeof(*p));
+  blob_init(&p->x, 0, 0);
+  if( !cache_exists() ) return 0;
+  zKey = mprintf("dirindex-%s-%z", zUuid, cache_repository_version());
+  if( cache_fragment_read(zKey, &p->x) && dirindex_setup(p) ){
+    fossil_free(zKey);
+    return 1;
+  }
+  blob_reset(&p->x);
+  blob_init(&aOff, 0, 0);
+  blob_init(&entries, 0, 0);
+  compute_fileage(rid, 0);
+  db_prepare(&q,
+     "SELECT filename.name, blob.uuid, fileage.mtime\n"
+     "  FROM fileage, filename, blob\n"
+     " WHERE filename.fnid=fileage.fnid\n"
+     "   AND blob.rid=fileage.fid\n"
+     " ORDER BY filename.name;"
+  );
+  for(n=0; db_step(&q)==SQLITE_ROW; n++){
+    double mtime = db_column_double(&q, 2);
+    int iOff = blob_size(&entries);
+    blob_append(&aOff, (const char*)&iOff, sizeof(iOff));
+    blob_append(&entries, (const char*)&mtime, sizeof(mtime));
+    blob_append(&entries, db_column_text(&q, 0), db_column_bytes(&q, 0)+1);
+    blob_append(&entries, db_column_text(&q, 1), db_column_bytes(&q, 1)+1);
+  }
+  db_finalize(&q);
+  hdr.magic = DIRINDEX_MAGIC;
+  hdr.nFile = n;
+  for(n=0; n<hdr.nFile; n++){
+    ((int*)blob_buffer(&aOff))[n] += (int)sizeof(hdr) + blob_size(&aOff);
+  }
+  blob_append(&p->x, (const char*)&hdr, sizeof(hdr));
+  blob_append(&p->x, blob_buffer(&aOff), blob_size(&aOff));
+  blob_append(&p->x, blob_buffer(&entries), blob_size(&entries));
+  p->nFile = hdr.nFile;
+  p->aOff = (const int*)(blob_buffer(&p->x) + sizeof(hdr));
+  cache_fragment_write(zKey, &p->x);
+  blob_reset(&aOff);
+  blob_reset(&entries);
+  fossil_free(zKey);
+  return 1;
+}
+
 
 /*
 ** WEBPAGE: dir
@@ -135,6 +287,7 @@ void page_dir(void){
   int linkTrunk = 1;
   int linkTip = 1;
   HQuery sURI;
+  DirIndex idx;
 
   if( strcmp(PD("type","flat"),"tree")==0 ){ page_tree(); return; }
   login_check_credentials();
@@ -219,7 +372,39 @@ void page_dir(void){
   db_multi_exec(
      "CREATE TEMP TABLE localfiles(x UNIQUE NOT NULL, u);"
   );
-  if( zCI ){
+  if( zCI && dirindex_load(&idx, rid, zUuid) ){
+    Stmt ins;
+    int nPrefix = (int)strlen(zPrefix);
+    int i = dirindex_search(&idx, zPrefix);
+
+    /* Walk the entries of zD[].  A subdirectory is entered once, using
+    ** the first file within it, and then skipped with a second search
+    ** for its name followed by '0', the character after '/'. */
+    db_prepare(&ins, "INSERT OR IGNORE INTO localfiles VALUES(:x, :u)");
+    while( i<idx.nFile ){
+      const char *zName = dirindex_name(&idx, i);
+      int j;
+      if( strncmp(zName, zPrefix, nPrefix)!=0 ) break;
+      for(j=nPrefix; zName[j] && zName[j]!='/'; j++){}
+      db_bind_text(&ins, ":u", dirindex_uuid(&idx, i));
+      if( zName[j]=='/' ){
+        char *zSub = mprintf("/%.*s", j-nPrefix, &zName[nPrefix]);
+        char *zNext = mprintf("%.*s0", j, zName);
+        db_bind_text(&ins, ":x", zSub);
+        db_step(&ins);
+        i = dirindex_search(&idx, zNext);
+        fossil_free(zSub);
+        fossil_free(zNext);
+      }else{
+        db_bind_text(&ins, ":x", &zName[nPrefix]);
+        db_step(&ins);
+        i++;
+      }
+      db_reset(&ins);
+    }
+    db_finalize(&ins);
+    blob_reset(&idx.x);
+  }else if( zCI ){
     Stmt ins;
     ManifestFile *pFile;
     ManifestFile *pPrev = 0;
@@ -607,6 +792,7 @@ void page_tree(void){
   int showDirOnly;         /* Show directories only.  Omit files */
   int nDir = 0;            /* Number of directories. Used for ID attributes */
   char *zProjectName = db_get("project-name", 0);
+  DirIndex idx;        /* Directory index for check-in zCI */
 
   if( strcmp(PD("type","flat"),"flat")==0 ){ page_dir(); return; }
   memset(&sTree, 0, sizeof(sTree));
@@ -696,7 +882,36 @@ void page_tree(void){
 
   /* Compute the file hierarchy.
   */
-  if( zCI ){
+  if( zCI && dirindex_load(&idx, rid, zUuid) ){
+    char *zPrefix = zD ? mprintf("%s/", zD) : "";
+    int nPrefix = (int)strlen(zPrefix);
+    int i, n;
+    const char **azEntry;
+
+    /* The index is in strcmp() order, and the tree wants the
+    ** case-insensitive order used by the query below. */
+    i = dirindex_search(&idx, zPrefix);
+    for(n=i; n<idx.nFile; n++){
+      if( strncmp(dirindex_name(&idx, n), zPrefix, nPrefix)!=0 ) break;
+    }
+    n -= i;
+    azEntry = fossil_malloc( sizeof(azEntry[0])*(n+1) );
+    for(n=0; i<idx.nFile; i++, n++){
+      if( strncmp(dirindex_name(&idx, i), zPrefix, nPrefix)!=0 ) break;
+      azEntry[n] = dirindex_entry(&idx, i);
+    }
+    qsort((void*)azEntry, n, sizeof(azEntry[0]), dirindexEntryCmp);
+    for(i=0; i<n; i++){
+      const char *zFile = azEntry[i] + sizeof(double);
+      double mtime;
+      memcpy(&mtime, azEntry[i], sizeof(mtime));
+      if( pRE && re_match(pRE, (const unsigned char*)zFile, -1)==0 ) continue;
+      tree_add_node(&sTree, zFile, zFile+strlen(zFile)+1, mtime);
+      nFile++;
+    }
+    fossil_free((void*)azEntry);
+    if( zD ) fossil_free(zPrefix);
+  }else if( zCI ){
     Stmt q;
     compute_fileage(rid, 0);
     db_prepare(&q,
@@ -904,17 +1119,276 @@ static const char zComputeFileAgeRun[] =
 @  ORDER BY event.mtime ASC;
 ;
 
+/*
+** For each file of a check-in, the oldest ancestor of that check-in at
+** which the file took on its current content.  A check-in gets its rows
+** on first use, mostly by copying the rows of its primary parent.  The
+** rows are saved as a cache fragment, so that later requests and the
+** children of the check-in can reuse them, and are loaded into this
+** TEMP table while in use.
+*/
+static const char zLastChangeSetup[] =
+@ CREATE TABLE IF NOT EXISTS temp.lastchange(
+@   cid INTEGER,                    -- The check-in
+@   fnid INTEGER,                   -- A file of that check-in
+@   fid INTEGER,                    -- Content of the file in check-in cid
+@   mid INTEGER,                    -- Check-in that introduced fid, or 0
+@   PRIMARY KEY(cid, fnid)
+@ ) WITHOUT ROWID;
+;
+
+/*
+** When more files than this need a search, walk the whole ancestry once
+** rather than testing the ancestry of each candidate separately.
+*/
+#define LASTCHANGE_SEARCH_LIMIT 50
+
+/*
+** Return the oldest check-in that is check-in vid or one of its
+** ancestors and that changes some file to content fid.  Return 0 if
+** there is no such check-in.  This is what zComputeFileAgeRun finds for
+** a single file, without walking the whole ancestry of vid.
+*/
+static int lastchange_search(int fid, int vid){
+  static Stmt q;
+  int mid = 0;
+  db_static_prepare(&q,
+    "SELECT mlink.mid FROM mlink, event"
+    " WHERE mlink.fid=:fid"
+    "   AND mlink.fid!=mlink.pid"
+    "   AND event.objid=mlink.mid"
+    " ORDER BY event.mtime"
+  );
+  db_bind_int(&q, ":fid", fid);
+  while( mid==0 && db_step(&q)==SQLITE_ROW ){
+    int m = db_column_int(&q, 0);
+    if( ancestry_is_ancestor(m, vid) ) mid = m;
+  }
+  db_reset(&q);
+  return mid;
+}
+
+/*
+** Return the name of the cache fragment that holds the LASTCHANGE rows
+** of check-in vid.  The name changes whenever lastchange_invalidate() is
+** called and whenever content is removed from the repository, which
+** includes a rebuild that renumbers the filenames.  The caller must free
+** the result.
+*/
+static char *lastchange_key(int vid){
+  return db_text(0,
+    "SELECT printf('lastchange-%%s-%%d-%%d', uuid,"
+    "  (SELECT value FROM config WHERE name='lastchange-cnt'),"
+    "  (SELECT value FROM config WHERE name='rmcnt'))"
+    "  FROM blob WHERE rid=%d", vid
+  );
+}
+
+/*
+** Make sure the LASTCHANGE table holds the saved rows of check-in vid.
+** Return false if no rows were saved for vid.
+*/
+static int lastchange_load(int vid){
+  Blob x;
+  Stmt ins;
+  char *zKey;
+  const int *a;
+  int i, n;
+
+  if( db_exists("SELECT 1 FROM temp.lastchange WHERE cid=%d", vid) ){
+    return 1;
+  }
+  zKey = lastchange_key(vid);
+  blob_init(&x, 0, 0);
+  if( zKey==0 || !cache_fragment_read(zKey, &x) ){
+    fossil_free(zKey);
+    return 0;
+  }
+  fossil_free(zKey);
+  a = (const int*)blob_buffer(&x);
+  n = blob_size(&x)/(3*(int)sizeof(int));
+  db_prepare(&ins,
+    "INSERT OR IGNORE INTO temp.lastchange(cid, fnid, fid, mid)"
+    " VALUES(%d, :fnid, :fid, :mid)", vid
+  );
+  for(i=0; i<n; i++){
+    db_bind_int(&ins, ":fnid", a[i*3]);
+    db_bind_int(&ins, ":fid", a[i*3+1]);
+    db_bind_int(&ins, ":mid", a[i*3+2]);
+    db_step(&ins);
+    db_reset(&ins);
+  }
+  db_finalize(&ins);
+  blob_reset(&x);
+  return 1;
+}
+
+/*
+** Save the LASTCHANGE rows of check-in vid as a cache fragment.
+*/
+static void lastchange_save(int vid){
+  Blob x;
+  Stmt q;
+  char *zKey = lastchange_key(vid);
+  if( zKey==0 ) return;
+  blob_init(&x, 0, 0);
+  db_prepare(&q,
+    "SELECT fnid, fid, mid FROM temp.lastchange WHERE cid=%d", vid
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    int a[3];
+    a[0] = db_column_int(&q, 0);
+    a[1] = db_column_int(&q, 1);
+    a[2] = db_column_int(&q, 2);
+    blob_append(&x, (const char*)a, sizeof(a));
+  }
+  db_finalize(&q);
+  cache_fragment_write(zKey, &x);
+  blob_reset(&x);
+  fossil_free(zKey);
+}
+
+/*
+** Make sure the LASTCHANGE table holds rows for check-in vid.  Return
+** false if that is not possible because the repository has no cache,
+** in which case the rows could not be kept for reuse.
+**
+** Files whose content is unchanged from the primary parent inherit the
+** parent's answer, so when the parent already has rows only the files
+** changed by vid need a search.  A merge check-in might bring in an
+** older instance of the same content from another parent, so the
+** inherited rows of a merge are searched again whenever some check-in
+** older than the inherited one has the same content.  Without rows for
+** the parent, or with many files to search, the whole ancestry is
+** walked once instead, as zComputeFileAgeRun does.
+**
+** Nothing is written to the repository, so this works the same for
+** read-only repositories and for users who may only read.
+*/
+static int lastchange_compute(int vid){
+  Stmt q;
+  int pid, nMerge, n, i;
+  int *aFile;
+
+  if( !cache_exists() ) return 0;
+  db_multi_exec(zLastChangeSetup /*works-like:"constant"*/);
+  if( lastchange_load(vid) ) return 1;
+  pid = db_int(0, "SELECT pid FROM plink WHERE cid=%d AND isprim", vid);
+  nMerge = db_int(0, "SELECT count(*) FROM plink WHERE cid=%d", vid) - 1;
+  if( pid && !lastchange_load(pid) ) pid = 0;
+  db_multi_exec(
+    "INSERT OR IGNORE INTO temp.lastchange(cid, fnid, fid, mid)"
+    " SELECT %d, filename.fnid, blob.rid,"
+    "        coalesce((SELECT nullif(p.mid,0) FROM temp.lastchange p"
+    "                   WHERE p.cid=%d AND p.fnid=filename.fnid"
+    "                     AND p.fid=blob.rid), -1)"
+    "   FROM foci, filename, blob"
+    "  WHERE foci.checkinID=%d"
+    "    AND filename.name=foci.filename"
+    "    AND blob.uuid=foci.uuid",
+    vid, pid, vid
+  );
+  if( nMerge>0 && pid ){
+    db_multi_exec(
+      "UPDATE temp.lastchange SET mid=-1"
+      " WHERE cid=%d AND mid>0"
+      "   AND EXISTS(SELECT 1 FROM mlink, event e"
+      "               WHERE mlink.fid=lastchange.fid"
+      "                 AND mlink.fid!=mlink.pid"
+      "                 AND e.objid=mlink.mid"
+      "                 AND e.mtime<(SELECT mtime FROM event"
+      "                               WHERE objid=lastchange.mid))",
+      vid
+    );
+  }
+  n = db_int(0,
+    "SELECT count(*) FROM temp.lastchange WHERE cid=%d AND mid<0", vid
+  );
+  if( n>LASTCHANGE_SEARCH_LIMIT ){
+    db_multi_exec(
+      "WITH RECURSIVE"
+      "  ckin(x) AS (VALUES(%d) UNION SELECT pid FROM ckin, plink WHERE cid=x)"
+      "UPDATE temp.lastchange SET mid=coalesce("
+      "   (SELECT mlink.mid FROM mlink, event"
+      "     WHERE mlink.fid=lastchange.fid"
+      "       AND mlink.fid!=mlink.pid"
+      "       AND mlink.mid IN (SELECT x FROM ckin)"
+      "       AND event.objid=mlink.mid"
+      "     ORDER BY event.mtime LIMIT 1), 0)"
+      " WHERE cid=%d AND mid<0",
+      vid, vid
+    );
+    n = 0;
+  }
+  aFile = fossil_malloc( sizeof(aFile[0])*2*(n+1) );
+  db_prepare(&q,
+    "SELECT fnid, fid FROM temp.lastchange WHERE cid=%d AND mid<0", vid
+  );
+  for(i=0; i<n && db_step(&q)==SQLITE_ROW; i++){
+    aFile[i*2] = db_column_int(&q, 0);
+    aFile[i*2+1] = db_column_int(&q, 1);
+  }
+  db_finalize(&q);
+  n = i;
+  db_prepare(&q,
+    "UPDATE temp.lastchange SET mid=:mid WHERE cid=%d AND fnid=:fnid", vid
+  );
+  for(i=0; i<n; i++){
+    db_bind_int(&q, ":mid", lastchange_search(aFile[i*2+1], vid));
+    db_bind_int(&q, ":fnid", aFile[i*2]);
+    db_step(&q);
+    db_reset(&q);
+  }
+  db_finalize(&q);
+  fossil_free(aFile);
+  lastchange_save(vid);
+  return 1;
+}
+
+/*
+** Forget all saved LASTCHANGE rows, by changing the names under which
+** they are saved.  This is called when the ancestry or the dates of
+** existing check-ins change.
+*/
+void lastchange_invalidate(void){
+  db_multi_exec(
+     "REPLACE INTO config(name,value,mtime)"
+     " VALUES('lastchange-cnt',"
+     "   coalesce((SELECT value FROM config WHERE name='lastchange-cnt'),0)+1,"
+     "   now())"
+  );
+  if( db_table_exists("temp", "lastchange") ){
+    db_multi_exec("DELETE FROM temp.lastchange");
+  }
+}
+
 /*
 ** Look at all file containing in the version "vid".  Construct a
 ** temporary table named "fileage" that contains the file-id for each
 ** files, the pathname, the check-in where the file was added, and the
 ** mtime on that check-in. If zGlob and *zGlob then only files matching
 ** the given glob are computed.
+**
+** The answers are read from the LASTCHANGE table when the repository has
+** a cache, which avoids a walk over the complete ancestry of vid.
 */
 int compute_fileage(int vid, const char* zGlob){
   Stmt q;
   db_multi_exec(zComputeFileAgeSetup /*works-like:"constant"*/);
-  db_prepare(&q, zComputeFileAgeRun  /*works-like:"constant"*/);
+  if( lastchange_compute(vid) ){
+    db_prepare(&q,
+      "INSERT OR IGNORE INTO fileage(fnid, fid, mid, mtime, pathname)"
+      " SELECT lastchange.fnid, lastchange.fid, lastchange.mid,"
+      "        event.mtime, filename.name"
+      "   FROM temp.lastchange, filename, event"
+      "  WHERE lastchange.cid=:ckin"
+      "    AND filename.fnid=lastchange.fnid"
+      "    AND filename.name GLOB :glob"
+      "    AND event.objid=lastchange.mid"
+    );
+  }else{
+    db_prepare(&q, zComputeFileAgeRun  /*works-like:"constant"*/);
+  }
   db_bind_int(&q, ":ckin", vid);
   db_bind_text(&q, ":glob", zGlob && zGlob[0] ? zGlob : "*");
   db_exec(&q);
@@ -139,13 +139,95 @@ static void cache_register_sizename(sqlite3 *db){
 }
 
 /*
-** Attempt to write pContent into the cache.  If the cache file does
-** not exist, then this routine is a no-op.  Older cache entries might
-** be deleted.
+** Size of the pieces in which archives are copied between the cache
+** database and the spool file or the client.
 */
-void cache_write(Blob *pContent, const char *zKey){
+#define CACHE_CHUNK_SIZE 65536
+
+/*
+** Copy nByte bytes from file in into the data of row id of the blob
+** table, which must already hold that many bytes.  Return true on
+** success.
+*/
+static int cacheCopyFromFile(sqlite3 *db, sqlite3_int64 id, FILE *in,
+                             int nByte){
+  sqlite3_blob *pBlob = 0;
+  char *zBuf;
+  int iOfst = 0;
+  int rc;
+
+  rc = sqlite3_blob_open(db, "main", "blob", "data", id, 1, &pBlob);
+  if( rc!=SQLITE_OK ){
+    sqlite3_blob_close(pBlob);
+    return 0;
+  }
+  zBuf = fossil_malloc(CACHE_CHUNK_SIZE);
+  rewind(in);
+  while( rc==SQLITE_OK && iOfst<nByte ){
+    int n = nByte - iOfst;
+    if( n>CACHE_CHUNK_SIZE ) n = CACHE_CHUNK_SIZE;
+    if( fread(zBuf, 1, n, in)!=(size_t)n ) break;
+    rc = sqlite3_blob_write(pBlob, zBuf, n, iOfst);
+    iOfst += n;
+  }
+  fossil_free(zBuf);
+  sqlite3_blob_close(pBlob);
+  return rc==SQLITE_OK && iOfst==nByte;
+}
+
+/*
+** Add one to the hit count of the current web page, if bHit is true, or
+** else to its miss count, in the "pagestat" table of cache database db.
+** Pages are counted by the first element of their path.
+*/
+static void cachePageCount(sqlite3 *db, int bHit){
+  sqlite3_stmt *pStmt;
+  char *zPage;
+
+  sqlite3_exec(db,
+     "CREATE TABLE IF NOT EXISTS pagestat("
+       "page TEXT PRIMARY KEY,"    /* First element of the path */
+       "nhit INT,"                 /* Replies taken from the cache */
+       "nmiss INT"                 /* Replies generated and then cached */
+     ");", 0, 0, 0);
+  zPage = mprintf("/%s", g.zPath);
+  pStmt = cacheStmt(db, bHit ?
+     "UPDATE pagestat SET nhit=nhit+1 WHERE page=?1" :
+     "UPDATE pagestat SET nmiss=nmiss+1 WHERE page=?1");
+  if( pStmt ){
+    sqlite3_bind_text(pStmt, 1, zPage, -1, SQLITE_STATIC);
+    sqlite3_step(pStmt);
+    sqlite3_finalize(pStmt);
+    if( sqlite3_changes(db)==0 ){
+      pStmt = cacheStmt(db,
+         "INSERT INTO pagestat(page,nhit,nmiss) VALUES(?1,?2,?3)");
+      if( pStmt ){
+        sqlite3_bind_text(pStmt, 1, zPage, -1, SQLITE_STATIC);
+        sqlite3_bind_int(pStmt, 2, bHit);
+        sqlite3_bind_int(pStmt, 3, !bHit);
+        sqlite3_step(pStmt);
+        sqlite3_finalize(pStmt);
+      }
+    }
+  }
+  fossil_free(zPage);
+}
+
+/*
+** Write nByte bytes of content into the cache under zKey.  The content
+** is pContent or, if pContent is NULL, the content of file in.  If the
+** cache file does not exist, then this routine is a no-op.  Older cache
+** entries might be deleted.
+*/
+static void cacheStore(
+  const char *zKey,
+  Blob *pContent,
+  FILE *in,
+  int nByte
+){
   sqlite3 *db;
   sqlite3_stmt *pStmt;
+  sqlite3_int64 id;
   int rc = 0;
   int nKeep;
 
@@ -155,9 +237,16 @@ void cache_write(Blob *pContent, const char *zKey){
   sqlite3_exec(db, "BEGIN IMMEDIATE", 0, 0, 0);
   pStmt = cacheStmt(db, "INSERT INTO blob(data) VALUES(?1)");
   if( pStmt==0 ) goto cache_write_end;
-  sqlite3_bind_blob(pStmt, 1, blob_buffer(pContent), blob_size(pContent),
-                    SQLITE_STATIC);
+  if( pContent ){
+    sqlite3_bind_blob(pStmt, 1, blob_buffer(pContent), nByte, SQLITE_STATIC);
+  }else{
+    sqlite3_bind_zeroblob(pStmt, 1, nByte);
+  }
   if( sqlite3_step(pStmt)!=SQLITE_DONE ) goto cache_write_end;
+  id = sqlite3_last_insert_rowid(db);
+  if( pContent==0 && !cacheCopyFromFile(db, id, in, nByte) ){
+    goto cache_write_end;
+  }
   sqlite3_finalize(pStmt);
   pStmt = cacheStmt(db,
       "INSERT OR IGNORE INTO cache(key,sz,tm,nref,id)"
@@ -165,13 +254,16 @@ void cache_write(Blob *pContent, const char *zKey){
   );
   if( pStmt==0 ) goto cache_write_end;
   sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
-  sqlite3_bind_int(pStmt, 2, blob_size(pContent));
-  sqlite3_bind_int(pStmt, 3, sqlite3_last_insert_rowid(db));
+  sqlite3_bind_int(pStmt, 2, nByte);
+  sqlite3_bind_int64(pStmt, 3, id);
   if( sqlite3_step(pStmt)!=SQLITE_DONE) goto cache_write_end;
   rc = sqlite3_changes(db);
 
   /* If the write was successful, truncate the cache to keep at most
-  ** max-cache-entry entries in the cache.
+  ** max-cache-entry entries in the cache.  Web pages (keys that begin
+  ** with "page:") are not counted against max-cache-entry.  Instead, the
+  ** least recently used pages are removed once all pages together use
+  ** more than max-page-cache-size bytes.
   **
   ** The cache entry replacement algorithm is approximately LRU
   ** (least recently used).  However, each access of an entry buys
@@ -185,12 +277,29 @@ void cache_write(Blob *pContent, const char *zKey){
     pStmt = cacheStmt(db,
                  "DELETE FROM cache WHERE rowid IN ("
                     "SELECT rowid FROM cache"
+                    " WHERE key NOT GLOB 'page:*'"
                     " ORDER BY (tm + 3600*min(nRef,48)) DESC"
                     " LIMIT -1 OFFSET ?1)");
     if( pStmt ){
       sqlite3_bind_int(pStmt, 1, nKeep);
       sqlite3_step(pStmt);
     }
+    if( strncmp(zKey, "page:", 5)==0 ){
+      cachePageCount(db, 0);
+      sqlite3_finalize(pStmt);
+      pStmt = cacheStmt(db,
+                 "DELETE FROM cache WHERE rowid IN ("
+                    "SELECT rowid FROM ("
+                      "SELECT rowid, sum(sz) OVER ("
+                        "ORDER BY (tm + 3600*min(nRef,48)) DESC) AS tot"
+                      " FROM cache WHERE key GLOB 'page:*')"
+                    " WHERE tot>?1)");
+      if( pStmt ){
+        sqlite3_bind_int64(pStmt, 1,
+                           db_get_int("max-page-cache-size",20000000));
+        sqlite3_step(pStmt);
+      }
+    }
   }
 
 cache_write_end:
@@ -199,6 +308,79 @@ cache_write_end:
   sqlite3_close(db);
 }
 
+/*
+** Attempt to write pContent into the cache.  If the cache file does
+** not exist, then this routine is a no-op.  Older cache entries might
+** be deleted.
+*/
+void cache_write(Blob *pContent, const char *zKey){
+  cacheStore(zKey, pContent, 0, blob_size(pContent));
+}
+
+/*
+** Archives are sent to the client while they are being built, so they
+** are never held in memory as a whole.  To still get them into the
+** cache, the content is spooled into a temporary file by
+** cache_spool_write() as it is sent and moved into the cache by
+** cache_spool_finish().  Nothing is spooled if the repository has no
+** cache.
+*/
+static struct {
+  FILE *out;            /* The spool file, or NULL */
+  char *zKey;           /* The key for the spooled content */
+  sqlite3_int64 nByte;  /* Bytes written to the spool file so far */
+} cacheSpool;
+
+/*
+** Start spooling content to be stored in the cache under zKey.
+*/
+void cache_spool_begin(const char *zKey){
+  assert( cacheSpool.out==0 );
+  if( !cache_exists() ) return;
+  cacheSpool.out = tmpfile();
+  cacheSpool.zKey = fossil_strdup(zKey);
+  cacheSpool.nByte = 0;
+}
+
+/*
+** Append n bytes to the spooled content.
+*/
+void cache_spool_write(const char *z, int n){
+  if( cacheSpool.out==0 || n<=0 ) return;
+  if( fwrite(z, 1, n, cacheSpool.out)!=(size_t)n ){
+    fclose(cacheSpool.out);
+    cacheSpool.out = 0;
+  }
+  cacheSpool.nByte += n;
+}
+
+/*
+** Send n bytes of the reply to the client, and spool them for the cache.
+** This is the output routine of archives that are streamed.
+*/
+void cache_spool_and_send(const char *z, int n){
+  cgi_stream_write(z, n);
+  cache_spool_write(z, n);
+}
+
+/*
+** Store the spooled content in the cache and discard the spool file.
+** Content too large for a single cache entry is dropped.
+*/
+void cache_spool_finish(void){
+  if( cacheSpool.out ){
+    if( cacheSpool.nByte>0 && cacheSpool.nByte<0x7fffffff
+     && fflush(cacheSpool.out)==0
+    ){
+      cacheStore(cacheSpool.zKey, 0, cacheSpool.out, (int)cacheSpool.nByte);
+    }
+    fclose(cacheSpool.out);
+    cacheSpool.out = 0;
+  }
+  fossil_free(cacheSpool.zKey);
+  cacheSpool.zKey = 0;
+}
+
 /*
 ** Attempt to read content out of the cache with the given zKey.  Return
 ** non-zero on success and zero if unable to locate the content.
@@ -241,6 +423,626 @@ cache_read_done:
   return rc;
 }
 
+/*
+** If the cache holds content for zKey, send it as the reply to the
+** current request, a piece at a time, and return non-zero.  Return zero
+** if there is no such content.  The content type of the reply must be
+** set before calling this routine.
+**
+** Each piece is read in its own transaction, so that a slow client does
+** not lock other processes out of the cache.
+*/
+int cache_send(const char *zKey){
+  sqlite3 *db;
+  sqlite3_stmt *pStmt;
+  sqlite3_int64 id = 0;
+  int nByte = 0;
+  int iOfst;
+  char *zBuf;
+
+  db = cacheOpen(0);
+  if( db==0 ) return 0;
+  sqlite3_busy_timeout(db, 10000);
+  sqlite3_exec(db, "BEGIN IMMEDIATE", 0, 0, 0);
+  pStmt = cacheStmt(db,
+    "SELECT blob.id, length(blob.data) FROM cache, blob"
+    " WHERE cache.key=?1 AND cache.id=blob.id");
+  if( pStmt ){
+    sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      id = sqlite3_column_int64(pStmt, 0);
+      nByte = sqlite3_column_int(pStmt, 1);
+    }
+    sqlite3_finalize(pStmt);
+  }
+  if( id ){
+    pStmt = cacheStmt(db,
+              "UPDATE cache SET nref=nref+1, tm=strftime('%s','now')"
+              " WHERE key=?1");
+    if( pStmt ){
+      sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+      sqlite3_step(pStmt);
+      sqlite3_finalize(pStmt);
+    }
+  }
+  sqlite3_exec(db, "COMMIT", 0, 0, 0);
+  if( id==0 ){
+    sqlite3_close(db);
+    return 0;
+  }
+  zBuf = fossil_malloc(CACHE_CHUNK_SIZE);
+  cgi_stream_begin(nByte);
+  for(iOfst=0; iOfst<nByte; iOfst+=CACHE_CHUNK_SIZE){
+    sqlite3_blob *pBlob = 0;
+    int n = nByte - iOfst;
+    int rc;
+    if( n>CACHE_CHUNK_SIZE ) n = CACHE_CHUNK_SIZE;
+    rc = sqlite3_blob_open(db, "main", "blob", "data", id, 0, &pBlob);
+    if( rc==SQLITE_OK ) rc = sqlite3_blob_read(pBlob, zBuf, n, iOfst);
+    sqlite3_blob_close(pBlob);
+    if( rc!=SQLITE_OK ) break;  /* Entry evicted.  Truncate the reply */
+    cgi_stream_write(zBuf, n);
+  }
+  fossil_free(zBuf);
+  sqlite3_close(db);
+  return 1;
+}
+
+/*
+** Return true if the cache holds content for zKey.
+*/
+int cache_contains(const char *zKey){
+  sqlite3 *db;
+  sqlite3_stmt *pStmt;
+  int rc = 0;
+
+  db = cacheOpen(0);
+  if( db==0 ) return 0;
+  pStmt = cacheStmt(db, "SELECT 1 FROM cache WHERE key=?1");
+  if( pStmt ){
+    sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+    rc = sqlite3_step(pStmt)==SQLITE_ROW;
+    sqlite3_finalize(pStmt);
+  }
+  sqlite3_close(db);
+  return rc;
+}
+
+/*
+** Return the key under which the archive of check-in rid that the zType
+** page ("zip", "sqlar" or "tarball") builds is cached.  zName is the
+** top-level directory of the archive and zInclude and zExclude are the
+** in= and ex= query parameters, or NULL.  The caller must free the
+** result.
+*/
+char *cache_archive_key(
+  const char *zType,
+  int rid,
+  const char *zName,
+  const char *zInclude,
+  const char *zExclude
+){
+  Blob key;
+  blob_init(&key, 0, 0);
+  blob_appendf(&key, "/%s/%z", zType, rid_to_uuid(rid));
+  blob_appendf(&key, "/%q", zName);
+  if( zInclude ) blob_appendf(&key, ",in=%Q", zInclude);
+  if( zExclude ) blob_appendf(&key, ",ex=%Q", zExclude);
+  return blob_str(&key);
+}
+
+/*
+** Return a string that changes whenever artifacts or tags are added to
+** or removed from the repository.  Keys of cached content that depends
+** on the check-in graph or the tags as a whole, rather than on a single
+** artifact, include this string.  Additions raise the largest RID or
+** tagxref rowid.  Removals might leave both unchanged, so they are
+** counted separately by cache_content_removed().  The caller must free
+** the result.
+*/
+char *cache_repository_version(void){
+  return db_text("",
+     "SELECT printf('%%d-%%d-%%d', (SELECT max(rid) FROM blob),"
+     "  (SELECT max(rowid) FROM tagxref),"
+     "  (SELECT value FROM config WHERE name='rmcnt'))");
+}
+
+/*
+** Record that artifacts or tags have been removed from the repository,
+** so that the string returned by cache_repository_version() changes.
+** Cached web pages are deleted, as they might show the removed content.
+*/
+void cache_content_removed(void){
+  sqlite3 *db;
+  db_multi_exec(
+     "REPLACE INTO config(name,value,mtime)"
+     " VALUES('rmcnt',"
+     "   coalesce((SELECT value FROM config WHERE name='rmcnt'),0)+1, now())"
+  );
+  db = cacheOpen(0);
+  if( db ){
+    sqlite3_busy_timeout(db, 10000);
+    sqlite3_exec(db, "DELETE FROM cache WHERE key GLOB 'page:*'", 0, 0, 0);
+    sqlite3_close(db);
+  }
+}
+
+/*
+** Return true if the current repository has a cache database, so that
+** content handed to cache_write() will be kept.
+*/
+int cache_exists(void){
+  char *zDbName = cacheName();
+  int rc = zDbName!=0 && file_size(zDbName, ExtFILE)>0;
+  fossil_free(zDbName);
+  return rc;
+}
+
+/*
+** Fragments are small pieces of rendered content, such as the search
+** text of a document or the HTML body of a wiki page.  They are kept in
+** their own "fragment" table of the cache database, outside of the LRU
+** list of the "cache" table, as there is one entry per document.  The
+** connection stays open until cache_fragment_close().  Each write is
+** committed on its own, so that no lock on the cache database is held
+** between writes.  At most CACHE_FRAGMENT_MXROW entries are kept, the
+** oldest being removed first.
+*/
+#define CACHE_FRAGMENT_MXROW    50000
+static struct {
+  sqlite3 *db;             /* The cache database, or NULL */
+  sqlite3_stmt *pRead;     /* Statement to look up an entry */
+  sqlite3_stmt *pWrite;    /* Statement to add an entry */
+  int bTried;              /* True if the database has been opened */
+  int nWrite;              /* Total writes since the database was opened */
+} cacheFrag;
+
+/*
+** Return the cache database connection used for fragments, or NULL
+** if the repository has no cache.
+*/
+static sqlite3 *cacheFragmentDb(void){
+  if( !cacheFrag.bTried ){
+    cacheFrag.bTried = 1;
+    cacheFrag.db = cacheOpen(0);
+    if( cacheFrag.db==0 ) return 0;
+    if( sqlite3_exec(cacheFrag.db,
+          "CREATE TABLE IF NOT EXISTS fragment("
+            "key TEXT PRIMARY KEY,"  /* Kind of fragment and its source */
+            "tm INT,"                /* When added (unix timestamp) */
+            "data BLOB"              /* The fragment content */
+          ");", 0, 0, 0)!=SQLITE_OK
+     || (cacheFrag.pRead = cacheStmt(cacheFrag.db,
+           "SELECT data FROM fragment WHERE key=?1"))==0
+     || (cacheFrag.pWrite = cacheStmt(cacheFrag.db,
+           "REPLACE INTO fragment(key,tm,data)"
+           " VALUES(?1,strftime('%s','now'),?2)"))==0
+    ){
+      sqlite3_finalize(cacheFrag.pRead);
+      cacheFrag.pRead = 0;
+      sqlite3_close(cacheFrag.db);
+      cacheFrag.db = 0;
+    }
+  }
+  return cacheFrag.db;
+}
+
+/*
+** Append the cached fragment for zKey to pOut.  Return non-zero on
+** success and zero if there is no cache or no such entry.
+*/
+int cache_fragment_read(const char *zKey, Blob *pOut){
+  int rc = 0;
+  if( cacheFragmentDb()==0 ) return 0;
+  sqlite3_bind_text(cacheFrag.pRead, 1, zKey, -1, SQLITE_STATIC);
+  if( sqlite3_step(cacheFrag.pRead)==SQLITE_ROW ){
+    blob_append(pOut, sqlite3_column_blob(cacheFrag.pRead, 0),
+                      sqlite3_column_bytes(cacheFrag.pRead, 0));
+    rc = 1;
+  }
+  sqlite3_reset(cacheFrag.pRead);
+  return rc;
+}
+
+/*
+** Remember pText as the fragment for zKey.  This is a no-op if the
+** repository has no cache.
+*/
+void cache_fragment_write(const char *zKey, Blob *pText){
+  if( cacheFragmentDb()==0 ) return;
+  sqlite3_bind_text(cacheFrag.pWrite, 1, zKey, -1, SQLITE_STATIC);
+  sqlite3_bind_blob(cacheFrag.pWrite, 2, blob_buffer(pText),
+                    blob_size(pText), SQLITE_STATIC);
+  if( sqlite3_step(cacheFrag.pWrite)==SQLITE_DONE ){
+    cacheFrag.nWrite++;
+  }
+  sqlite3_reset(cacheFrag.pWrite);
+}
+
+/*
+** Trim the "fragment" table and close the connection.  This is called
+** when the repository is closed.
+*/
+void cache_fragment_close(void){
+  if( cacheFrag.db ){
+    if( cacheFrag.nWrite ){
+      char *zSql = sqlite3_mprintf(
+         "DELETE FROM fragment WHERE rowid IN ("
+         "SELECT rowid FROM fragment ORDER BY tm DESC LIMIT -1 OFFSET %d)",
+         CACHE_FRAGMENT_MXROW);
+      sqlite3_exec(cacheFrag.db, zSql, 0, 0, 0);
+      sqlite3_free(zSql);
+    }
+    sqlite3_finalize(cacheFrag.pRead);
+    sqlite3_finalize(cacheFrag.pWrite);
+    sqlite3_close(cacheFrag.db);
+  }
+  memset(&cacheFrag, 0, sizeof(cacheFrag));
+}
+
+/*
+** Abandon, without closing it, a fragment connection inherited through
+** fork().  The next fragment read or write opens a connection of its
+** own.
+*/
+void cache_fragment_forget(void){
+  memset(&cacheFrag, 0, sizeof(cacheFrag));
+}
+
+/*
+** Add to the current MD5 checksum the state of the repository and of
+** the request that rendered HTML depends on: the base URL, whether the
+** user may see hyperlinks, the skin, the settings, and the content of
+** the repository, as identified by its latest receipt.
+**
+** Only the values of the settings and of the skin, project and ticket
+** configuration are used.  Other CONFIG entries, such as the backoffice
+** lease or the counters kept by the backoffice, change without any
+** effect on the HTML and are left out.
+*/
+static void cacheDigestRenderState(void){
+  Stmt q;
+  const char *zSkin = skin_in_use();
+  char *zState = db_text(0,
+     "SELECT printf('%%s %%d %%d %%d %%s %%s', %Q, %d, %d,"
+     "  (SELECT max(rcvid) FROM rcvfrom),"
+     "  (SELECT value FROM config WHERE name='cfgcnt'), %Q)",
+     g.zTop, g.perm.Hyperlink, g.javascriptHyperlink, zSkin ? zSkin : ""
+  );
+  md5sum_step_text(zState, -1);
+  fossil_free(zState);
+  db_prepare(&q,
+     "SELECT name, value FROM config"
+     " WHERE name IN %s OR name IN %s"
+     "    OR name IN ('js','wysiwyg-wiki')"
+     "    OR name GLOB 'timeline-*' OR name GLOB 'wiki-*'"
+     "    OR name GLOB 'adunit*' OR name GLOB 'auto-hyperlink-*'"
+     "    OR name GLOB 'draft[1-9]-*'"
+     " ORDER BY name",
+     configure_inop_rhs(CONFIGSET_SKIN|CONFIGSET_CSS|CONFIGSET_PROJ
+                        |CONFIGSET_TKT),
+     db_setting_inop_rhs()
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    const char *zValue = db_column_raw(&q, 1);
+    md5sum_step_text(db_column_text(&q, 0), -1);
+    md5sum_step_text("=", 1);
+    md5sum_step_text(zValue, db_column_bytes(&q, 1));
+    md5sum_step_text("\n", 1);
+  }
+  db_finalize(&q);
+}
+
+/*
+** Return the effective capabilities of the current user as a string
+** with one "0" or "1" for each field of g.perm.  Pages that offer
+** different links or content to different users include this string
+** in their ETag or cache key.  The caller must free the result.
+*/
+char *cache_capabilities(void){
+  const char *aPerm = (const char*)&g.perm;
+  char *z = fossil_malloc( sizeof(g.perm)+1 );
+  int i;
+  for(i=0; i<(int)sizeof(g.perm); i++){
+    z[i] = aPerm[i] ? '1' : '0';
+  }
+  z[i] = 0;
+  return z;
+}
+
+/*
+** Return a fragment key for the HTML rendering of artifact zHash by
+** zRenderer.  Besides the artifact, the HTML depends on the base URL,
+** on whether the user may see hyperlinks, on the skin and the settings,
+** and on other content of the repository, such as whether a linked
+** ticket is closed.  A digest of all of these is part of the key, so
+** that any change simply leads to a new key, while CONFIG entries that
+** do not affect the HTML leave the key alone.  /wiki and /doc also use
+** the key as the base of their ETag.  The caller must free the result.
+*/
+char *cache_render_key(const char *zHash, const char *zRenderer){
+  md5sum_init();
+  cacheDigestRenderState();
+  return mprintf("html-%s-%s-%.16s", zRenderer, zHash, md5sum_finish(0));
+}
+
+/*
+** Web pages marked "cacheable" on their WEBPAGE: line are kept in the
+** cache table under keys of the form "page:URL:DIGEST", where URL is the
+** full path of the request and its query string.  The digest covers the
+** same state as cache_render_key() plus the user and their capabilities,
+** the display cookie and the Fossil executable, so a cached page is only
+** reused when it would be generated again unchanged.  A page may still
+** decide, once it sees its query parameters, that its reply depends on
+** the current time and call cache_page_veto() to keep it out of the
+** cache.
+**
+** A hit only reads the cache database, apart from the update of the
+** access time and use count of the entry and of the hit count of the
+** page.  The "pagestat" table counts the hits and the misses of each
+** page, by the first element of its path, for /cachestat.
+*/
+static int cachePageVetoed = 0;
+
+/*
+** Keep the reply to the current request out of the page cache.
+*/
+void cache_page_veto(void){
+  cachePageVetoed = 1;
+}
+
+/*
+** Return the page cache key for the current request, or NULL if the
+** request cannot use the page cache.  The caller must free the result.
+*/
+char *cache_page_key(void){
+  const char *zQuery = PD("QUERY_STRING","");
+  char zBuf[50];
+  char *zCap;
+  if( g.localOpen ) return 0;
+  if( fossil_strcmp(P("REQUEST_METHOD"),"GET")!=0 ) return 0;
+  if( !cache_exists() ) return 0;
+#ifdef FOSSIL_ENABLE_TH1_HOOKS
+  if( !g.fNoThHook && Th_AreHooksEnabled() ) return 0;
+#endif
+  login_check_credentials();
+  md5sum_init();
+  cacheDigestRenderState();
+  sqlite3_snprintf(sizeof(zBuf), zBuf, " %d %lld ",
+                   g.isHuman, file_mtime(g.nameOfExe, ExtFILE));
+  md5sum_step_text(zBuf, -1);
+  md5sum_step_text(g.zLogin ? g.zLogin : "", -1);
+  md5sum_step_text(" ", 1);
+  zCap = cache_capabilities();
+  md5sum_step_text(zCap, -1);
+  fossil_free(zCap);
+  md5sum_step_text(" ", 1);
+  md5sum_step_text(PD(DISPLAY_SETTINGS_COOKIE,""), -1);
+  return mprintf("page:/%s%s%s%s%s:%.16s", g.zPath,
+                 g.zExtra ? "/" : "", g.zExtra ? g.zExtra : "",
+                 zQuery[0] ? "?" : "", zQuery, md5sum_finish(0));
+}
+
+/*
+** Append the page cache entry for zKey to pContent and return true, or
+** return false if there is no such entry.  Unlike cache_read(), the
+** entry is read without first taking a write lock.  Only a hit writes to
+** the cache database, in a single transaction that updates the access
+** time and use count of the entry and the hit count of the page.
+*/
+static int cachePageRead(Blob *pContent, const char *zKey){
+  sqlite3 *db;
+  sqlite3_stmt *pStmt;
+  int rc = 0;
+
+  db = cacheOpen(0);
+  if( db==0 ) return 0;
+  pStmt = cacheStmt(db,
+    "SELECT blob.data FROM cache, blob"
+    " WHERE cache.key=?1 AND cache.id=blob.id");
+  if( pStmt ){
+    sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      blob_append(pContent, sqlite3_column_blob(pStmt, 0),
+                            sqlite3_column_bytes(pStmt, 0));
+      rc = 1;
+    }
+    sqlite3_finalize(pStmt);
+  }
+  if( rc ){
+    sqlite3_busy_timeout(db, 1000);
+    sqlite3_exec(db, "BEGIN IMMEDIATE", 0, 0, 0);
+    pStmt = cacheStmt(db,
+              "UPDATE cache SET nref=nref+1, tm=strftime('%s','now')"
+              " WHERE key=?1");
+    if( pStmt ){
+      sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+      sqlite3_step(pStmt);
+      sqlite3_finalize(pStmt);
+    }
+    cachePageCount(db, 1);
+    sqlite3_exec(db, "COMMIT", 0, 0, 0);
+  }
+  sqlite3_close(db);
+  return rc;
+}
+
+/*
+** If the page cache holds a reply for zKey, make it the reply to the
+** current request and return true.  Otherwise return false.
+**
+** A cached page starts with the nonce of the request that built it and
+** a newline.  That nonce is replaced by the nonce of this request.
+*/
+int cache_page_serve(const char *zKey){
+  Blob x;
+  char *z, *zNext;
+  char *zOld;                   /* Nonce of the request that built the page */
+  const char *zNonce;           /* Nonce of this request */
+  int nOld;
+  blob_init(&x, 0, 0);
+  if( !cachePageRead(&x, zKey) ) return 0;
+  z = blob_str(&x);
+  for(nOld=0; z[nOld] && z[nOld]!='\n'; nOld++){}
+  zOld = mprintf("%.*s", nOld, z);
+  z += nOld + (z[nOld]=='\n');
+  zNonce = style_nonce();
+  while( nOld>0 && (zNext = strstr(z, zOld))!=0 ){
+    cgi_append_content(z, (int)(zNext-z));
+    cgi_append_content(zNonce, -1);
+    z = zNext + nOld;
+  }
+  cgi_append_content(z, -1);
+  fossil_free(zOld);
+  blob_reset(&x);
+  return 1;
+}
+
+/*
+** Save the reply to the current request in the page cache under zKey,
+** unless it is not an ordinary HTML page or the page vetoed caching.
+*/
+void cache_page_store(const char *zKey){
+  Blob x;
+  if( cachePageVetoed || !cgi_reply_is_plain_html() ) return;
+  blob_init(&x, 0, 0);
+  blob_appendf(&x, "%s\n", style_nonce());
+  cgi_copy_content(&x);
+  cache_write(&x, zKey);
+  blob_reset(&x);
+}
+
+/*
+** Return the number of entries in the "fragment" table of cache database
+** db, or zero if there is no such table.
+*/
+static int cacheFragmentCount(sqlite3 *db){
+  sqlite3_stmt *pStmt;
+  int n = 0;
+  if( sqlite3_table_column_metadata(db,0,"fragment","key",0,0,0,0,0)
+        !=SQLITE_OK ){
+    return 0;
+  }
+  pStmt = cacheStmt(db, "SELECT count(*) FROM fragment");
+  if( pStmt && sqlite3_step(pStmt)==SQLITE_ROW ){
+    n = sqlite3_column_int(pStmt, 0);
+  }
+  sqlite3_finalize(pStmt);
+  return n;
+}
+
+/*
+** Build into the cache the ZIP archive and the tarball of check-in rid
+** that its /info page links to.
+*/
+static void cacheArchivesOf(int rid){
+  char *zUuid = rid_to_uuid(rid);
+  char *zName = info_archive_name(zUuid);
+  g.zOpenRevision = zUuid;
+  zip_pregenerate(rid, zName);
+  tarball_pregenerate(rid, zName);
+  g.zOpenRevision = 0;
+  fossil_free(zName);
+  fossil_free(zUuid);
+}
+
+/*
+** The CPU time in microseconds after which cache_backoffice() stops
+** starting to build the archives of another check-in.
+*/
+#define CACHE_BACKOFFICE_BUDGET  5000000
+
+/*
+** Build the archives of check-ins that received a tag matching the
+** archive-tag-glob setting, so that the first downloads of a new release
+** find them in the cache.  This routine is called by the backoffice.
+**
+** The "archive-tag-rcvid" config entry remembers the receipt of the last
+** tag handled, so each tag is handled once, as it arrives.  The archives
+** of one check-in are a slice of work: no new slice is started once the
+** time budget is spent, and the rest is left for a later run.  Tags that
+** arrived before the setting was first seen are not handled, except that
+** the archives of the newest matching check-in are built.
+*/
+void cache_backoffice(void){
+  char *zGlob;
+  char *zWhere;
+  int iMark;
+  int iDone;                  /* Receipts up to this one are handled */
+  int iLast;                  /* Receipt of the last check-in handled */
+  int iTimer;
+  int *aCand = 0;             /* Pairs of check-in rid and receipt */
+  int nCand = 0;
+  int nAlloc = 0;
+  int i;
+  Stmt q;
+
+  zGlob = db_get("archive-tag-glob", 0);
+  if( zGlob==0 || zGlob[0]==0 || !cache_exists() ){
+    fossil_free(zGlob);
+    return;
+  }
+  zWhere = mprintf(
+     "   FROM tagxref, tag, blob, event"
+     "  WHERE tag.tagid=tagxref.tagid AND tag.tagname GLOB 'sym-*'"
+     "    AND %s"
+     "    AND tagxref.tagtype>0"
+     "    AND blob.rid=tagxref.srcid"
+     "    AND event.objid=tagxref.rid AND event.type='ci'",
+     glob_expr("substr(tag.tagname,5)", zGlob)
+  );
+  iMark = db_get_int("archive-tag-rcvid", -1);
+  if( iMark<0 ){
+    int rid = db_int(0, "SELECT tagxref.rid %s ORDER BY event.mtime DESC",
+                     zWhere/*safe-for-%s*/);
+    if( rid ) cacheArchivesOf(rid);
+    db_set_int("archive-tag-rcvid",
+               db_int(0, "SELECT max(rcvid) FROM blob"), 0);
+    fossil_free(zWhere);
+    fossil_free(zGlob);
+    return;
+  }
+  /* Gather the candidates first, as building a tarball cannot run while
+  ** a statement is pending */
+  db_prepare(&q,
+     "SELECT tagxref.rid, max(coalesce(blob.rcvid,0)) AS rcvid %s"
+     " GROUP BY tagxref.rid HAVING rcvid>%d"
+     " ORDER BY rcvid, event.mtime",
+     zWhere/*safe-for-%s*/, iMark
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    if( nCand>=nAlloc ){
+      nAlloc = nAlloc*2 + 20;
+      aCand = fossil_realloc(aCand, nAlloc*2*sizeof(aCand[0]));
+    }
+    aCand[nCand*2] = db_column_int(&q, 0);
+    aCand[nCand*2+1] = db_column_int(&q, 1);
+    nCand++;
+  }
+  db_finalize(&q);
+  iDone = iLast = iMark;
+  iTimer = fossil_timer_start();
+  for(i=0; i<nCand; i++){
+    int rid = aCand[i*2];
+    int rcvid = aCand[i*2+1];
+    /* All tags of receipts up to iLast are handled once a later
+    ** receipt comes up */
+    if( rcvid>iLast ) iDone = iLast;
+    if( fossil_timer_fetch(iTimer)>=CACHE_BACKOFFICE_BUDGET ){
+      iLast = iDone;
+      break;
+    }
+    cacheArchivesOf(rid);
+    iLast = rcvid;
+  }
+  iDone = iLast;
+  fossil_timer_stop(iTimer);
+  fossil_free(aCand);
+  if( iDone>iMark ) db_set_int("archive-tag-rcvid", iDone, 0);
+  fossil_free(zWhere);
+  fossil_free(zGlob);
+}
+
 /*
 ** Create a cache database for the current repository if no such
 ** database already exists.
@@ -269,6 +1071,11 @@ void cache_initialize(void){
 ** The cache is stored in a file that is distinct from the repository
 ** but that is held in the same directory as the repository.  The cache
 ** file can be deleted in order to completely disable the cache.
+**
+** Besides archives, the cache holds web pages that are marked as
+** cacheable, such as /info and /vdiff.  The "max-cache-entry" value
+** limits the number of archives and the "max-page-cache-size" value
+** limits the total size of cached pages in bytes.
 */
 void cache_cmd(void){
   const char *zCmd;
@@ -299,7 +1106,9 @@ void cache_cmd(void){
   }else if( strncmp(zCmd, "clear", nCmd)==0 ){
     db = cacheOpen(0);
     if( db ){
-      sqlite3_exec(db, "DELETE FROM cache; DELETE FROM blob; VACUUM;",0,0,0);
+      sqlite3_exec(db, "DELETE FROM cache; DELETE FROM blob;"
+                       "DROP TABLE IF EXISTS fragment;"
+                       "DROP TABLE IF EXISTS pagestat; VACUUM;",0,0,0);
       sqlite3_close(db);
       fossil_print("cache cleared\n");
     }else{
@@ -330,9 +1139,10 @@ void cache_cmd(void){
         }
         sqlite3_finalize(pStmt);
       }
+      fossil_print("Entries: %d  Fragments: %d"
+                   "  Cache-file Size: %lld\n",
+                   nEntry, cacheFragmentCount(db), file_size(zDbName, ExtFILE));
       sqlite3_close(db);
-      fossil_print("Entries: %d  Cache-file Size: %lld\n",
-                   nEntry, file_size(zDbName, ExtFILE));
       fossil_free(zDbName);
     }
   }else if( strncmp(zCmd, "status", nCmd)==0 ){
@@ -383,6 +1193,35 @@ void cache_page(void){
     bigSizeName(sizeof(zBuf), zBuf, file_size(zDbName, ExtFILE));
     @ <p>cache-file name: %h(zDbName)</p>
     @ <p>cache-file size: %s(zBuf)</p>
+    @ <p>fragments: %d(cacheFragmentCount(db))</p>
+    pStmt = cacheStmt(db,
+         "SELECT page,"
+         "       (SELECT count(*) FROM cache"
+         "         WHERE key GLOB 'page:'||page||'[/?:]*'),"
+         "       nhit, nmiss,"
+         "       printf('%.1f%%', 100.0*nhit/max(nhit+nmiss,1))"
+         "  FROM pagestat ORDER BY nhit+nmiss DESC");
+    if( pStmt ){
+      int bFirst = 1;
+      while( sqlite3_step(pStmt)==SQLITE_ROW ){
+        if( bFirst ){
+          @ <h2>Cached Pages</h2>
+          @ <table border="1" cellpadding="3" cellspacing="0">
+          @ <tr><th>Page</th><th>Entries</th><th>Hits</th><th>Misses</th>
+          @ <th>Hit Ratio</th></tr>
+          bFirst = 0;
+        }
+        @ <tr><td>%h(sqlite3_column_text(pStmt,0))</td>
+        @ <td align="right">%d(sqlite3_column_int(pStmt,1))</td>
+        @ <td align="right">%d(sqlite3_column_int(pStmt,2))</td>
+        @ <td align="right">%d(sqlite3_column_int(pStmt,3))</td>
+        @ <td align="right">%s(sqlite3_column_text(pStmt,4))</td></tr>
+      }
+      sqlite3_finalize(pStmt);
+      if( !bFirst ){
+        @ </table>
+      }
+    }
     fossil_free(zDbName);
     sqlite3_close(db);
   }
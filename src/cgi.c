@@ -41,6 +41,7 @@
 # include <sys/time.h>
 # include <sys/wait.h>
 # include <sys/select.h>
+# include <sys/stat.h>
 #endif
 #ifdef __EMX__
   typedef int socklen_t;
@@ -191,6 +192,24 @@ void cgi_set_content(Blob *pNewContent){
   blob_zero(pNewContent);
 }
 
+/*
+** Return true if the reply is an ordinary HTML page: status 200, no
+** extra header lines such as cookies, and a content type of text/html.
+*/
+int cgi_reply_is_plain_html(void){
+  return (iReplyStatus==200 || iReplyStatus<=0)
+      && blob_size(&extraHeader)==0
+      && fossil_strcmp(zContentType, "text/html")==0;
+}
+
+/*
+** Append the reply content generated so far to pOut.
+*/
+void cgi_copy_content(Blob *pOut){
+  blob_append(pOut, blob_buffer(&cgiContent[0]), blob_size(&cgiContent[0]));
+  blob_append(pOut, blob_buffer(&cgiContent[1]), blob_size(&cgiContent[1]));
+}
+
 /*
 ** Set the reply status code
 */
@@ -251,10 +270,29 @@ static int is_gzippable(void){
 }
 
 /*
-** Do a normal HTTP reply
+** Set when the body of the reply has been streamed by cgi_stream_write().
+** 1: streaming  2: streaming a reply to a HEAD request, body discarded
+** 3: the body is gathered in memory for an ordinary reply.
+** The header of a streamed reply is held back until the first piece of
+** the body is ready, so that an error found before then still gets an
+** ordinary error reply.  cgiStreamSize is the Content-Length, or negative
+** if unknown, while the header is pending, and -2 once it is sent.
 */
-void cgi_reply(void){
-  int total_size;
+static int cgiStreamed = 0;
+static int cgiStreamSize = -2;
+
+/*
+** A streamed reply of unknown size that does not go straight to a socket
+** is spooled into this file, and sent with a Content-Length once it is
+** complete.
+*/
+static FILE *cgiStreamSpool = 0;
+
+/*
+** Write the header lines of the reply that do not depend on the
+** content of the body, ending with the Content-Type line.
+*/
+static void cgi_reply_header(void){
   if( iReplyStatus<=0 ){
     iReplyStatus = 200;
     zReplyStatus = "OK";
@@ -309,6 +347,157 @@ void cgi_reply(void){
   ** the browser, not some shared location.
   */
   fprintf(g.httpOut, "Content-Type: %s; charset=utf-8\r\n", zContentType);
+}
+
+/*
+** Return true if the reply is written directly to a socket, as it is
+** for "fossil server" and SCGI, and not to a pipe, as it is for CGI.
+*/
+static int cgi_output_is_socket(void){
+#ifndef _WIN32
+  struct stat sb;
+  return g.httpOut!=0 && fstat(fileno(g.httpOut), &sb)==0
+      && S_ISSOCK(sb.st_mode);
+#else
+  return 0;
+#endif
+}
+
+/*
+** Arrange for the body of the reply to be written directly to the
+** client by cgi_stream_write(), rather than accumulated in memory.  This
+** is used for large replies such as archives.  nByte is the size of the
+** body, or negative if it is not known in advance, in which case the end
+** of the body is marked by closing the connection.  The content type
+** must be set first.  The header is sent with the first piece of the
+** body.
+**
+** A client can only tell a failed reply of unknown size from a complete
+** one if the connection is reset, which needs a socket.  Otherwise, as
+** behind a web server that runs Fossil as CGI, the body is spooled to a
+** temporary file instead, and sent by cgi_reply() with a Content-Length.
+** If no temporary file can be made, as in a chroot jail without /tmp,
+** the body is gathered in memory for an ordinary reply.
+*/
+void cgi_stream_begin(int nByte){
+  assert( cgiStreamed==0 );
+  blob_reset(&cgiContent[0]);
+  blob_reset(&cgiContent[1]);
+  cgiStreamed = fossil_strcmp(P("REQUEST_METHOD"),"HEAD")==0 ? 2 : 1;
+  cgiStreamSize = nByte<0 ? -1 : nByte;
+  if( nByte<0 && cgiStreamed==1 && !cgi_output_is_socket() ){
+    cgiStreamSpool = tmpfile();
+    if( cgiStreamSpool==0 ) cgiStreamed = 3;
+  }
+}
+
+/*
+** Send the header of a streamed reply, if it has not been sent yet.
+*/
+static void cgi_stream_header(void){
+  if( cgiStreamSize==-2 ) return;
+  cgi_reply_header();
+  if( cgiStreamSize>=0 ){
+    fprintf(g.httpOut, "Content-Length: %d\r\n", cgiStreamSize);
+  }
+  fprintf(g.httpOut, "\r\n");
+  cgiStreamSize = -2;
+}
+
+/*
+** Send n bytes of the body of a reply started by cgi_stream_begin().
+** This is a no-op if no such reply is in progress, or if this process
+** no longer talks to the client, as in a backoffice child.
+*/
+void cgi_stream_write(const char *z, int n){
+  if( cgiStreamed==3 ){
+    blob_append(&cgiContent[0], z, n);
+  }else if( cgiStreamed==1 && g.httpOut!=0 && n>0 ){
+    if( cgiStreamSpool ){
+      if( fwrite(z, 1, n, cgiStreamSpool)!=(size_t)n ){
+        fossil_fatal("cannot spool the reply");
+      }
+      return;
+    }
+    cgi_stream_header();
+    fwrite(z, 1, n, g.httpOut);
+  }
+}
+
+/*
+** Send the body spooled by cgi_stream_write(), preceded by the header,
+** and discard the spool file.
+*/
+static void cgi_stream_send_spool(void){
+  char zBuf[8192];
+  size_t n;
+  FILE *in = cgiStreamSpool;
+  cgiStreamSpool = 0;
+  cgiStreamSize = (int)ftell(in);
+  cgi_stream_header();
+  rewind(in);
+  while( (n = fread(zBuf, 1, sizeof(zBuf), in))>0 ){
+    fwrite(zBuf, 1, n, g.httpOut);
+  }
+  fclose(in);
+}
+
+/*
+** Called on a fatal error while the reply is being streamed.  If the
+** header has not been sent yet, which is always the case for a spooled
+** reply, go back to an ordinary reply, so that the error is reported,
+** and return false.  Otherwise the client has already been told that the
+** request succeeded, so reset the connection, which a client sees as a
+** failed download rather than a short one, and return true.  Return
+** false if the reply is not streamed.
+*/
+int cgi_stream_abort(void){
+  if( cgiStreamed==0 ) return 0;
+  if( cgiStreamSize!=-2 ){
+    if( cgiStreamSpool ){
+      fclose(cgiStreamSpool);
+      cgiStreamSpool = 0;
+    }
+    cgiStreamed = 0;
+    cgiStreamSize = -2;
+    return 0;
+  }
+  if( g.httpOut ){
+#ifndef _WIN32
+    struct linger sLinger;
+    sLinger.l_onoff = 1;
+    sLinger.l_linger = 0;
+    setsockopt(fileno(g.httpOut), SOL_SOCKET, SO_LINGER,
+               &sLinger, sizeof(sLinger));
+    close(fileno(g.httpOut));
+#endif
+  }
+  return 1;
+}
+
+/*
+** Do a normal HTTP reply
+*/
+void cgi_reply(void){
+  int total_size;
+  if( cgiStreamed==3 ){
+    cgiStreamed = 0;
+    cgiStreamSize = -2;
+  }
+  if( cgiStreamed ){
+    if( cgiStreamSpool ){
+      cgi_stream_send_spool();
+    }else{
+      cgi_stream_header();
+    }
+    fflush(g.httpOut);
+    g.cgiOutput = 2;
+    if( g.db!=0 ){
+      backoffice_check_if_needed();
+    }
+    return;
+  }
+  cgi_reply_header();
   if( fossil_strcmp(zContentType,"application/x-fossil")==0 ){
     cgi_combine_header_and_body();
     blob_compress(&cgiContent[0], &cgiContent[0]);
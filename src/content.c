@@ -222,6 +222,27 @@ static int content_of_blob(int rid, Blob *pBlob){
   return rc;
 }
 
+/*
+** If artifact rid is stored whole rather than as a delta, put the
+** compressed form in which it is stored, as made by blob_compress(),
+** into the uninitialized blob pBlob and return 1.  Otherwise zero
+** pBlob and return 0.
+*/
+int content_get_stored(int rid, Blob *pBlob){
+  static Stmt q;
+  int rc = 0;
+  blob_zero(pBlob);
+  if( delta_source_rid(rid)!=0 ) return 0;
+  db_static_prepare(&q, "SELECT content FROM blob WHERE rid=:rid AND size>=0");
+  db_bind_int(&q, ":rid", rid);
+  if( db_step(&q)==SQLITE_ROW ){
+    db_column_blob(&q, 0, pBlob);
+    rc = 1;
+  }
+  db_reset(&q);
+  return rc;
+}
+
 /*
 ** Extract the content for ID rid and put it into the
 ** uninitialized blob.  Return 1 on success.  If the record
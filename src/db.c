@@ -57,6 +57,7 @@ struct Stmt {
   Stmt *pNext, *pPrev;    /* List of all unfinalized statements */
   int nStep;              /* Number of sqlite3_step() calls */
   int rc;                 /* Error from db_vprepare() */
+  int prepFlags;          /* Flags passed to sqlite3_prepare_v3() */
 };
 
 /*
@@ -64,7 +65,7 @@ struct Stmt {
 ** is useful to help avoid assertions when performing cleanup in some
 ** error handling cases.
 */
-#define empty_Stmt_m {BLOB_INITIALIZER,NULL, NULL, NULL, 0, 0}
+#define empty_Stmt_m {BLOB_INITIALIZER,NULL, NULL, NULL, 0, 0, 0}
 #endif /* INTERFACE */
 const struct Stmt empty_Stmt = empty_Stmt_m;
 
@@ -91,6 +92,11 @@ static void db_err(const char *zFormat, ...){
   fossil_fatal("Database error: %s", z);
 }
 
+/*
+** Number of finalized statements kept in the statement cache.
+*/
+#define DB_STMT_CACHE_SZ  50
+
 /*
 ** All static variable that a used by only this file are gathered into
 ** the following structure.
@@ -101,6 +107,29 @@ static struct DbLocalData {
   int nCommitHook;          /* Number of commit hooks */
   Stmt *pAllStmt;           /* List of all unfinalized statements */
   int nPrepare;             /* Number of calls to sqlite3_prepare_v2() */
+  int nPrepareAvoided;      /* Prepares satisfied from the statement cache */
+  unsigned int iStmtUse;    /* Counter used for LRU in aStmtCache[] */
+  struct sStmtCache {
+    sqlite3_stmt *pStmt;        /* A reset statement.  NULL if slot unused */
+    unsigned int h;             /* Hash of the SQL text of pStmt */
+    int prepFlags;              /* sqlite3_prepare_v3() flags of pStmt */
+    unsigned int iUse;          /* Value of iStmtUse when last added */
+  } aStmtCache[DB_STMT_CACHE_SZ];
+  int bSqlProf;             /* True while the SQL profiler is collecting */
+  int nProf;                /* Number of entries in aProf[] */
+  int nProfAlloc;           /* Space allocated for aProf[] */
+  struct sSqlProf {
+    char *zSql;                 /* Normalized SQL text */
+    unsigned int h;             /* Hash of zSql */
+    int nCall;                  /* Number of times the statement ran */
+    sqlite3_int64 nRow;         /* Total rows returned */
+    sqlite3_int64 nNs;          /* Total run time in nanoseconds */
+  } *aProf;
+  int nProfActive;          /* Number of entries in aProfActive[] */
+  struct sProfActive {
+    sqlite3_stmt *pStmt;        /* A statement that has returned rows */
+    sqlite3_int64 nRow;         /* Rows returned by pStmt so far */
+  } aProfActive[20];
   int nDeleteOnFail;        /* Number of entries in azDeleteOnFail[] */
   struct sCommitHook {
     int (*xHook)(void);         /* Functions to call at db_end_transaction() */
@@ -235,6 +264,8 @@ void db_end_transaction(int rollbackFlag){
     while( db.pAllStmt ){
       db_finalize(db.pAllStmt);
     }
+    if( db.doRollback ) manifest_cache_clear();
+    manifest_zcard_forget();
     db_multi_exec("%s", db.doRollback ? "ROLLBACK" : "COMMIT");
     db.doRollback = 0;
   }
@@ -257,6 +288,8 @@ void db_force_rollback(void){
     db_finalize(db.pAllStmt);
   }
   if( db.nBegin ){
+    manifest_cache_clear();
+    manifest_zcard_forget();
     sqlite3_exec(g.db, "ROLLBACK", 0, 0, 0);
     db.nBegin = 0;
   }
@@ -296,6 +329,88 @@ void db_commit_hook(int (*x)(void), int sequence){
   db.nCommitHook++;
 }
 
+/*
+** Hash function for the SQL text of statements in the statement cache.
+*/
+static unsigned int db_sql_hash(const char *z){
+  unsigned int h = 0;
+  while( *z ){ h = (h<<3) ^ h ^ (unsigned char)*(z++); }
+  return h;
+}
+
+/*
+** Finalized statements are kept in a small LRU cache keyed by their SQL
+** text and prepare flags.  db_vprepare() and db_prepare_blob() look in
+** this cache first, so that code which prepares the same SQL over and
+** over, often through db_int(), db_exists() or db_text() inside a loop,
+** does not have to parse that SQL again each time.
+**
+** Remove and return a statement for zSql prepared with prepFlags on the
+** g.db connection, or return NULL if there is no such statement in the
+** cache.
+*/
+static sqlite3_stmt *db_stmt_cache_take(const char *zSql, int prepFlags){
+  unsigned int h = db_sql_hash(zSql);
+  int i;
+  for(i=0; i<DB_STMT_CACHE_SZ; i++){
+    struct sStmtCache *p = &db.aStmtCache[i];
+    if( p->pStmt && p->h==h && p->prepFlags==prepFlags
+     && sqlite3_db_handle(p->pStmt)==g.db
+     && strcmp(sqlite3_sql(p->pStmt), zSql)==0
+    ){
+      sqlite3_stmt *pStmt = p->pStmt;
+      p->pStmt = 0;
+      db.nPrepareAvoided++;
+      return pStmt;
+    }
+  }
+  return 0;
+}
+
+/*
+** Reset pStmt, which was prepared with prepFlags, and add it to the
+** statement cache, evicting the least recently added statement if the
+** cache is full.  Statements whose
+** last step failed are finalized instead.  Return the result code
+** that sqlite3_finalize() would have returned.
+*/
+static int db_stmt_cache_put(sqlite3_stmt *pStmt, int prepFlags){
+  int i, iSlot = 0;
+  int rc;
+  if( pStmt==0 ) return SQLITE_OK;
+  rc = sqlite3_reset(pStmt);
+  if( rc!=SQLITE_OK ){
+    sqlite3_finalize(pStmt);
+    return rc;
+  }
+  sqlite3_clear_bindings(pStmt);
+  for(i=0; i<DB_STMT_CACHE_SZ; i++){
+    if( db.aStmtCache[i].pStmt==0 ){
+      iSlot = i;
+      break;
+    }
+    if( db.aStmtCache[i].iUse<db.aStmtCache[iSlot].iUse ) iSlot = i;
+  }
+  sqlite3_finalize(db.aStmtCache[iSlot].pStmt);
+  db.aStmtCache[iSlot].pStmt = pStmt;
+  db.aStmtCache[iSlot].h = db_sql_hash(sqlite3_sql(pStmt));
+  db.aStmtCache[iSlot].prepFlags = prepFlags;
+  db.aStmtCache[iSlot].iUse = ++db.iStmtUse;
+  return SQLITE_OK;
+}
+
+/*
+** Finalize all statements in the statement cache.  This must be done
+** before closing any connection that g.db has referred to.
+*/
+void db_stmt_cache_clear(void){
+  int i;
+  for(i=0; i<DB_STMT_CACHE_SZ; i++){
+    sqlite3_finalize(db.aStmtCache[i].pStmt);
+    db.aStmtCache[i].pStmt = 0;
+  }
+}
+
 #if INTERFACE
 /*
 ** Possible flags to db_vprepare
@@ -317,11 +432,17 @@ int db_vprepare(Stmt *pStmt, int flags, const char *zFormat, va_list ap){
   blob_vappendf(&pStmt->sql, zFormat, ap);
   va_end(ap);
   zSql = blob_str(&pStmt->sql);
-  db.nPrepare++;
   if( flags & DB_PREPARE_PERSISTENT ){
     prepFlags = SQLITE_PREPARE_PERSISTENT;
   }
-  rc = sqlite3_prepare_v3(g.db, zSql, -1, prepFlags, &pStmt->pStmt, 0);
+  pStmt->prepFlags = prepFlags;
+  pStmt->pStmt = db_stmt_cache_take(zSql, prepFlags);
+  if( pStmt->pStmt ){
+    rc = SQLITE_OK;
+  }else{
+    db.nPrepare++;
+    rc = sqlite3_prepare_v3(g.db, zSql, -1, prepFlags, &pStmt->pStmt, 0);
+  }
   if( rc!=0 && (flags & DB_PREPARE_IGNORE_ERROR)==0 ){
     db_err("%s\n%s", sqlite3_errmsg(g.db), zSql);
   }
@@ -379,8 +500,14 @@ int db_prepare_blob(Stmt *pStmt, Blob *pSql){
   pStmt->sql = *pSql;
   blob_init(pSql, 0, 0);
   zSql = blob_sql_text(&pStmt->sql);
-  db.nPrepare++;
-  rc = sqlite3_prepare_v3(g.db, zSql, -1, 0, &pStmt->pStmt, 0);
+  pStmt->prepFlags = 0;
+  pStmt->pStmt = db_stmt_cache_take(zSql, 0);
+  if( pStmt->pStmt ){
+    rc = SQLITE_OK;
+  }else{
+    db.nPrepare++;
+    rc = sqlite3_prepare_v3(g.db, zSql, -1, 0, &pStmt->pStmt, 0);
+  }
   if( rc!=0 ){
     db_err("%s\n%s", sqlite3_errmsg(g.db), zSql);
   }
@@ -496,7 +623,7 @@ int db_finalize(Stmt *pStmt){
   pStmt->pPrev = 0;
   db_stats(pStmt);
   blob_reset(&pStmt->sql);
-  rc = sqlite3_finalize(pStmt->pStmt);
+  rc = db_stmt_cache_put(pStmt->pStmt, pStmt->prepFlags);
   db_check_result(rc);
   pStmt->pStmt = 0;
   return rc;
@@ -1010,6 +1137,8 @@ void db_add_aux_functions(sqlite3 *db){
                           capability_fullcap, 0, 0);
   sqlite3_create_function(db, "find_emailaddr", 1, SQLITE_UTF8, 0,
                           alert_find_emailaddr_func, 0, 0);
+  sqlite3_create_function(db, "pathbloom_test", 2, SQLITE_UTF8, 0,
+                          manifest_pathbloom_test_func, 0, 0);
 }
 
 #if USE_SEE
@@ -1237,7 +1366,7 @@ LOCAL sqlite3 *db_open(const char *zDbName){
   sqlite3_create_function(
     db, "if_selected", 3, SQLITE_UTF8, 0, file_is_selected,0,0
   );
-  if( g.fSqlTrace ) sqlite3_trace_v2(db, SQLITE_TRACE_STMT, db_sql_trace, 0);
+  db_set_trace(db);
   db_add_aux_functions(db);
   re_add_sql_func(db);  /* The REGEXP operator */
   foci_register(db);    /* The "files_of_checkin" virtual table */
@@ -1345,12 +1474,14 @@ void db_close_config(){
     g.zConfigDbName = 0;
   }else if( g.dbConfig ){
     sqlite3_wal_checkpoint(g.dbConfig, 0);
+    db_stmt_cache_clear();
     sqlite3_close(g.dbConfig);
     g.dbConfig = 0;
     g.zConfigDbName = 0;
   }else if( g.db && 0==iSlot ){
     int rc;
     sqlite3_wal_checkpoint(g.db, 0);
+    db_stmt_cache_clear();
     rc = sqlite3_close(g.db);
     if( g.fSqlTrace ) fossil_trace("-- db_close_config(%d)\n", rc);
     g.db = 0;
@@ -1631,6 +1762,32 @@ int db_allow_symlinks(void){
   return g.allowSymlinks;
 }
 
+/*
+** Apply the "mmap-size" and "cache-size" settings to the connection to
+** the repository database.  The --mmap-size and --cache-size command-line
+** options override the settings.  Both values are in megabytes.  A value
+** of zero in a setting means to use the SQLite default, but a zero given
+** on the command-line is applied, so that memory-mapped I/O can be turned
+** off for one command.
+**
+** Settings are read from the repository first and then from the global
+** configuration.  Because the global configuration is not consulted by
+** "fossil server" and "fossil cgi", a repository can be tuned for web
+** traffic while the global values continue to apply to CLI commands.
+*/
+static void db_tune_repository(void){
+  int szMmap, szCache;
+  szMmap = g.zMmapSize ? atoi(g.zMmapSize) : db_get_int("mmap-size", 0);
+  if( szMmap>0 || g.zMmapSize ){
+    db_multi_exec("PRAGMA repository.mmap_size=%lld",
+                  (i64)(szMmap>0 ? szMmap : 0)*1048576);
+  }
+  szCache = g.zCacheSize ? atoi(g.zCacheSize) : db_get_int("cache-size", 0);
+  if( szCache>0 ){
+    db_multi_exec("PRAGMA repository.cache_size=%d", -1024*szCache);
+  }
+}
+
 /*
 ** Open the repository database given by zDbName.  If zDbName==NULL then
 ** get the name from the already open local database.
@@ -1673,6 +1830,7 @@ void db_open_repository(const char *zDbName){
   g.allowSymlinks = db_get_boolean("allow-symlinks",
                                    db_allow_symlinks_by_default());
   g.zAuxSchema = db_get("aux-schema","");
+  db_tune_repository();
   g.eHashPolicy = db_get_int("hash-policy",-1);
   if( g.eHashPolicy<0 ){
     g.eHashPolicy = hname_default_policy();
@@ -1929,15 +2087,24 @@ void db_close(int reportErrors){
     sqlite3_status(SQLITE_STATUS_PAGECACHE_OVERFLOW, &cur, &hiwtr, 0);
     fprintf(stderr, "-- PCACHE_OVFLOW          %10d %10d\n", cur, hiwtr);
     fprintf(stderr, "-- prepared statements    %10d\n", db.nPrepare);
+    fprintf(stderr, "-- prepares avoided       %10d\n", db.nPrepareAvoided);
   }
   while( db.pAllStmt ){
     db_finalize(db.pAllStmt);
   }
+  manifest_cache_clear();
+  cache_fragment_close();
   if( db.nBegin && reportErrors ){
     fossil_warning("Transaction started at %s:%d never commits",
                    db.zStartFile, db.iStartLine);
     db_end_transaction(1);
   }
+  if( db.bSqlProf ){
+    if( g.repositoryOpen && db.nBegin==0 && db_get_boolean("sql-profile",0) ){
+      db_sqlprof_save("repository", g.zPath ? g.zPath : g.zCmdName);
+    }
+    db_sqlprof_stop();
+  }
   pStmt = 0;
   g.dbIgnoreErrors++; /* Stop "database locked" warnings from PRAGMA optimize */
   sqlite3_exec(g.db, "PRAGMA optimize", 0, 0, 0);
@@ -1958,6 +2125,7 @@ void db_close(int reportErrors){
   if( g.db ){
     int rc;
     sqlite3_wal_checkpoint(g.db, 0);
+    db_stmt_cache_clear();
     rc = sqlite3_close(g.db);
     if( g.fSqlTrace ) fossil_trace("-- sqlite3_close(%d)\n", rc);
     if( rc==SQLITE_BUSY && reportErrors ){
@@ -1981,6 +2149,7 @@ void db_panic_close(void){
   if( g.db ){
     int rc;
     sqlite3_wal_checkpoint(g.db, 0);
+    db_stmt_cache_clear();
     rc = sqlite3_close(g.db);
     if( g.fSqlTrace ) fossil_trace("-- sqlite3_close(%d)\n", rc);
   }
@@ -1989,6 +2158,40 @@ void db_panic_close(void){
   g.localOpen = 0;
 }
 
+#if !defined(_WIN32)
+/*
+** Called in a process just created by fork() to give it a connection of
+** its own to the repository, and to the user database if the parent had
+** one.  The process must only read from them, as the parent still holds
+** its own connections.  Those inherited from the parent are abandoned,
+** not closed, as closing them would touch state that still belongs to
+** the parent.  Static statements are prepared again on first use.  The
+** process must end with _exit().
+*/
+void db_reopen_after_fork(void){
+  Stmt *p;
+  for(p=db.pAllStmt; p; p=p->pNext){
+    blob_zero(&p->sql);
+    p->pStmt = 0;
+  }
+  db.pAllStmt = 0;
+  db.nBegin = 0;
+  db.doRollback = 0;
+  memset(db.aStmtCache, 0, sizeof(db.aStmtCache));
+  cache_fragment_forget();
+  g.db = db_open(g.zRepositoryName);
+  db_set_main_schemaname(g.db, "repository");
+  g.localOpen = 0;
+  g.dbConfig = 0;
+  if( g.zConfigDbName && file_access(g.zConfigDbName, R_OK)==0 ){
+    g.dbConfig = db_open(g.zConfigDbName);
+    db_set_main_schemaname(g.dbConfig, "configdb");
+  }else{
+    g.zConfigDbName = 0;
+  }
+}
+#endif
+
 /*
 ** Create a new empty repository database with the given name.
 **
@@ -2286,6 +2489,10 @@ LOCAL int db_sql_trace(unsigned m, void *notUsed, void *pP, void *pX){
   char *zSql;
   int n;
   const char *zArg = (const char*)pX;
+  if( m!=SQLITE_TRACE_STMT ){
+    if( db.bSqlProf ) db_sqlprof_event(m, pStmt, pX);
+    return 0;
+  }
   if( zArg[0]=='-' ) return 0;
   zSql = sqlite3_expanded_sql(pStmt);
   n = (int)strlen(zSql);
@@ -2294,6 +2501,213 @@ LOCAL int db_sql_trace(unsigned m, void *notUsed, void *pP, void *pX){
   return 0;
 }
 
+
+/*
+** Set the trace callback on database connection pDb to match the
+** current --sqltrace option and the state of the SQL profiler.
+*/
+LOCAL void db_set_trace(sqlite3 *pDb){
+  unsigned mTrace = 0;
+  if( g.fSqlTrace ) mTrace |= SQLITE_TRACE_STMT;
+  if( db.bSqlProf ) mTrace |= SQLITE_TRACE_PROFILE|SQLITE_TRACE_ROW;
+  sqlite3_trace_v2(pDb, mTrace, mTrace ? db_sql_trace : 0, 0);
+}
+
+/*
+** Return a copy of the SQL text zSql in which literal strings, blobs
+** and numbers are replaced by "?", comma-separated lists of literals
+** are collapsed to a single "?", and runs of whitespace are reduced to
+** a single space.  Statements that differ only in the values that were
+** formatted into them thus share a single profile entry.
+**
+** Space to hold the returned string is obtained from fossil_malloc().
+*/
+static char *db_sqlprof_normalize(const char *zSql){
+  int n = (int)strlen(zSql);
+  char *z = fossil_malloc(n+1);
+  int i = 0, j = 0;
+  while( zSql[i] ){
+    char c = zSql[i];
+    if( fossil_isspace(c) ){
+      while( fossil_isspace(zSql[i]) ) i++;
+      if( j>0 && zSql[i] ) z[j++] = ' ';
+      continue;
+    }
+    if( c=='\'' || ((c=='x' || c=='X') && zSql[i+1]=='\''
+                    && (i==0 || !fossil_isalnum(zSql[i-1]))) ){
+      if( c!='\'' ) i++;
+      for(i++; zSql[i]; i++){
+        if( zSql[i]=='\'' ){
+          if( zSql[i+1]!='\'' ){ i++; break; }
+          i++;
+        }
+      }
+    }else if( fossil_isdigit(c) && (i==0 || (!fossil_isalnum(zSql[i-1])
+                                             && zSql[i-1]!='_')) ){
+      while( fossil_isalnum(zSql[i]) || zSql[i]=='.' ) i++;
+    }else if( c=='"' || c=='[' || c=='`' ){
+      char cEnd = c=='[' ? ']' : c;
+      z[j++] = zSql[i++];
+      while( zSql[i] && zSql[i]!=cEnd ) z[j++] = zSql[i++];
+      if( zSql[i] ) z[j++] = zSql[i++];
+      continue;
+    }else{
+      z[j++] = zSql[i++];
+      continue;
+    }
+    /* A literal was just skipped.  Emit a "?", unless it continues
+    ** a list of literals already written as "?". */
+    if( j>=2 && z[j-1]==',' && z[j-2]=='?' ){
+      j--;
+    }else if( j>=3 && z[j-1]==' ' && z[j-2]==',' && z[j-3]=='?' ){
+      j -= 2;
+    }else{
+      z[j++] = '?';
+    }
+  }
+  while( j>0 && (z[j-1]==';' || z[j-1]==' ') ) j--;
+  z[j] = 0;
+  return z;
+}
+
+/*
+** Process a trace event for the SQL profiler.  SQLITE_TRACE_ROW events
+** count rows for the statement.  An SQLITE_TRACE_PROFILE event is
+** delivered when a statement finishes running and adds the run time
+** and row count to the entry for the normalized SQL text.
+*/
+LOCAL void db_sqlprof_event(unsigned m, sqlite3_stmt *pStmt, void *pX){
+  int i;
+  sqlite3_int64 nRow = 0;
+  char *zSql;
+  unsigned int h;
+  struct sSqlProf *p;
+
+  for(i=0; i<db.nProfActive && db.aProfActive[i].pStmt!=pStmt; i++){}
+  if( m==SQLITE_TRACE_ROW ){
+    if( i<db.nProfActive ){
+      db.aProfActive[i].nRow++;
+    }else if( i<count(db.aProfActive) ){
+      db.aProfActive[i].pStmt = pStmt;
+      db.aProfActive[i].nRow = 1;
+      db.nProfActive++;
+    }
+    return;
+  }
+  if( m!=SQLITE_TRACE_PROFILE ) return;
+  if( i<db.nProfActive ){
+    nRow = db.aProfActive[i].nRow;
+    db.aProfActive[i] = db.aProfActive[--db.nProfActive];
+  }
+  zSql = db_sqlprof_normalize(sqlite3_sql(pStmt));
+  h = db_sql_hash(zSql);
+  for(i=0; i<db.nProf; i++){
+    p = &db.aProf[i];
+    if( p->h==h && strcmp(p->zSql, zSql)==0 ) break;
+  }
+  if( i<db.nProf ){
+    fossil_free(zSql);
+  }else{
+    if( db.nProf>=db.nProfAlloc ){
+      db.nProfAlloc = db.nProfAlloc*2 + 50;
+      db.aProf = fossil_realloc(db.aProf, sizeof(db.aProf[0])*db.nProfAlloc);
+    }
+    p = &db.aProf[db.nProf++];
+    memset(p, 0, sizeof(*p));
+    p->zSql = zSql;
+    p->h = h;
+  }
+  p->nCall++;
+  p->nRow += nRow;
+  p->nNs += *(sqlite3_int64*)pX;
+}
+
+/*
+** Start the SQL profiler.  Every statement run on the repository
+** connection from here until db_sqlprof_stop() is aggregated, by
+** normalized SQL text, into a count of runs, rows and total time.
+*/
+void db_sqlprof_start(void){
+  if( db.bSqlProf ) return;
+  db.bSqlProf = 1;
+  if( g.db ) db_set_trace(g.db);
+}
+
+/*
+** Stop the SQL profiler and discard everything it has collected.
+*/
+void db_sqlprof_stop(void){
+  int i;
+  if( !db.bSqlProf ) return;
+  db.bSqlProf = 0;
+  if( g.db ) db_set_trace(g.db);
+  for(i=0; i<db.nProf; i++) fossil_free(db.aProf[i].zSql);
+  fossil_free(db.aProf);
+  db.aProf = 0;
+  db.nProf = db.nProfAlloc = 0;
+  db.nProfActive = 0;
+}
+
+/*
+** Return true if the SQL profiler is running.
+*/
+int db_sqlprof_active(void){
+  return db.bSqlProf;
+}
+
+/*
+** Add the statistics collected by the SQL profiler so far to the
+** "sqlprof" table in schema zSchema, creating that table if necessary.
+** Each entry is recorded against zPage, the name of the page or command
+** being profiled.
+**
+** This routine is called while the database is being shut down, so it
+** uses the raw SQLite interfaces and silently gives up on any error
+** rather than calling db_err().  Statements run here are not profiled.
+*/
+void db_sqlprof_save(const char *zSchema, const char *zPage){
+  char *zSql;
+  sqlite3_stmt *pStmt = 0;
+  int i;
+  int bTxn;
+  if( g.db==0 || !db.bSqlProf || db.nProf==0 ) return;
+  db.bSqlProf = 0;
+  zSql = sqlite3_mprintf(
+    "CREATE TABLE IF NOT EXISTS \"%w\".sqlprof(\n"
+    "  page TEXT,\n"             /* Page or command that ran the statement */
+    "  sql TEXT,\n"              /* Normalized SQL text */
+    "  ncall INTEGER,\n"         /* Number of times the statement ran */
+    "  nrow INTEGER,\n"          /* Total rows returned */
+    "  ns INTEGER,\n"            /* Total run time in nanoseconds */
+    "  PRIMARY KEY(page,sql)\n"
+    ") WITHOUT ROWID;", zSchema);
+  bTxn = sqlite3_get_autocommit(g.db);
+  if( bTxn ) sqlite3_exec(g.db, "BEGIN", 0, 0, 0);
+  if( sqlite3_exec(g.db, zSql, 0, 0, 0)==SQLITE_OK ){
+    sqlite3_free(zSql);
+    zSql = sqlite3_mprintf(
+      "INSERT INTO \"%w\".sqlprof(page,sql,ncall,nrow,ns)"
+      " VALUES(?1,?2,?3,?4,?5)"
+      " ON CONFLICT(page,sql) DO UPDATE SET ncall=ncall+excluded.ncall,"
+      " nrow=nrow+excluded.nrow, ns=ns+excluded.ns", zSchema);
+    sqlite3_prepare_v2(g.db, zSql, -1, &pStmt, 0);
+  }
+  sqlite3_free(zSql);
+  for(i=0; pStmt && i<db.nProf; i++){
+    struct sSqlProf *p = &db.aProf[i];
+    sqlite3_bind_text(pStmt, 1, zPage, -1, SQLITE_STATIC);
+    sqlite3_bind_text(pStmt, 2, p->zSql, -1, SQLITE_STATIC);
+    sqlite3_bind_int(pStmt, 3, p->nCall);
+    sqlite3_bind_int64(pStmt, 4, p->nRow);
+    sqlite3_bind_int64(pStmt, 5, p->nNs);
+    sqlite3_step(pStmt);
+    sqlite3_reset(pStmt);
+  }
+  sqlite3_finalize(pStmt);
+  if( bTxn ) sqlite3_exec(g.db, "COMMIT", 0, 0, 0);
+  db.bSqlProf = 1;
+}
+
 /*
 ** Implement the user() SQL function.  user() takes no arguments and
 ** returns the user ID of the current user.
@@ -3098,6 +3512,26 @@ struct Setting {
 */
 #endif
 /*
+** SETTING: archive-jobs     width=5 default=1
+** The number of processes that compress files in parallel when a
+** ZIP archive or a tarball is generated, by /zip and /tarball or by
+** the "zip" and "tarball" commands.  "0" means one process for each
+** CPU.  With more than one process, a tarball is compressed in
+** independent blocks, which makes it slightly larger.  This only
+** works on unix.
+*/
+/*
+** SETTING: archive-tag-glob width=40 block-text
+** A comma or newline-separated list of GLOB patterns for tag names,
+** such as "version-*".  When a check-in receives a matching tag, the
+** backoffice builds the ZIP archive and the tarball that the page of
+** the check-in links to and stores them in the cache, so that the
+** first downloads of a new release do not all have to build them.
+** Nothing is built unless the cache has been enabled with
+** "fossil cache init".  The cache keeps at most "max-cache-entry"
+** archives, 10 by default, so only recent releases stay in it.
+*/
+/*
 ** SETTING: auto-captcha    boolean default=on variable=autocaptcha
 ** If enabled, the /login page provides a button that will automatically
 ** fill in the captcha password.  This makes things easier for human users,
@@ -3162,6 +3596,14 @@ struct Setting {
 ** GLOB patterns that should be treated as binary files
 ** for committing and merging purposes.  Example: *.jpg
 */
+/*
+** SETTING: cache-size       width=25 default=0
+** The size, in megabytes, of the SQLite page cache used for the
+** repository database.  Larger values help operations that touch
+** many pages, such as "fossil rebuild".  "0" means to use the
+** SQLite default.  The --cache-size command-line option overrides
+** this setting for a single command.
+*/
 #if defined(_WIN32)||defined(__CYGWIN__)||defined(__DARWIN__)
 /*
 ** SETTING: case-sensitive  boolean default=off
@@ -3302,6 +3744,13 @@ struct Setting {
 **     meld "%baseline" "%original" "%merge" "%output"
 */
 /*
+** SETTING: graph-cache-rows width=25 default=200
+** Timeline graphs with at least this many rows keep their layout in
+** the repository cache (see "fossil cache") and reuse it the next
+** time the same timeline is drawn.  "0" disables this.  Nothing
+** is saved unless the cache has been enabled with "fossil cache init".
+*/
+/*
 ** SETTING: hash-digits      width=5 default=10
 ** The number of hexadecimal digits of the SHA3 hash to display.
 */
@@ -3376,6 +3825,14 @@ struct Setting {
 ** and Fossil repositories both require manifests.
 */
 /*
+** SETTING: manifest-cache-size width=25 default=32
+** The number of megabytes of memory used to keep parsed check-in
+** manifests, so that commands and pages that walk many check-ins do
+** not parse the same manifests, and especially the same baseline
+** manifests, again and again.  "0" keeps only the baselines that are
+** in use by a delta manifest.
+*/
+/*
 ** SETTING: max-loadavg      width=25 default=0.0
 ** Some CPU-intensive web pages (ex: /zip, /tarball, /blame)
 ** are disallowed if the system load average goes above this
@@ -3389,6 +3846,17 @@ struct Setting {
 ** A limit on the size of uplink HTTP requests.
 */
 /*
+** SETTING: mmap-size        width=25 default=0
+** The number of megabytes of the repository database that SQLite
+** may access using memory-mapped I/O, rather than copying pages
+** with read().  This is most useful for busy servers of read-mostly
+** repositories, which can then serve pages straight from the
+** operating system page cache.  "0" leaves the SQLite default in
+** effect, which normally does not use memory-mapped I/O.  The
+** --mmap-size command-line option overrides this setting for a
+** single command, and "--mmap-size 0" always turns it off.
+*/
+/*
 ** SETTING: mtime-changes    boolean default=on
 ** Use file modification times (mtimes) to detect when
 ** files have been modified.  If disabled, all managed files
@@ -3449,6 +3917,13 @@ struct Setting {
 ** the list in use cases 1 through 4, but not for 5 and 6.
 */
 /*
+** SETTING: search-jobs      width=5 default=1
+** The number of processes that scan the repository in parallel when
+** /search has no full-text index to use.  "0" means one process for
+** each CPU.  Each process reads its share of the documents through a
+** connection of its own.  This only works on unix.
+*/
+/*
 ** SETTING: self-register    boolean default=off
 ** Allow users to register themselves through the HTTP UI.
 ** This is useful if you want to see other names than
@@ -3456,6 +3931,15 @@ struct Setting {
 ** users can not be deleted.
 */
 /*
+** SETTING: sql-profile      boolean default=off
+** When enabled, the SQL statements run by every web page request are
+** profiled and their call counts, row counts, and run times are added
+** to the "sqlprof" table of the repository, grouped by page and by
+** SQL text with literal values removed.  Administrators can view the
+** results on the /sqlprof page.  Profiling slows every request a little,
+** so leave this off except while investigating performance.
+*/
+/*
 ** SETTING: ssh-command      width=40
 ** The command used to talk to a remote machine with  the "ssh://" protocol.
 */
@@ -3732,6 +4216,7 @@ void test_timespan_cmd(void){
   sqlite3_open(":memory:", &g.db);
   rDiff = db_double(0.0, "SELECT julianday('now') - julianday(%Q)", g.argv[2]);
   fossil_print("Time differences: %s\n", db_timespan_name(rDiff));
+  db_stmt_cache_clear();
   sqlite3_close(g.db);
   g.db = 0;
 }
@@ -3860,6 +4345,94 @@ void test_database_name_cmd(void){
   fossil_print("Config database:     %s\n", g.zConfigDbName);
 }
 
+/*
+** COMMAND: test-db-bench
+**
+** Usage: %fossil test-db-bench ?OPTIONS? ?WORKLOAD ...?
+**
+** Run read-only workloads against the repository and report the CPU
+** time used by each.  Use this together with the --mmap-size and
+** --cache-size options to measure the effect of the "mmap-size" and
+** "cache-size" settings.  WORKLOAD is one or more of:
+**
+**    scan        Read the raw content of every artifact
+**    content     Expand every artifact, resolving deltas
+**    timeline    Walk the event table the way /timeline does
+**
+** All three workloads are run if none is named.
+**
+** Options:
+**    -R REPOSITORY     Use REPOSITORY instead of the current checkout
+**    --repeat N        Run each workload N times.  Default: 3
+*/
+void test_db_bench_cmd(void){
+  static const char *const azWork[] = { "scan", "content", "timeline" };
+  const char *zRepeat;
+  int nRepeat;
+  int i, j, k;
+  zRepeat = find_option("repeat",0,1);
+  nRepeat = zRepeat ? atoi(zRepeat) : 3;
+  if( nRepeat<1 ) nRepeat = 1;
+  db_find_and_open_repository(0, 0);
+  verify_all_options();
+  for(i=2; i<g.argc; i++){
+    for(k=0; k<count(azWork) && fossil_strcmp(g.argv[i],azWork[k]); k++){}
+    if( k>=count(azWork) ){
+      fossil_fatal("unknown workload \"%s\"", g.argv[i]);
+    }
+  }
+  fossil_print("mmap_size:  %lld\n",
+               db_int64(0, "PRAGMA repository.mmap_size"));
+  fossil_print("cache_size: %d\n", db_int(0, "PRAGMA repository.cache_size"));
+  for(k=0; k<count(azWork); k++){
+    const char *zWork = azWork[k];
+    u64 nTotal = 0;
+    i64 nItem = 0;
+    if( g.argc>2 ){
+      for(i=2; i<g.argc && fossil_strcmp(g.argv[i],zWork); i++){}
+      if( i>=g.argc ) continue;
+    }
+    for(j=0; j<nRepeat; j++){
+      int iTimer = fossil_timer_start();
+      Stmt q;
+      nItem = 0;
+      if( k==0 ){
+        /* Fetch the content itself, as length() would skip the
+        ** overflow pages that hold most of it */
+        db_prepare(&q, "SELECT content FROM blob");
+        while( db_step(&q)==SQLITE_ROW ){
+          db_column_raw(&q, 0);
+          nItem += db_column_bytes(&q, 0);
+        }
+      }else if( k==1 ){
+        db_prepare(&q, "SELECT rid FROM blob WHERE size>=0");
+        while( db_step(&q)==SQLITE_ROW ){
+          Blob content;
+          content_get(db_column_int(&q,0), &content);
+          nItem += blob_size(&content);
+          blob_reset(&content);
+        }
+      }else{
+        db_prepare(&q,
+          "SELECT blob.uuid, event.mtime, coalesce(ecomment,comment),"
+          "       (SELECT group_concat(substr(tagname,5), ', ')"
+          "          FROM tag, tagxref"
+          "         WHERE tagname GLOB 'sym-*' AND tag.tagid=tagxref.tagid"
+          "           AND tagxref.rid=blob.rid AND tagxref.tagtype>0)"
+          "  FROM event, blob"
+          " WHERE blob.rid=event.objid"
+          " ORDER BY event.mtime DESC"
+        );
+        while( db_step(&q)==SQLITE_ROW ){ nItem++; }
+      }
+      db_finalize(&q);
+      nTotal += fossil_timer_stop(iTimer);
+    }
+    fossil_print("%-10s %12lld %10.3f ms\n", zWork, nItem,
+                 nTotal/(1000.0*nRepeat));
+  }
+}
+
 /*
 ** Compute a "fingerprint" on the repository.  A fingerprint is used
 ** to verify that that the repository has not been replaced by a clone
@@ -266,6 +266,289 @@ void compute_descendants(int rid, int N){
   );
 }
 
+/*
+** The CGEN table, when present, holds a generation number for every
+** check-in.  The generation number of a check-in is always larger than
+** the generation numbers of its parents, so a check-in can only be an
+** ancestor of check-ins with strictly larger generation numbers.
+** Ancestry walks use this to stop following a path as soon as it
+** descends below the generation of the check-in being sought.
+**
+** The table is optional.  Older repositories do not have it until
+** they are rebuilt, and all of the routines below fall back to
+** unbounded walks when it is missing.
+*/
+
+/*
+** If a single incremental update visits more than this many check-ins,
+** give up and recompute the whole CGEN table instead.
+*/
+#define ANCESTRY_UPDATE_LIMIT 10000
+
+/*
+** A bag of check-ins whose generation numbers need to be recomputed
+** at the end of a sequence of manifest_crosslink() calls.
+*/
+static Bag genToUpdate;
+
+/*
+** Return true if the repository has a CGEN table.
+*/
+int ancestry_available(void){
+  return db_table_exists("repository", "cgen");
+}
+
+/*
+** Return the generation number of check-in rid, or 0 if it is unknown.
+*/
+int ancestry_gen(int rid){
+  static Stmt q;
+  int gen = 0;
+  if( rid<=0 || !ancestry_available() ) return 0;
+  db_static_prepare(&q, "SELECT gen FROM cgen WHERE rid=:rid");
+  db_bind_int(&q, ":rid", rid);
+  if( db_step(&q)==SQLITE_ROW ) gen = db_column_int(&q, 0);
+  db_reset(&q);
+  return gen;
+}
+
+/*
+** Return an SQL term, in memory obtained from fossil_malloc(), that is
+** true for every check-in whose RID is in column zCol and that could
+** possibly be check-in rid or one of its descendants.  The term begins
+** with " AND " so that it can be appended to a WHERE clause.  An empty
+** string is returned if generation numbers are not available.
+*/
+char *ancestry_prune_sql(const char *zCol, int rid){
+  int gen = ancestry_gen(rid);
+  if( gen<=1 ) return fossil_strdup("");
+  return mprintf(
+    " AND coalesce((SELECT gen FROM cgen WHERE cgen.rid=%s),%d)>=%d",
+    zCol, gen, gen
+  );
+}
+
+/*
+** Return an SQL term, in memory obtained from fossil_malloc(), that is
+** true for every check-in whose RID is in column zCol and that could
+** possibly be check-in rid or one of its ancestors.  Like
+** ancestry_prune_sql(), the term begins with " AND " and is an empty
+** string if generation numbers are not available.
+*/
+char *ancestry_ceiling_sql(const char *zCol, int rid){
+  int gen = ancestry_gen(rid);
+  if( gen<=0 ) return fossil_strdup("");
+  return mprintf(
+    " AND coalesce((SELECT gen FROM cgen WHERE cgen.rid=%s),0)<=%d",
+    zCol, gen
+  );
+}
+
+/*
+** Return true if check-in aid is check-in rid or one of its ancestors.
+*/
+int ancestry_is_ancestor(int aid, int rid){
+  int aGen, rGen;
+  int rc;
+  char *zPrune;
+  if( aid==rid ) return 1;
+  aGen = ancestry_gen(aid);
+  rGen = ancestry_gen(rid);
+  if( aGen>0 && rGen>0 && aGen>=rGen ) return 0;
+  zPrune = ancestry_prune_sql("plink.pid", aid);
+  rc = db_exists(
+    "WITH RECURSIVE ancestor(id) AS ("
+    "  VALUES(%d)"
+    "  UNION"
+    "  SELECT pid FROM plink, ancestor"
+    "   WHERE cid=ancestor.id%s)"
+    "SELECT 1 FROM ancestor WHERE id=%d LIMIT 1",
+    rid, zPrune/*safe-for-%s*/, aid
+  );
+  fossil_free(zPrune);
+  return rc;
+}
+
+/*
+** Recompute the generation number of check-in rid from the generation
+** numbers of its parents, then carry the change forward to any children
+** that are no longer numbered above their parents.
+*/
+void ancestry_update(int rid){
+  static Stmt setGen;
+  static Stmt stale;
+  Bag pending;
+  int nStep = 0;
+
+  if( !ancestry_available() ) return;
+  db_static_prepare(&setGen,
+    "REPLACE INTO cgen(rid,gen)"
+    " SELECT :rid, coalesce(max(cgen.gen),0)+1 FROM plink, cgen"
+    "  WHERE plink.cid=:rid AND cgen.rid=plink.pid"
+  );
+  db_static_prepare(&stale,
+    "SELECT plink.cid FROM plink, cgen AS c, cgen AS p"
+    " WHERE plink.pid=:rid AND c.rid=plink.cid AND p.rid=plink.pid"
+    "   AND c.gen<=p.gen"
+  );
+  bag_init(&pending);
+  bag_insert(&pending, rid);
+  while( (rid = bag_first(&pending))!=0 ){
+    bag_remove(&pending, rid);
+    if( ++nStep>ANCESTRY_UPDATE_LIMIT ){
+      bag_clear(&pending);
+      ancestry_rebuild();
+      return;
+    }
+    db_bind_int(&setGen, ":rid", rid);
+    db_step(&setGen);
+    db_reset(&setGen);
+    db_bind_int(&stale, ":rid", rid);
+    while( db_step(&stale)==SQLITE_ROW ){
+      bag_insert(&pending, db_column_int(&stale, 0));
+    }
+    db_reset(&stale);
+  }
+  bag_clear(&pending);
+}
+
+/*
+** Schedule a recomputation of the generation number for check-in rid
+** by a later call to ancestry_do_pending_updates().
+*/
+void ancestry_eventually_update(int rid){
+  bag_insert(&genToUpdate, rid);
+}
+
+/*
+** Do all pending generation number updates.  A large batch, such as
+** the one accumulated by a rebuild or a big sync, is handled by
+** renumbering every check-in at once.
+*/
+void ancestry_do_pending_updates(void){
+  int rid;
+  if( bag_count(&genToUpdate)>ANCESTRY_UPDATE_LIMIT/10 ){
+    ancestry_rebuild();
+  }else{
+    for(rid=bag_first(&genToUpdate); rid; rid=bag_next(&genToUpdate,rid)){
+      ancestry_update(rid);
+    }
+  }
+  bag_clear(&genToUpdate);
+}
+
+/*
+** Recompute the entire CGEN table by visiting check-ins in topological
+** order.  Check-ins that are part of a cycle in PLINK, which can only
+** arise from a damaged repository, are left without a generation number.
+*/
+void ancestry_rebuild(void){
+  Stmt q;
+  int mx;             /* Largest RID in the repository */
+  int nEdge;          /* Number of PLINK entries */
+  int *aFirst;        /* Children of X are aChild[aFirst[X]..aFirst[X+1]-1] */
+  int *aChild;        /* Child check-ins, grouped by parent */
+  int *aIn;           /* Number of parents not yet numbered */
+  int *aGen;          /* Generation numbers.  -1 for non-check-ins */
+  int *aQueue;        /* Check-ins ready to be numbered */
+  int nQueue = 0;
+  int i, j;
+
+  if( !ancestry_available() ) return;
+  db_multi_exec("DELETE FROM cgen;");
+  mx = db_int(0, "SELECT max(rid) FROM blob");
+  nEdge = db_int(0, "SELECT count(*) FROM plink");
+  if( mx<=0 ) return;
+  aFirst = fossil_malloc( sizeof(int)*(mx+2)*4 + sizeof(int)*(nEdge+1) );
+  aIn = &aFirst[mx+2];
+  aGen = &aIn[mx+2];
+  aQueue = &aGen[mx+2];
+  aChild = &aQueue[mx+2];
+  memset(aFirst, 0, sizeof(int)*(mx+2)*2);
+  for(i=0; i<=mx; i++) aGen[i] = -1;
+  db_prepare(&q, "SELECT objid FROM event WHERE type='ci' AND objid<=%d", mx);
+  while( db_step(&q)==SQLITE_ROW ){
+    aGen[db_column_int(&q,0)] = 0;
+  }
+  db_finalize(&q);
+  db_prepare(&q,
+    "SELECT pid, cid FROM plink"
+    " WHERE pid>0 AND pid<=%d AND cid>0 AND cid<=%d", mx, mx
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    int pid = db_column_int(&q, 0);
+    int cid = db_column_int(&q, 1);
+    aFirst[pid+1]++;
+    aIn[cid]++;
+    aGen[pid] = aGen[cid] = 0;
+  }
+  for(i=1; i<=mx+1; i++) aFirst[i] += aFirst[i-1];
+  db_reset(&q);
+  while( db_step(&q)==SQLITE_ROW ){
+    int pid = db_column_int(&q, 0);
+    aChild[aFirst[pid]++] = db_column_int(&q, 1);
+  }
+  db_finalize(&q);
+  /* aFirst[X] now marks the end of the children of X rather than the
+  ** start.  Shift it back by one slot. */
+  for(i=mx+1; i>0; i--) aFirst[i] = aFirst[i-1];
+  aFirst[0] = 0;
+  for(i=1; i<=mx; i++){
+    if( aGen[i]==0 && aIn[i]==0 ){
+      aGen[i] = 1;
+      aQueue[nQueue++] = i;
+    }
+  }
+  for(i=0; i<nQueue; i++){
+    int pid = aQueue[i];
+    for(j=aFirst[pid]; j<aFirst[pid+1]; j++){
+      int cid = aChild[j];
+      if( aGen[cid]<=aGen[pid] ) aGen[cid] = aGen[pid]+1;
+      if( --aIn[cid]==0 ) aQueue[nQueue++] = cid;
+    }
+  }
+  db_prepare(&q, "INSERT INTO cgen(rid,gen) VALUES(:rid,:gen)");
+  for(i=1; i<=mx; i++){
+    if( aGen[i]<=0 || aIn[i]>0 ) continue;
+    db_bind_int(&q, ":rid", i);
+    db_bind_int(&q, ":gen", aGen[i]);
+    db_step(&q);
+    db_reset(&q);
+  }
+  db_finalize(&q);
+  fossil_free(aFirst);
+}
+
+/*
+** COMMAND: test-ancestry-index
+**
+** Usage: %fossil test-ancestry-index ?--rebuild?
+**
+** Verify that the generation number of every check-in is larger than
+** the generation numbers of all of its parents and report the number
+** of violations.  With --rebuild, recompute all generation numbers first.
+*/
+void test_ancestry_index_cmd(void){
+  int rebuildFlag;
+  db_find_and_open_repository(0,0);
+  rebuildFlag = find_option("rebuild",0,0)!=0;
+  verify_all_options();
+  if( !ancestry_available() ){
+    fossil_fatal("this repository has no generation numbers;"
+                 " run \"fossil rebuild\"");
+  }
+  db_begin_transaction();
+  if( rebuildFlag ) ancestry_rebuild();
+  fossil_print("%d check-ins, %d without a generation number, %d errors\n",
+    db_int(0, "SELECT count(*) FROM cgen"),
+    db_int(0, "SELECT count(*) FROM event"
+              " WHERE type='ci' AND objid NOT IN (SELECT rid FROM cgen)"),
+    db_int(0, "SELECT count(*) FROM plink, cgen AS c, cgen AS p"
+              " WHERE c.rid=plink.cid AND p.rid=plink.pid AND c.gen<=p.gen")
+  );
+  db_end_transaction(0);
+}
+
 /*
 ** COMMAND: descendants*
 **
@@ -1015,23 +1015,34 @@ static int match_dline(DLine *pA, DLine *pB){
 }
 
 /*
-** There is a change block in which nLeft lines of text on the left are
-** converted into nRight lines of text on the right.  This routine computes
-** how the lines on the left line up with the lines on the right.
+** Change blocks whose Wagner matrix would have more than this many cells
+** are not aligned directly.  Instead, they are first broken up into
+** smaller windows, either at anchor lines that are unique on both sides,
+** or at split points found by a bounded search.
+*/
+#define SBS_ALIGN_MX        100000
+
+/*
+** The total amount of work (roughly, the number of match_dline() calls)
+** that will be spent aligning a single large change block.  Windows that
+** remain after the budget is exhausted get the simple alignment.
+*/
+#define SBS_ALIGN_BUDGET   1000000
+
+/*
+** Maximum number of lines on the smaller side of a window that are
+** examined when searching for a divide-and-conquer split point.
+*/
+#define SBS_ALIGN_SCAN         400
+
+/*
+** Compute the Wagner alignment for a change block in which nLeft lines
+** of text on the left are converted into nRight lines of text on the
+** right.  Both nLeft and nRight must be greater than zero.
 **
 ** The return value is a buffer of unsigned characters, obtained from
-** fossil_malloc().  (The caller needs to free the return value using
-** fossil_free().)  Entries in the returned array have values as follows:
-**
-**    1.  Delete the next line of pLeft.
-**    2.  Insert the next line of pRight.
-**    3.  The next line of pLeft changes into the next line of pRight.
-**    4.  Delete one line from pLeft and add one line to pRight.
-**
-** Values larger than three indicate better matches.
-**
-** The length of the returned array will be just large enough to cause
-** all elements of pLeft and pRight to be consumed.
+** fossil_malloc(), as described for sbsAlignment() below.  The number
+** of entries in that buffer is written into *pnResult.
 **
 ** Algorithm:  Wagner's minimum edit-distance algorithm, modified by
 ** adding a cost to each match based on how well the two rows match
@@ -1039,10 +1050,10 @@ static int match_dline(DLine *pA, DLine *pB){
 ** are between 0 and 100 where 0 is a perfect match 100 is a complete
 ** mismatch.
 */
-static unsigned char *sbsAlignment(
+static unsigned char *sbsAlignmentWagner(
    DLine *aLeft, int nLeft,       /* Text on the left */
    DLine *aRight, int nRight,     /* Text on the right */
-   u64 diffFlags                  /* Flags passed into the original diff */
+   int *pnResult                  /* OUT: Number of entries in the result */
 ){
   int i, j, k;                 /* Loop counters */
   int *a;                      /* One row of the Wagner matrix */
@@ -1053,26 +1064,8 @@ static unsigned char *sbsAlignment(
   int mxLen;                   /* MAX(nLeft, nRight) */
   int aBuf[100];               /* Stack space for a[] if nRight not to big */
 
+  assert( nLeft>0 && nRight>0 );
   aM = fossil_malloc( (nLeft+1)*(nRight+1) );
-  if( nLeft==0 ){
-    memset(aM, 2, nRight);
-    return aM;
-  }
-  if( nRight==0 ){
-    memset(aM, 1, nLeft);
-    return aM;
-  }
-
-  /* This algorithm is O(N**2).  So if N is too big, bail out with a
-  ** simple (but stupid and ugly) result that doesn't take too long. */
-  mnLen = nLeft<nRight ? nLeft : nRight;
-  if( nLeft*nRight>100000 && (diffFlags & DIFF_SLOW_SBS)==0 ){
-    memset(aM, 4, mnLen);
-    if( nLeft>mnLen )  memset(aM+mnLen, 1, nLeft-mnLen);
-    if( nRight>mnLen ) memset(aM+mnLen, 2, nRight-mnLen);
-    return aM;
-  }
-
   if( nRight < count(aBuf)-1 ){
     pToFree = 0;
     a = aBuf;
@@ -1148,18 +1141,332 @@ static unsigned char *sbsAlignment(
   ** The coefficients for conditions (1) and (2) above are determined by
   ** experimentation.
   */
+  mnLen = nLeft<nRight ? nLeft : nRight;
   mxLen = nLeft>nRight ? nLeft : nRight;
   if( i*4>mxLen*5 && (nMatch==0 || iMatch/nMatch>15) ){
     memset(aM, 4, mnLen);
     if( nLeft>mnLen )  memset(aM+mnLen, 1, nLeft-mnLen);
     if( nRight>mnLen ) memset(aM+mnLen, 2, nRight-mnLen);
+    i = mxLen;
   }
 
   /* Return the result */
   fossil_free(pToFree);
+  *pnResult = i;
   return aM;
 }
 
+/*
+** An instance of the following object accumulates the alignment of a
+** large change block as it is computed one window at a time.
+*/
+typedef struct SbsAligner SbsAligner;
+struct SbsAligner {
+  unsigned char *aM;     /* The alignment computed so far */
+  int nM;                /* Number of entries used in aM[] */
+  int nAlloc;            /* Number of entries allocated for aM[] */
+  int nWork;             /* Work budget remaining */
+};
+
+/*
+** Append n copies of alignment code c to the alignment in p.
+*/
+static void sbsAlignAppend(SbsAligner *p, unsigned char c, int n){
+  if( n<=0 ) return;
+  if( p->nM+n>p->nAlloc ){
+    p->nAlloc = (p->nM+n)*2 + 100;
+    p->aM = fossil_realloc(p->aM, p->nAlloc);
+  }
+  memset(&p->aM[p->nM], c, n);
+  p->nM += n;
+}
+
+/*
+** Append the simple (but stupid and ugly) alignment for nLeft lines on
+** the left and nRight lines on the right: pair lines off one by one,
+** then delete or insert whatever is left over.
+*/
+static void sbsAlignSimple(SbsAligner *p, int nLeft, int nRight){
+  int mnLen = nLeft<nRight ? nLeft : nRight;
+  sbsAlignAppend(p, 4, mnLen);
+  sbsAlignAppend(p, 1, nLeft-mnLen);
+  sbsAlignAppend(p, 2, nRight-mnLen);
+}
+
+/*
+** Compute a hash of the text of pLine that ignores all whitespace.
+** Write the number of non-whitespace characters into *pnChar.
+*/
+static unsigned int sbsHashIgnoreSpace(const DLine *pLine, int *pnChar){
+  unsigned int h = 0;
+  int i, n = 0;
+  for(i=0; i<pLine->n; i++){
+    char c = pLine->z[i];
+    if( fossil_isspace(c) ) continue;
+    h += (unsigned char)c;
+    h *= 0x9e3779b1;
+    n++;
+  }
+  *pnChar = n;
+  return h ^ n;
+}
+
+/*
+** Return true if pA and pB are the same when all whitespace is ignored.
+*/
+static int sbsSameIgnoreSpace(const DLine *pA, const DLine *pB){
+  int a = 0, b = 0;
+  while( 1 ){
+    while( a<pA->n && fossil_isspace(pA->z[a]) ) a++;
+    while( b<pB->n && fossil_isspace(pB->z[b]) ) b++;
+    if( a>=pA->n || b>=pB->n ) break;
+    if( pA->z[a++]!=pB->z[b++] ) return 0;
+  }
+  return a>=pA->n && b>=pB->n;
+}
+
+static void sbsAlignWindow(SbsAligner*,DLine*,int,DLine*,int);
+
+/*
+** Try to break a large window into smaller windows at anchor lines.
+** An anchor is a non-blank line that occurs exactly once on each side,
+** when whitespace is ignored, so that reformatting changes (which
+** usually only change indentation or spacing) still find anchors.
+** The longest increasing sequence of anchors is kept, and the text
+** between consecutive anchors is aligned recursively.
+**
+** Return 0, without changing p, if no anchors are found.
+*/
+static int sbsAlignAnchors(
+  SbsAligner *p,                 /* Write the alignment here */
+  DLine *aLeft, int nLeft,       /* Text on the left */
+  DLine *aRight, int nRight      /* Text on the right */
+){
+  struct SbsAnchorSlot {
+    unsigned int h;              /* Whitespace-insensitive hash */
+    int nL, nR;                  /* Occurrences on the left and right */
+    int iL, iR;                  /* Index of the last occurrence each side */
+  } *aSlot;
+  int *aPair;                    /* Right index for each left line, or -1 */
+  int *aTail;                    /* LIS: left index ending a run of k+1 */
+  int *aPrev;                    /* LIS: predecessor of each left index */
+  int nSlot;                     /* Number of slots in aSlot[] */
+  int nLis;                      /* Length of the LIS */
+  int i, k, n;
+  unsigned int h;
+
+  p->nWork -= nLeft + nRight;
+  for(nSlot=64; nSlot<2*(nLeft+nRight); nSlot*=2){}
+  aSlot = fossil_malloc( sizeof(aSlot[0])*nSlot );
+  memset(aSlot, 0, sizeof(aSlot[0])*nSlot);
+
+  /* Count the occurrences of each distinct line on each side */
+  for(i=0; i<nLeft+nRight; i++){
+    DLine *pLine = i<nLeft ? &aLeft[i] : &aRight[i-nLeft];
+    h = sbsHashIgnoreSpace(pLine, &n);
+    if( n==0 ) continue;
+    for(k=h&(nSlot-1); aSlot[k].nL+aSlot[k].nR>0; k=(k+1)&(nSlot-1)){
+      if( aSlot[k].h!=h ) continue;
+      if( sbsSameIgnoreSpace(pLine, aSlot[k].nL ? &aLeft[aSlot[k].iL]
+                                                : &aRight[aSlot[k].iR]) ){
+        break;
+      }
+    }
+    aSlot[k].h = h;
+    if( i<nLeft ){
+      aSlot[k].nL++;
+      aSlot[k].iL = i;
+    }else{
+      aSlot[k].nR++;
+      aSlot[k].iR = i - nLeft;
+    }
+  }
+
+  /* Pair up the lines that are unique on both sides, in left order */
+  aPair = fossil_malloc( sizeof(int)*nLeft*3 );
+  aTail = &aPair[nLeft];
+  aPrev = &aPair[nLeft*2];
+  for(i=0; i<nLeft; i++) aPair[i] = -1;
+  for(k=0; k<nSlot; k++){
+    if( aSlot[k].nL==1 && aSlot[k].nR==1 ){
+      aPair[aSlot[k].iL] = aSlot[k].iR;
+    }
+  }
+  fossil_free(aSlot);
+
+  /* Longest increasing subsequence of right indexes (patience sorting) */
+  nLis = 0;
+  for(i=0; i<nLeft; i++){
+    int lo, hi;
+    if( aPair[i]<0 ) continue;
+    lo = 0;
+    hi = nLis;
+    while( lo<hi ){
+      int mid = (lo+hi)/2;
+      if( aPair[aTail[mid]]<aPair[i] ) lo = mid+1; else hi = mid;
+    }
+    aPrev[i] = lo>0 ? aTail[lo-1] : -1;
+    aTail[lo] = i;
+    if( lo==nLis ) nLis++;
+  }
+  if( nLis==0 ){
+    fossil_free(aPair);
+    return 0;
+  }
+
+  /* Unwind the LIS into aTail[0..nLis-1] in increasing order */
+  for(k=nLis-1, i=aTail[nLis-1]; k>=0; k--, i=aPrev[i]){
+    aTail[k] = i;
+  }
+
+  /* Align the windows between anchors */
+  {
+    int iL = 0, iR = 0;
+    for(k=0; k<nLis; k++){
+      int aL = aTail[k];
+      int aR = aPair[aL];
+      sbsAlignWindow(p, &aLeft[iL], aL-iL, &aRight[iR], aR-iR);
+      sbsAlignAppend(p, 3, 1);
+      iL = aL+1;
+      iR = aR+1;
+    }
+    sbsAlignWindow(p, &aLeft[iL], nLeft-iL, &aRight[iR], nRight-iR);
+  }
+  fossil_free(aPair);
+  return 1;
+}
+
+/*
+** Break a large window into two smaller windows.  The middle line of the
+** larger side is matched against a bounded range of lines on the smaller
+** side, near the proportional position, and the window is split so that
+** the best match begins the second half.
+*/
+static void sbsAlignDivide(
+  SbsAligner *p,                 /* Write the alignment here */
+  DLine *aLeft, int nLeft,       /* Text on the left */
+  DLine *aRight, int nRight      /* Text on the right */
+){
+  DLine *aSmall, *aBig;          /* The smaller and larger sides */
+  int nSmall, nBig;              /* Size of aSmall and aBig.  nSmall<=nBig */
+  int iDivSmall, iDivBig;        /* Split point on each side */
+  int iCenter;                   /* Proportional position on small side */
+  int iFirst, iLast;             /* Range of aSmall[] examined */
+  int score, bestScore;          /* Match scores */
+  int i;
+
+  if( nLeft>nRight ){
+    aBig = aLeft;   nBig = nLeft;
+    aSmall = aRight; nSmall = nRight;
+  }else{
+    aBig = aRight;  nBig = nRight;
+    aSmall = aLeft; nSmall = nLeft;
+  }
+  iDivBig = nBig/2;
+  iCenter = (int)((i64)iDivBig*nSmall/nBig);
+  iFirst = iCenter - SBS_ALIGN_SCAN/2;
+  if( iFirst<0 ) iFirst = 0;
+  iLast = iFirst + SBS_ALIGN_SCAN;
+  if( iLast>nSmall ) iLast = nSmall;
+  iDivSmall = iCenter;
+  bestScore = 10000;
+  for(i=iFirst; i<iLast; i++){
+    score = match_dline(&aBig[iDivBig], &aSmall[i]) + abs(i-iCenter)/4;
+    if( score<bestScore ){
+      bestScore = score;
+      iDivSmall = i;
+    }
+  }
+  p->nWork -= iLast - iFirst;
+  if( aBig==aLeft ){
+    sbsAlignWindow(p, aLeft, iDivBig, aRight, iDivSmall);
+    sbsAlignWindow(p, &aLeft[iDivBig], nLeft-iDivBig,
+                      &aRight[iDivSmall], nRight-iDivSmall);
+  }else{
+    sbsAlignWindow(p, aLeft, iDivSmall, aRight, iDivBig);
+    sbsAlignWindow(p, &aLeft[iDivSmall], nLeft-iDivSmall,
+                      &aRight[iDivBig], nRight-iDivBig);
+  }
+}
+
+/*
+** Append the alignment of one window of a change block to p.  Small
+** windows are aligned directly using Wagner's algorithm.  Larger windows
+** are split at anchors, or else divided in two, and then aligned
+** recursively.  Once the work budget is used up, the simple alignment
+** is used for whatever remains.
+*/
+static void sbsAlignWindow(
+  SbsAligner *p,                 /* Write the alignment here */
+  DLine *aLeft, int nLeft,       /* Text on the left */
+  DLine *aRight, int nRight      /* Text on the right */
+){
+  i64 nCell = (i64)nLeft*nRight;
+  if( nLeft==0 || nRight==0 ){
+    sbsAlignSimple(p, nLeft, nRight);
+    return;
+  }
+  if( nCell>p->nWork ){
+    if( nCell<=SBS_ALIGN_MX || p->nWork<=0 ){
+      sbsAlignSimple(p, nLeft, nRight);
+      return;
+    }
+  }else if( nCell<=SBS_ALIGN_MX ){
+    int n;
+    unsigned char *aM = sbsAlignmentWagner(aLeft, nLeft, aRight, nRight, &n);
+    p->nWork -= (int)nCell;
+    sbsAlignAppend(p, 0, n);
+    memcpy(&p->aM[p->nM-n], aM, n);
+    fossil_free(aM);
+    return;
+  }
+  if( sbsAlignAnchors(p, aLeft, nLeft, aRight, nRight) ) return;
+  sbsAlignDivide(p, aLeft, nLeft, aRight, nRight);
+}
+
+/*
+** There is a change block in which nLeft lines of text on the left are
+** converted into nRight lines of text on the right.  This routine computes
+** how the lines on the left line up with the lines on the right.
+**
+** The return value is a buffer of unsigned characters, obtained from
+** fossil_malloc().  (The caller needs to free the return value using
+** fossil_free().)  Entries in the returned array have values as follows:
+**
+**    1.  Delete the next line of pLeft.
+**    2.  Insert the next line of pRight.
+**    3.  The next line of pLeft changes into the next line of pRight.
+**    4.  Delete one line from pLeft and add one line to pRight.
+**
+** Values larger than three indicate better matches.
+**
+** The length of the returned array will be just large enough to cause
+** all elements of pLeft and pRight to be consumed.
+**
+** Small change blocks are aligned by sbsAlignmentWagner().  That
+** algorithm is O(N**2), so larger change blocks are first broken into
+** small windows at lines that are unique on both sides, or at split
+** points found by divide-and-conquer, and only the windows are run
+** through Wagner.  The total work is capped by SBS_ALIGN_BUDGET.  The
+** DIFF_SLOW_SBS flag forces a single Wagner alignment of the whole block.
+*/
+static unsigned char *sbsAlignment(
+   DLine *aLeft, int nLeft,       /* Text on the left */
+   DLine *aRight, int nRight,     /* Text on the right */
+   u64 diffFlags                  /* Flags passed into the original diff */
+){
+  SbsAligner s;
+  if( nLeft>0 && nRight>0 && (diffFlags & DIFF_SLOW_SBS)!=0 ){
+    int n;
+    return sbsAlignmentWagner(aLeft, nLeft, aRight, nRight, &n);
+  }
+  memset(&s, 0, sizeof(s));
+  s.nWork = SBS_ALIGN_BUDGET;
+  sbsAlignWindow(&s, aLeft, nLeft, aRight, nRight);
+  if( s.aM==0 ) s.aM = fossil_malloc(1);
+  return s.aM;
+}
+
 /*
 ** R[] is an array of six integer, two COPY/DELETE/INSERT triples for a
 ** pair of adjacent differences.  Return true if the gap between these
@@ -2346,9 +2653,9 @@ unsigned gradient_color(unsigned c1, unsigned c2, int n, int i){
 }
 
 /*
-** WEBPAGE: annotate
-** WEBPAGE: blame
-** WEBPAGE: praise
+** WEBPAGE: annotate cacheable
+** WEBPAGE: blame cacheable
+** WEBPAGE: praise cacheable
 **
 ** URL: /annotate?checkin=ID&filename=FILENAME
 ** URL: /blame?checkin=ID&filename=FILENAME
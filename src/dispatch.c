@@ -50,6 +50,7 @@ struct CmdOrPage {
 #define CMDFLAG_BLOCKTEXT   0x0080      /* Multi-line text setting */
 #define CMDFLAG_BOOLEAN     0x0100      /* A boolean setting */
 #define CMDFLAG_RAWCONTENT  0x0200      /* Do not interpret POST content */
+#define CMDFLAG_CACHEABLE   0x0400      /* Webpage may be served from cache */
 /**************************************************************************/
 
 /* Values for the 2nd parameter to dispatch_name_search() */
@@ -502,6 +503,7 @@ static const char zOptions[] =
 @ Command-line options common to all commands:
 @ 
 @   --args FILENAME         Read additional arguments and options from FILENAME
+@   --cache-size MB         Override the "cache-size" setting
 @   --cgitrace              Active CGI tracing
 @   --comfmtflags VALUE     Set comment formatting flags to VALUE
 @   --comment-format VALUE  Alias for --comfmtflags
@@ -509,6 +511,7 @@ static const char zOptions[] =
 @   --help                  Show help on the command rather than running it
 @   --httptrace             Trace outbound HTTP requests
 @   --localtime             Display times using the local timezone
+@   --mmap-size MB          Override the "mmap-size" setting
 @   --no-th-hook            Do not run TH1 hooks
 @   --quiet                 Reduce the amount of output
 @   --sqlstats              Show SQL usage statistics when done
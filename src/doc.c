@@ -539,39 +539,106 @@ void convert_href_and_output(Blob *pIn){
   blob_append(cgi_output_blob(), &z[base], i-base);
 }
 
+/*
+** If zKey is not NULL and the cache database holds the rendering of a
+** document under that key, generate the reply from the cache and
+** return true.  Return false if the document must be rendered.
+**
+** A cached rendering is the title of the document, a newline, and the
+** HTML that goes between the header and the footer.
+*/
+static int doc_render_from_cache(const char *zKey){
+  Blob x;
+  const char *z;
+  int i;
+  if( zKey==0 ) return 0;
+  blob_init(&x, 0, 0);
+  if( !cache_fragment_read(zKey, &x) ) return 0;
+  z = blob_str(&x);
+  for(i=0; z[i] && z[i]!='\n'; i++){}
+  if( z[i]==0 ){
+    blob_reset(&x);
+    return 0;
+  }
+  style_header("%.*s", i, z);
+  cgi_append_content(&z[i+1], blob_size(&x)-i-1);
+  style_footer();
+  blob_reset(&x);
+  return 1;
+}
+
+/*
+** Save a rendering of a document under key zKey, if zKey is not NULL.
+** The HTML is the content of the reply from offset iStart onwards.
+*/
+static void doc_render_to_cache(
+  const char *zKey,             /* Cache key, or NULL */
+  const char *zTitle,           /* Title of the document */
+  int iStart                    /* Offset of the HTML in the reply */
+){
+  Blob *pOut = cgi_output_blob();
+  Blob x;
+  int i;
+  if( zKey==0 ) return;
+  blob_init(&x, 0, 0);
+  blob_append(&x, zTitle, -1);
+  for(i=0; i<blob_size(&x); i++){
+    if( blob_buffer(&x)[i]=='\n' ) blob_buffer(&x)[i] = ' ';
+  }
+  blob_append(&x, "\n", 1);
+  blob_append(&x, blob_buffer(pOut)+iStart, blob_size(pOut)-iStart);
+  cache_fragment_write(zKey, &x);
+  blob_reset(&x);
+}
+
 /*
 ** Render a document as the reply to the HTTP request.  The body
 ** of the document is contained in pBody.  The body might be binary.
 ** The mimetype is in zMimetype.
+**
+** If zCacheKey is not NULL, then wiki and markdown documents are taken
+** from, or saved into, the cache database under that key.
 */
 void document_render(
   Blob *pBody,                  /* Document content */
   const char *zMime,            /* MIME-type */
   const char *zDefaultTitle,    /* Default title */
-  const char *zFilename         /* Name of the file being rendered */
+  const char *zFilename,        /* Name of the file being rendered */
+  const char *zCacheKey         /* Key for the rendering cache, or NULL */
 ){
   Blob title;
   blob_init(&title,0,0);
   if( fossil_strcmp(zMime, "text/x-fossil-wiki")==0 ){
     Blob tail;
+    int iStart;
     style_adunit_config(ADUNIT_RIGHT_OK);
+    if( doc_render_from_cache(zCacheKey) ) return;
     if( wiki_find_title(pBody, &title, &tail) ){
       style_header("%s", blob_str(&title));
+      iStart = blob_size(cgi_output_blob());
       wiki_convert(&tail, 0, WIKI_BUTTONS);
     }else{
+      blob_append(&title, zDefaultTitle, -1);
       style_header("%s", zDefaultTitle);
+      iStart = blob_size(cgi_output_blob());
       wiki_convert(pBody, 0, WIKI_BUTTONS);
     }
+    doc_render_to_cache(zCacheKey, blob_str(&title), iStart);
     style_footer();
   }else if( fossil_strcmp(zMime, "text/x-markdown")==0 ){
     Blob tail = BLOB_INITIALIZER;
+    int iStart;
+    if( doc_render_from_cache(zCacheKey) ) return;
     markdown_to_html(pBody, &title, &tail);
     if( blob_size(&title)>0 ){
       style_header("%s", blob_str(&title));
     }else{
+      blob_append(&title, zDefaultTitle, -1);
       style_header("%s", zDefaultTitle);
     }
+    iStart = blob_size(cgi_output_blob());
     convert_href_and_output(&tail);
+    doc_render_to_cache(zCacheKey, blob_str(&title), iStart);
     style_footer();
   }else if( fossil_strcmp(zMime, "text/plain")==0 ){
     style_header("%s", zDefaultTitle);
@@ -672,6 +739,7 @@ void doc_page(void){
   int i;                            /* Loop counter */
   Blob filebody;                    /* Content of the documentation file */
   Blob title;                       /* Document title */
+  char *zCacheKey = 0;              /* Key for the rendering cache */
   int nMiss = (-1);                 /* Failed attempts to find the document */
   int isUV = g.zPath[0]=='u';       /* True for /uv.  False for /doc */
   const char *zDfltTitle;
@@ -774,8 +842,24 @@ void doc_page(void){
                                        "  FROM blob WHERE rid=%d", vid));
     Th_Store("doc_date", db_text(0, "SELECT datetime(mtime) FROM event"
                                     " WHERE objid=%d AND type='ci'", vid));
+    if( nMiss<count(azSuffix)
+     && (fossil_strcmp(zMime, "text/x-fossil-wiki")==0
+         || fossil_strcmp(zMime, "text/x-markdown")==0)
+    ){
+      /* The reply depends on the document and its rendering, on the
+      ** check-in named in the header, and on the user and capabilities.
+      ** Other types of document, such as those run through TH1, might
+      ** depend on anything and get no ETag. */
+      char *zUuid = rid_to_uuid(rid);
+      char *zCap = cache_capabilities();
+      zCacheKey = cache_render_key(zUuid, zMime);
+      etag_check(ETAG_HASH, mprintf("%s %d %s %s",
+                 zCacheKey, vid, g.zLogin ? g.zLogin : "", zCap));
+      fossil_free(zCap);
+      fossil_free(zUuid);
+    }
   }
-  document_render(&filebody, zMime, zDfltTitle, zName);
+  document_render(&filebody, zMime, zDfltTitle, zName, zCacheKey);
   if( nMiss>=count(azSuffix) ) cgi_set_status(404, "Not Found");
   db_end_transaction(0);
   return;
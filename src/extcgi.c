@@ -206,7 +206,7 @@ void ext_page(void){
       goto ext_not_found;
     }
     blob_read_from_file(&reply, zScript, ExtFILE);
-    document_render(&reply, zMime, zName, zName);
+    document_render(&reply, zMime, zName, zName, 0);
     return;
   }
 
@@ -305,7 +305,7 @@ ext_not_found:
   }
   if( toChild ) fclose(toChild);
   if( zFailReason==0 ){
-    document_render(&reply, zMime, zName, zName);
+    document_render(&reply, zMime, zName, zName, 0);
   }else{
     cgi_set_status(404, "Not Found");
     @ <h1>Not Found</h1>
@@ -100,6 +100,7 @@ struct GraphContext {
   int nHash;                 /* Number of slots in apHash[] */
   GraphRow **apHash;         /* Hash table of GraphRow objects.  Key: rid */
   u8 aiRailMap[GR_MAX_RAIL]; /* Mapping of rails to actually columns */
+  u8 bRailMapped;            /* True if aiRailMap moves zLeftBranch left */
 };
 
 #endif
@@ -412,7 +413,7 @@ static void riser_to_top(GraphRow *pRow){
 
 
 /*
-** Compute the complete graph
+** Compute the complete graph.  See graph_finish() for details.
 **
 ** When primary or merge parents are off-screen, normally a line is drawn
 ** from the node down to the bottom of the graph.  This line is called a
@@ -426,7 +427,8 @@ static void riser_to_top(GraphRow *pRow){
 **       TIMELINE_FILLGAPS:    Use step-children
 **       TIMELINE_XMERGE:      Omit off-graph merge lines
 */
-void graph_finish(GraphContext *p, const char *zLeftBranch, u32 tmFlags){
+static void graph_layout(GraphContext *p, const char *zLeftBranch,
+                         u32 tmFlags){
   GraphRow *pRow, *pDesc, *pDup, *pLoop, *pParent;
   int i, j;
   u64 mask;
@@ -752,10 +754,254 @@ void graph_finish(GraphContext *p, const char *zLeftBranch, u32 tmFlags){
         aMap[pRow->iRail] = j++;
       }
     }
-    cgi_printf("<!-- aiRailMap =");
-    for(i=0; i<=p->mxRail; i++) cgi_printf(" %d", aMap[i]);
-    cgi_printf(" -->\n");
+    p->bRailMapped = 1;
+  }
+
+  p->nErr = 0;
+}
+
+/*
+** The layout of a graph with many rows is saved in the ".cache"
+** database (see cache.c) so that redrawing the same timeline, which is
+** what happens on busy servers, does not run the layout algorithm, and
+** the count_nonbranch_children() query for every row, a second time.
+**
+** A saved layout is a GraphCacheHdr followed by one GraphCacheRow for
+** each row of the graph.  Each GraphCacheRow is followed by nRiser
+** pairs of integers giving the rail and target row of each riser.
+** Row indexes are stored relative to the top row, as GraphRow.idx
+** values differ from one graph to the next.
+*/
+#define GRAPH_CACHE_MAGIC  0x47524c31     /* "GRL1" */
+
+typedef struct GraphCacheHdr GraphCacheHdr;
+typedef struct GraphCacheRow GraphCacheRow;
+struct GraphCacheHdr {
+  u32 magic;                 /* GRAPH_CACHE_MAGIC */
+  int nRow;                  /* Number of rows that follow */
+  int nErr;                  /* Copy of GraphContext.nErr */
+  int mxRail;                /* Copy of GraphContext.mxRail */
+  int bRailMapped;           /* Copy of GraphContext.bRailMapped */
+  u8 aiRailMap[GR_MAX_RAIL]; /* Copy of GraphContext.aiRailMap */
+};
+struct GraphCacheRow {
+  i8 iRail;                  /* Copies of the same GraphRow fields */
+  i8 mergeOut;
+  u8 bDescender;
+  u8 isStepParent;
+  int nRiser;                /* Number of aiRiser[] entries that are >=0 */
+  int mergeUpto;             /* Relative to the top row */
+  int cherrypickUpto;        /* Relative to the top row */
+  u64 mergeDown;
+  u64 cherrypickDown;
+  u64 mergeInMask;           /* Rails for which mergeIn[] is 1 */
+  u64 cherrypickInMask;      /* Rails for which mergeIn[] is 2 */
+};
+
+/*
+** Return the name of the cache entry that holds the layout for graph p.
+** The name is a hash of every input to the layout algorithm: the rows
+** and their parents and branches, the flags, and the version of the
+** repository content, as the layout also depends on children that are
+** not part of the graph.
+*/
+static char *graph_cache_key(
+  GraphContext *p,
+  const char *zLeftBranch,
+  u32 tmFlags
+){
+  GraphRow *pRow;
+  Blob in, hash;
+  int i;
+  char *zKey;
+
+  blob_init(&in, 0, 0);
+  blob_appendf(&in, "%x %z %d:%s\n",
+     tmFlags & (TIMELINE_DISJOINT|TIMELINE_FILLGAPS|TIMELINE_XMERGE),
+     cache_repository_version(),
+     zLeftBranch ? (int)strlen(zLeftBranch) : -1,
+     zLeftBranch ? zLeftBranch : "");
+  for(pRow=p->pFirst; pRow; pRow=pRow->pNext){
+    blob_appendf(&in, "%d %d %d", pRow->rid, pRow->nParent,
+                 pRow->nCherrypick);
+    for(i=0; i<pRow->nParent; i++){
+      blob_appendf(&in, " %d", pRow->aParent[i]);
+    }
+    blob_appendf(&in, " %d:%s\n", (int)strlen(pRow->zBranch), pRow->zBranch);
   }
+  blob_init(&hash, 0, 0);
+  sha1sum_blob(&in, &hash);
+  zKey = mprintf("graph-%s", blob_str(&hash));
+  blob_reset(&in);
+  blob_reset(&hash);
+  return zKey;
+}
 
+/*
+** Load the layout of graph p from the cache fragment zKey.  Return
+** true on success.  Return false and leave p unchanged if there
+** is no such entry.
+*/
+static int graph_cache_load(GraphContext *p, const char *zKey){
+  Blob x;
+  GraphCacheHdr hdr;
+  GraphCacheRow r;
+  GraphRow *pRow;
+  const char *z;
+  int n, i, iBase;
+  int aPair[2];
+
+  blob_init(&x, 0, 0);
+  if( !cache_fragment_read(zKey, &x) ) return 0;
+  z = blob_buffer(&x);
+  n = blob_size(&x);
+  if( n<(int)sizeof(hdr) ) goto graph_cache_load_fail;
+  memcpy(&hdr, z, sizeof(hdr));
+  z += sizeof(hdr);
+  n -= sizeof(hdr);
+  if( hdr.magic!=GRAPH_CACHE_MAGIC || hdr.nRow!=p->nRow ){
+    goto graph_cache_load_fail;
+  }
+  if( hdr.nErr ){
+    p->nErr = hdr.nErr;
+    blob_reset(&x);
+    return 1;
+  }
+  iBase = p->pFirst->idx - 1;
+  for(pRow=p->pFirst; pRow; pRow=pRow->pNext){
+    if( n<(int)sizeof(r) ) goto graph_cache_load_fail;
+    memcpy(&r, z, sizeof(r));
+    z += sizeof(r);
+    n -= sizeof(r);
+    if( n<(int)sizeof(aPair)*r.nRiser ) goto graph_cache_load_fail;
+    pRow->iRail = r.iRail;
+    pRow->mergeOut = r.mergeOut;
+    pRow->bDescender = r.bDescender;
+    pRow->isStepParent = r.isStepParent;
+    pRow->mergeUpto = r.mergeUpto>0 ? r.mergeUpto+iBase : r.mergeUpto;
+    pRow->cherrypickUpto =
+       r.cherrypickUpto>0 ? r.cherrypickUpto+iBase : r.cherrypickUpto;
+    pRow->mergeDown = r.mergeDown;
+    pRow->cherrypickDown = r.cherrypickDown;
+    for(i=0; i<GR_MAX_RAIL; i++){
+      if( (r.mergeInMask>>i) & 1 ){
+        pRow->mergeIn[i] = 1;
+      }else if( (r.cherrypickInMask>>i) & 1 ){
+        pRow->mergeIn[i] = 2;
+      }else{
+        pRow->mergeIn[i] = 0;
+      }
+    }
+    memset(pRow->aiRiser, -1, sizeof(pRow->aiRiser));
+    for(i=0; i<r.nRiser; i++){
+      memcpy(aPair, z, sizeof(aPair));
+      z += sizeof(aPair);
+      n -= sizeof(aPair);
+      if( aPair[0]<0 || aPair[0]>=GR_MAX_RAIL ) goto graph_cache_load_fail;
+      pRow->aiRiser[aPair[0]] = aPair[1]>0 ? aPair[1]+iBase : aPair[1];
+    }
+  }
+  p->mxRail = hdr.mxRail;
+  p->bRailMapped = hdr.bRailMapped;
+  memcpy(p->aiRailMap, hdr.aiRailMap, sizeof(p->aiRailMap));
   p->nErr = 0;
+  blob_reset(&x);
+  return 1;
+
+graph_cache_load_fail:
+  /* A damaged entry.  Run the layout algorithm and trust that it
+  ** resets every field that was already loaded. */
+  for(pRow=p->pFirst; pRow; pRow=pRow->pNext){
+    pRow->bDescender = 0;
+    pRow->isStepParent = 0;
+    pRow->mergeUpto = 0;
+    pRow->cherrypickUpto = 0;
+    pRow->mergeDown = 0;
+    pRow->cherrypickDown = 0;
+    memset(pRow->mergeIn, 0, sizeof(pRow->mergeIn));
+    memset(pRow->aiRiser, -1, sizeof(pRow->aiRiser));
+  }
+  blob_reset(&x);
+  return 0;
+}
+
+/*
+** Save the layout of graph p in the cache fragment zKey.
+*/
+static void graph_cache_save(GraphContext *p, const char *zKey){
+  Blob x;
+  GraphCacheHdr hdr;
+  GraphCacheRow r;
+  GraphRow *pRow;
+  int i, iBase;
+  int aPair[2];
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = GRAPH_CACHE_MAGIC;
+  hdr.nRow = p->nRow;
+  hdr.nErr = p->nErr;
+  hdr.mxRail = p->mxRail;
+  hdr.bRailMapped = p->bRailMapped;
+  memcpy(hdr.aiRailMap, p->aiRailMap, sizeof(hdr.aiRailMap));
+  blob_init(&x, 0, 0);
+  blob_append(&x, (const char*)&hdr, sizeof(hdr));
+  iBase = p->pFirst->idx - 1;
+  for(pRow=p->pFirst; pRow && p->nErr==0; pRow=pRow->pNext){
+    memset(&r, 0, sizeof(r));
+    r.iRail = pRow->iRail;
+    r.mergeOut = pRow->mergeOut;
+    r.bDescender = pRow->bDescender;
+    r.isStepParent = pRow->isStepParent;
+    r.mergeUpto = pRow->mergeUpto>0 ? pRow->mergeUpto-iBase : pRow->mergeUpto;
+    r.cherrypickUpto = pRow->cherrypickUpto>0 ?
+                         pRow->cherrypickUpto-iBase : pRow->cherrypickUpto;
+    r.mergeDown = pRow->mergeDown;
+    r.cherrypickDown = pRow->cherrypickDown;
+    for(i=0; i<GR_MAX_RAIL; i++){
+      if( pRow->mergeIn[i]==1 ) r.mergeInMask |= BIT(i);
+      if( pRow->mergeIn[i]==2 ) r.cherrypickInMask |= BIT(i);
+      if( pRow->aiRiser[i]>=0 ) r.nRiser++;
+    }
+    blob_append(&x, (const char*)&r, sizeof(r));
+    for(i=0; i<GR_MAX_RAIL; i++){
+      if( pRow->aiRiser[i]<0 ) continue;
+      aPair[0] = i;
+      aPair[1] = pRow->aiRiser[i]>0 ? pRow->aiRiser[i]-iBase : 0;
+      blob_append(&x, (const char*)aPair, sizeof(aPair));
+    }
+  }
+  cache_fragment_write(zKey, &x);
+  blob_reset(&x);
+}
+
+/*
+** Compute the complete graph.
+**
+** Graphs with at least "graph-cache-rows" rows reuse the layout saved
+** by an earlier call for the same rows, if there is one, and save their
+** layout otherwise.  This only happens if the cache has been enabled
+** with "fossil cache init".
+*/
+void graph_finish(GraphContext *p, const char *zLeftBranch, u32 tmFlags){
+  char *zKey = 0;
+  int mnRow;
+  int i;
+
+  if( p==0 || p->pFirst==0 || p->nErr ) return;
+  mnRow = db_get_int("graph-cache-rows", 200);
+  if( mnRow>0 && p->nRow>=mnRow && g.repositoryOpen ){
+    zKey = graph_cache_key(p, zLeftBranch, tmFlags);
+    if( !graph_cache_load(p, zKey) ){
+      graph_layout(p, zLeftBranch, tmFlags);
+      graph_cache_save(p, zKey);
+    }
+    fossil_free(zKey);
+  }else{
+    graph_layout(p, zLeftBranch, tmFlags);
+  }
+  if( p->nErr==0 && p->bRailMapped ){
+    cgi_printf("<!-- aiRailMap =");
+    for(i=0; i<=p->mxRail; i++) cgi_printf(" %d", p->aiRailMap[i]);
+    cgi_printf(" -->\n");
+  }
 }
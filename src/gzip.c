@@ -20,9 +20,20 @@
 **
 ** State information is stored in static variables, so this implementation
 ** can only be building up a single GZIP file at a time.
+**
+** This file also implements a pool of worker processes that compress
+** independent pieces of data in parallel, for use by the archive
+** generators.
 */
 #include "config.h"
 #include <assert.h>
+#if !defined(_WIN32)
+# include <unistd.h>
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <signal.h>
+# include <errno.h>
+#endif
 #if defined(FOSSIL_ENABLE_MINIZ)
 #  define MINIZ_HEADER_FILE_ONLY
 #  include "miniz.c"
@@ -39,8 +50,19 @@ struct gzip_state {
   int iCRC;             /* The checksum */
   z_stream stream;      /* The working compressor */
   Blob out;             /* Results stored here */
+  void (*xOut)(const char*,int);  /* Or sent here, if not NULL */
+  int bPool;            /* True if compressing with the worker pool */
+  Blob block;           /* Input not yet handed to the worker pool */
+  unsigned int nIn;     /* Total input when using the worker pool */
 } gzip;
 
+/*
+** When the worker pool is used, the input is compressed in independent
+** blocks of about this many bytes, each of which ends on a byte boundary
+** so that the compressed blocks can simply be concatenated.
+*/
+#define GZIP_BLOCK_SIZE 262144
+
 /*
 ** Write a 32-bit integer as little-endian into the given buffer.
 */
@@ -52,12 +74,38 @@ static void put32(char *z, int v){
 }
 
 /*
-** Begin constructing a gzip file.
+** Read a 32-bit little-endian integer from the given buffer.
+*/
+static int get32(const char *z){
+  const unsigned char *a = (const unsigned char*)z;
+  return a[0] | (a[1]<<8) | (a[2]<<16) | ((unsigned)a[3]<<24);
+}
+
+/*
+** Deliver n bytes of compressed output.
+*/
+static void gzip_output(const char *z, int n){
+  if( n<=0 ) return;
+  if( gzip.xOut ){
+    gzip.xOut(z, n);
+  }else{
+    blob_append(&gzip.out, z, n);
+  }
+}
+
+/*
+** Begin constructing a gzip file.  If the deflate worker pool is
+** running, the file is compressed by the workers, as a series of
+** independent blocks.
 */
 void gzip_begin(sqlite3_int64 now){
   char aHdr[10];
   assert( gzip.eState==0 );
   blob_zero(&gzip.out);
+  gzip.xOut = 0;
+  gzip.bPool = deflate_pool_size()>0;
+  blob_zero(&gzip.block);
+  gzip.nIn = 0;
   aHdr[0] = 0x1f;
   aHdr[1] = 0x8b;
   aHdr[2] = 8;
@@ -68,11 +116,40 @@ void gzip_begin(sqlite3_int64 now){
   put32(&aHdr[4], now&0xffffffff);
   aHdr[8] = 2;
   aHdr[9] = -1;
-  blob_append(&gzip.out, aHdr, 10);
+  gzip_output(aHdr, 10);
   gzip.iCRC = 0;
   gzip.eState = 1;
 }
 
+/*
+** Begin constructing a gzip file that is handed to xOut, a piece at a
+** time, as it is compressed, rather than being held in memory until
+** gzip_finish().
+*/
+void gzip_begin_stream(sqlite3_int64 now, void (*xOut)(const char*,int)){
+  gzip_begin(now);
+  gzip.xOut = xOut;
+  gzip_output(blob_buffer(&gzip.out), blob_size(&gzip.out));
+  blob_reset(&gzip.out);
+}
+
+/*
+** Hand the input accumulated in gzip.block to the worker pool, first
+** collecting the oldest result if all workers are busy.
+*/
+static void gzip_pool_submit(int bFinish){
+  if( deflate_pool_full() ){
+    Blob r;
+    blob_zero(&r);
+    deflate_pool_collect(&r);
+    gzip_output(blob_buffer(&r), blob_size(&r));
+    blob_reset(&r);
+  }
+  deflate_pool_submit(blob_buffer(&gzip.block), blob_size(&gzip.block),
+                      bFinish);
+  blob_reset(&gzip.block);
+}
+
 /*
 ** Add nIn bytes of content from pIn to the gzip file.
 */
@@ -81,6 +158,15 @@ void gzip_step(const char *pIn, int nIn){
   char *zOutBuf;
   int nOut;
 
+  if( gzip.bPool ){
+    gzip.eState = 2;
+    gzip.iCRC = crc32(gzip.iCRC, (const unsigned char*)pIn, nIn);
+    gzip.nIn += nIn;
+    blob_append(&gzip.block, pIn, nIn);
+    if( blob_size(&gzip.block)>=GZIP_BLOCK_SIZE ) gzip_pool_submit(0);
+    return;
+  }
+
   nOut = nIn + nIn/10 + 100;
   if( nOut<100000 ) nOut = 100000;
   zOutBuf = fossil_malloc(nOut);
@@ -98,7 +184,7 @@ void gzip_step(const char *pIn, int nIn){
   gzip.iCRC = crc32(gzip.iCRC, gzip.stream.next_in, gzip.stream.avail_in);
   do{
     deflate(&gzip.stream, nIn==0 ? Z_FINISH : 0);
-    blob_append(&gzip.out, zOutBuf, nOut - gzip.stream.avail_out);
+    gzip_output(zOutBuf, nOut - gzip.stream.avail_out);
     gzip.stream.avail_out = nOut;
     gzip.stream.next_out = (unsigned char*)zOutBuf;
   }while( gzip.stream.avail_in>0 );
@@ -106,21 +192,297 @@ void gzip_step(const char *pIn, int nIn){
 }
 
 /*
-** Finish the gzip file and put the content in *pOut
+** Finish the gzip file and put the content in *pOut.  If the file is
+** being streamed, the rest of it goes to the output routine and *pOut
+** is left empty.
 */
 void gzip_finish(Blob *pOut){
   char aTrailer[8];
   assert( gzip.eState>0 );
-  gzip_step("", 0);
-  deflateEnd(&gzip.stream);
+  if( gzip.bPool ){
+    gzip_pool_submit(1);
+    while( deflate_pool_pending()>0 ){
+      Blob r;
+      blob_zero(&r);
+      deflate_pool_collect(&r);
+      gzip_output(blob_buffer(&r), blob_size(&r));
+      blob_reset(&r);
+    }
+    put32(&aTrailer[4], gzip.nIn);
+  }else{
+    gzip_step("", 0);
+    deflateEnd(&gzip.stream);
+    put32(&aTrailer[4], gzip.stream.total_in);
+  }
   put32(aTrailer, gzip.iCRC);
-  put32(&aTrailer[4], gzip.stream.total_in);
-  blob_append(&gzip.out, aTrailer, 8);
+  gzip_output(aTrailer, 8);
   *pOut = gzip.out;
   blob_zero(&gzip.out);
+  gzip.xOut = 0;
+  gzip.bPool = 0;
   gzip.eState = 0;
 }
 
+/*
+** Compress n bytes of z as a raw deflate stream and append the result
+** to pOut.  If bFinish is false, the stream is ended with a sync flush
+** instead of a final block, so that another raw deflate stream can be
+** appended to it.
+*/
+void gzip_deflate_raw(const char *z, int n, int bFinish, Blob *pOut){
+  z_stream stream;
+  char *zOutBuf = fossil_malloc(GZIP_BUFSZ);
+
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+  stream.avail_in = n;
+  stream.next_in = (unsigned char*)z;
+  do{
+    stream.avail_out = GZIP_BUFSZ;
+    stream.next_out = (unsigned char*)zOutBuf;
+    deflate(&stream, bFinish ? Z_FINISH : Z_SYNC_FLUSH);
+    blob_append(pOut, zOutBuf, GZIP_BUFSZ - stream.avail_out);
+  }while( stream.avail_out==0 );
+  deflateEnd(&stream);
+  fossil_free(zOutBuf);
+}
+
+/*
+** The deflate worker pool.
+**
+** Fossil is single-threaded, so data is compressed in parallel by worker
+** processes forked by deflate_pool_start().  Each worker reads requests
+** from a pipe, compresses them with gzip_deflate_raw() and writes the
+** results to another pipe.  Requests are given to the workers in turn
+** and results are collected in the order of the requests.  A worker is
+** only given a new request after its previous result has been collected,
+** so neither the workers nor the parent can block each other.
+**
+** Workers never touch the repository: the parent reads the content and
+** sends it to them.  On Windows there are no workers and compression is
+** done by the caller.
+*/
+#define DEFLATE_POOL_MAX 32
+static struct {
+  int nWorker;          /* Number of workers.  0 if there is no pool */
+  int nPending;         /* Requests whose result is not yet collected */
+  int iNext;            /* Worker for the next request */
+#if !defined(_WIN32)
+  int bPipeSaved;         /* True if xOldPipe must be restored */
+  void (*xOldPipe)(int);  /* SIGPIPE handler before the pool started */
+  struct {
+    pid_t pid;            /* Process id of the worker */
+    int fdReq;            /* Pipe to send requests */
+    int fdRes;            /* Pipe to read results */
+  } a[DEFLATE_POOL_MAX];
+#endif
+} dpool;
+
+#if !defined(_WIN32)
+/*
+** Read or write exactly n bytes.  Return false on failure.
+*/
+static int deflate_pool_read(int fd, char *z, int n){
+  while( n>0 ){
+    ssize_t got = read(fd, z, n);
+    if( got<=0 ){
+      if( got<0 && errno==EINTR ) continue;
+      return 0;
+    }
+    z += got;
+    n -= got;
+  }
+  return 1;
+}
+static int deflate_pool_write(int fd, const char *z, int n){
+  while( n>0 ){
+    ssize_t got = write(fd, z, n);
+    if( got<=0 ){
+      if( got<0 && errno==EINTR ) continue;
+      return 0;
+    }
+    z += got;
+    n -= got;
+  }
+  return 1;
+}
+
+/*
+** The body of a worker process.  A request is the size of the data and
+** the bFinish flag of gzip_deflate_raw(), as two 32-bit integers,
+** followed by the data.  A result is the size of the compressed data
+** followed by the compressed data.
+*/
+static void deflate_worker(int fdReq, int fdRes){
+  Blob in, out;
+  char aHdr[8];
+  blob_zero(&in);
+  blob_zero(&out);
+  while( deflate_pool_read(fdReq, aHdr, 8) ){
+    int n = get32(aHdr);
+    blob_resize(&in, n);
+    if( !deflate_pool_read(fdReq, blob_buffer(&in), n) ) break;
+    blob_reset(&out);
+    blob_append(&out, aHdr, 4);
+    gzip_deflate_raw(blob_buffer(&in), n, get32(&aHdr[4]), &out);
+    put32(blob_buffer(&out), blob_size(&out)-4);
+    if( !deflate_pool_write(fdRes, blob_buffer(&out), blob_size(&out)) ){
+      break;
+    }
+  }
+}
+#endif
+
+/*
+** Start a pool of nJob deflate workers, or of one worker per CPU if
+** nJob is zero or less.  Return the number of workers, which is zero if
+** there is no point in a pool, as for nJob==1, or if workers cannot be
+** started.
+*/
+int deflate_pool_start(int nJob){
+#if defined(_WIN32)
+  return 0;
+#else
+  int i;
+  assert( dpool.nWorker==0 );
+  if( nJob<=0 ) nJob = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if( nJob>DEFLATE_POOL_MAX ) nJob = DEFLATE_POOL_MAX;
+  if( nJob<=1 ) return 0;
+  dpool.xOldPipe = signal(SIGPIPE, SIG_IGN);
+  dpool.bPipeSaved = 1;
+  for(i=0; i<nJob; i++){
+    int aReq[2], aRes[2];
+    pid_t pid;
+    if( pipe(aReq)<0 ) break;
+    if( pipe(aRes)<0 ){
+      close(aReq[0]);
+      close(aReq[1]);
+      break;
+    }
+    pid = fork();
+    if( pid<0 ){
+      close(aReq[0]);
+      close(aReq[1]);
+      close(aRes[0]);
+      close(aRes[1]);
+      break;
+    }
+    if( pid==0 ){
+      /* This is the worker.  It must not flush stdio buffers inherited
+      ** from the parent or touch the database, so it leaves by _exit() */
+      int j;
+      for(j=0; j<i; j++){
+        close(dpool.a[j].fdReq);
+        close(dpool.a[j].fdRes);
+      }
+      close(aReq[1]);
+      close(aRes[0]);
+      deflate_worker(aReq[0], aRes[1]);
+      _exit(0);
+    }
+    close(aReq[0]);
+    close(aRes[1]);
+    dpool.a[i].pid = pid;
+    dpool.a[i].fdReq = aReq[1];
+    dpool.a[i].fdRes = aRes[0];
+    dpool.nWorker = i+1;
+  }
+  dpool.nPending = 0;
+  dpool.iNext = 0;
+  if( dpool.nWorker<2 ) deflate_pool_stop();
+  return dpool.nWorker;
+#endif
+}
+
+/*
+** Return the number of workers in the pool, or 0 if there is no pool.
+*/
+int deflate_pool_size(void){
+  return dpool.nWorker;
+}
+
+/*
+** Return the number of requests whose result has not been collected.
+*/
+int deflate_pool_pending(void){
+  return dpool.nPending;
+}
+
+/*
+** Return true if every worker has a request, so that a result must be
+** collected before another request can be submitted.
+*/
+int deflate_pool_full(void){
+  return dpool.nPending>=dpool.nWorker;
+}
+
+/*
+** Ask the next worker to compress n bytes of z, as gzip_deflate_raw()
+** would.  The pool must not be full.
+*/
+void deflate_pool_submit(const char *z, int n, int bFinish){
+#if !defined(_WIN32)
+  int i = dpool.iNext;
+  char aHdr[8];
+  assert( dpool.nPending<dpool.nWorker );
+  put32(aHdr, n);
+  put32(&aHdr[4], bFinish);
+  if( !deflate_pool_write(dpool.a[i].fdReq, aHdr, 8)
+   || !deflate_pool_write(dpool.a[i].fdReq, z, n)
+  ){
+    fossil_fatal("compression worker %d failed", (int)dpool.a[i].pid);
+  }
+  dpool.iNext = (i+1)%dpool.nWorker;
+  dpool.nPending++;
+#endif
+}
+
+/*
+** Append the result of the oldest request to pOut.
+*/
+void deflate_pool_collect(Blob *pOut){
+#if !defined(_WIN32)
+  int i = (dpool.iNext + dpool.nWorker - dpool.nPending)%dpool.nWorker;
+  int iOfst = blob_size(pOut);
+  char aHdr[4];
+  int n;
+  assert( dpool.nPending>0 );
+  if( !deflate_pool_read(dpool.a[i].fdRes, aHdr, 4) ){
+    fossil_fatal("compression worker %d failed", (int)dpool.a[i].pid);
+  }
+  n = get32(aHdr);
+  blob_resize(pOut, iOfst+n);
+  if( !deflate_pool_read(dpool.a[i].fdRes, blob_buffer(pOut)+iOfst, n) ){
+    fossil_fatal("compression worker %d failed", (int)dpool.a[i].pid);
+  }
+  dpool.nPending--;
+#endif
+}
+
+/*
+** Stop the workers.  Results not yet collected are lost.  The SIGPIPE
+** handler is restored only if deflate_pool_start() replaced it, so that
+** calling this routine without a pool leaves the handler alone.
+*/
+void deflate_pool_stop(void){
+#if !defined(_WIN32)
+  int i;
+  for(i=0; i<dpool.nWorker; i++){
+    close(dpool.a[i].fdReq);
+    close(dpool.a[i].fdRes);
+  }
+  for(i=0; i<dpool.nWorker; i++){
+    waitpid(dpool.a[i].pid, 0, 0);
+  }
+  if( dpool.bPipeSaved ){
+    if( dpool.xOldPipe!=SIG_ERR ) signal(SIGPIPE, dpool.xOldPipe);
+    dpool.bPipeSaved = 0;
+  }
+#endif
+  dpool.nWorker = 0;
+  dpool.nPending = 0;
+}
+
 /*
 ** COMMAND: test-gzip
 **
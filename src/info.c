@@ -627,8 +627,35 @@ void ci_tags_page(void){
 }
 
 /*
-** WEBPAGE: vinfo
-** WEBPAGE: ci
+** Return the base name, without a suffix, of the archives of check-in
+** zUuid that the Download: line of the check-in page links to.  It is
+** the project name, with characters that do not belong in file names
+** changed to "_", followed by "-" and the abbreviated hash.  The caller
+** must free the result.
+*/
+char *info_archive_name(const char *zUuid){
+  char *zPJ = db_get("short-project-name", 0);
+  char *zName;
+  Blob projName;
+  int jj;
+  if( zPJ==0 ) zPJ = db_get("project-name", "unnamed");
+  blob_zero(&projName);
+  blob_append(&projName, zPJ, -1);
+  blob_trim(&projName);
+  zPJ = blob_str(&projName);
+  for(jj=0; zPJ[jj]; jj++){
+    if( (zPJ[jj]>0 && zPJ[jj]<' ') || strchr("\"*/:<>?\\|", zPJ[jj]) ){
+      zPJ[jj] = '_';
+    }
+  }
+  zName = mprintf("%s-%S", zPJ, zUuid);
+  blob_reset(&projName);
+  return zName;
+}
+
+/*
+** WEBPAGE: vinfo cacheable
+** WEBPAGE: ci cacheable
 ** URL:  /ci/ARTIFACTID
 **  OR:  /ci?name=ARTIFACTID
 **
@@ -723,28 +750,16 @@ void ci_page(void){
 
     /* The Download: line */
     if( g.perm.Zip  ){
-      char *zPJ = db_get("short-project-name", 0);
+      char *zName = info_archive_name(zUuid);
       char *zUrl;
-      Blob projName;
-      int jj;
-      if( zPJ==0 ) zPJ = db_get("project-name", "unnamed");
-      blob_zero(&projName);
-      blob_append(&projName, zPJ, -1);
-      blob_trim(&projName);
-      zPJ = blob_str(&projName);
-      for(jj=0; zPJ[jj]; jj++){
-        if( (zPJ[jj]>0 && zPJ[jj]<' ') || strchr("\"*/:<>?\\|", zPJ[jj]) ){
-          zPJ[jj] = '_';
-        }
-      }
-      zUrl = mprintf("%R/tarball/%S/%t-%S.tar.gz", zUuid, zPJ, zUuid);
+      zUrl = mprintf("%R/tarball/%S/%t.tar.gz", zUuid, zName);
       @ <tr><th>Downloads:</th><td>
       @ %z(href("%s",zUrl))Tarball</a>
-      @ | %z(href("%R/zip/%S/%t-%S.zip",zUuid, zPJ,zUuid))ZIP archive</a>
-      @ | %z(href("%R/sqlar/%S/%t-%S.sqlar",zUuid,zPJ,zUuid))\
+      @ | %z(href("%R/zip/%S/%t.zip",zUuid,zName))ZIP archive</a>
+      @ | %z(href("%R/sqlar/%S/%t.sqlar",zUuid,zName))\
       @ SQL archive</a></td></tr>
       fossil_free(zUrl);
-      blob_reset(&projName);
+      fossil_free(zName);
     }
 
     @ <tr><th>Timelines:</th><td>
@@ -1160,7 +1175,7 @@ static void checkin_description(int rid){
 
 
 /*
-** WEBPAGE: vdiff
+** WEBPAGE: vdiff cacheable
 ** URL: /vdiff?from=TAG&to=TAG
 **
 ** Show the difference between two check-ins identified by the from= and
@@ -1622,7 +1637,7 @@ int object_description(
 
 
 /*
-** WEBPAGE: fdiff
+** WEBPAGE: fdiff cacheable
 ** URL: fdiff?v1=UUID&v2=UUID
 **
 ** Two arguments, v1 and v2, identify the artifacts to be diffed.
@@ -1887,7 +1902,7 @@ static void hexdump(Blob *pBlob){
 }
 
 /*
-** WEBPAGE: hexdump
+** WEBPAGE: hexdump cacheable
 ** URL: /hexdump?name=ARTIFACTID
 **
 ** Show the complete content of a file identified by ARTIFACTID
@@ -2079,9 +2094,9 @@ void output_text_with_line_numbers(
 
 
 /*
-** WEBPAGE: artifact
-** WEBPAGE: file
-** WEBPAGE: whatis
+** WEBPAGE: artifact cacheable
+** WEBPAGE: file cacheable
+** WEBPAGE: whatis cacheable
 **
 ** Typical usage:
 **
@@ -2422,7 +2437,7 @@ void tinfo_page(void){
 
 
 /*
-** WEBPAGE: info
+** WEBPAGE: info cacheable
 ** URL: info/ARTIFACTID
 **
 ** The argument is a artifact ID which might be a check-in or a file or
@@ -249,6 +249,61 @@ static char json_timeline_add_time_clause(Blob *pSql){
   return rc;
 }
 
+/*
+** State carried from json_timeline_setup_sql() to
+** json_timeline_add_cursor() for the pending timeline query.
+*/
+static struct {
+  char *zFilter;        /* Conditions that select the timeline events */
+  int bNewest;          /* True if events are listed newest first */
+  int limit;            /* The LIMIT of the query.  0 for none */
+} jtCursor = {0, 0, 0};
+
+/*
+** Helper for the timeline family of functions.  If the "cursor"
+** environment parameter holds a cursor from an earlier page of the same
+** timeline, append the clauses that select the events older than that
+** page to pSql and return true.  Otherwise return false.
+*/
+static int json_timeline_add_cursor_clause(Blob *pSql, const char *zFilter){
+  char const * zCursor = json_find_option_cstr("cursor",NULL,NULL);
+  double rMtime;
+  int rid;
+  if( zCursor==0
+   || !timeline_cursor_decode(zCursor, zFilter, &rMtime, &rid)
+  ){
+    return 0;
+  }
+  timeline_cursor_sql(pSql, rMtime, rid);
+  blob_append(pSql, " ORDER BY event.mtime DESC, event.objid DESC ", -1);
+  return 1;
+}
+
+/*
+** If the query set up by json_timeline_setup_sql() filled a full page
+** of events, newest first, add to pPayload the "cursor" property with
+** which a client fetches the next, older, page.
+*/
+static void json_timeline_add_cursor(cson_object * pPayload){
+  Stmt q = empty_Stmt;
+  if( jtCursor.zFilter && jtCursor.bNewest && jtCursor.limit>0
+   && db_int(0, "SELECT count(*) FROM json_timeline")>=jtCursor.limit
+  ){
+    db_prepare(&q, "SELECT event.mtime, event.objid"
+                   " FROM json_timeline JOIN event ON event.objid=rid"
+                   " ORDER BY sortId DESC LIMIT 1");
+    if( db_step(&q)==SQLITE_ROW ){
+      char *zCursor = timeline_cursor(db_column_double(&q,0),
+                                      db_column_int(&q,1), jtCursor.zFilter);
+      cson_object_set(pPayload, "cursor", json_new_string(zCursor));
+      fossil_free(zCursor);
+    }
+    db_finalize(&q);
+  }
+  fossil_free(jtCursor.zFilter);
+  jtCursor.zFilter = 0;
+}
+
 /*
 ** Tries to figure out a timeline query length limit base on
 ** environment parameters. If it can it returns that value,
@@ -296,8 +351,15 @@ static int json_timeline_setup_sql( char const * zEventType,
   if( json_timeline_add_tag_branch_clause(pSql, pPayload) < 0 ){
     return FSL_JSON_E_INVALID_ARGS;
   }
-  json_timeline_add_time_clause(pSql);
+  fossil_free(jtCursor.zFilter);
+  jtCursor.zFilter = fossil_strdup(blob_str(pSql));
+  if( json_timeline_add_cursor_clause(pSql, jtCursor.zFilter) ){
+    jtCursor.bNewest = 1;
+  }else{
+    jtCursor.bNewest = json_timeline_add_time_clause(pSql)<=0;
+  }
   limit = json_timeline_limit(20);
+  jtCursor.limit = limit;
   if(limit>0){
     blob_appendf(pSql,"LIMIT %d ",limit);
   }
@@ -488,6 +550,7 @@ static cson_value * json_timeline_ci(){
   SET("timelineSql");
 #endif
   db_multi_exec("%s", blob_buffer(&sql)/*safe-for-%s*/);
+  json_timeline_add_cursor(pay);
   blob_reset(&sql);
   db_prepare(&q, "SELECT "
              " rid AS rid"
@@ -552,6 +615,7 @@ cson_value * json_timeline_event(){
   cson_object_set(pay, "timelineSql", cson_value_new_string(blob_buffer(&sql),strlen(blob_buffer(&sql))));
 #endif
   db_multi_exec("%s", blob_buffer(&sql) /*safe-for-%s*/);
+  json_timeline_add_cursor(pay);
   blob_reset(&sql);
   db_prepare(&q, "SELECT"
              /* For events, the name is generally more useful than
@@ -608,6 +672,7 @@ cson_value * json_timeline_wiki(){
   cson_object_set(pay, "timelineSql", cson_value_new_string(blob_buffer(&sql),strlen(blob_buffer(&sql))));
 #endif
   db_multi_exec("%s", blob_buffer(&sql) /*safe-for-%s*/);
+  json_timeline_add_cursor(pay);
   blob_reset(&sql);
   db_prepare(&q, "SELECT"
              " uuid AS uuid,"
@@ -667,6 +732,7 @@ static cson_value * json_timeline_ticket(){
   }
 
   db_multi_exec("%s", blob_buffer(&sql) /*safe-for-%s*/);
+  json_timeline_add_cursor(pay);
 #define SET(K) if(0!=(check=cson_object_set(pay,K,tmp))){ \
     json_set_err((cson_rc.AllocError==check)        \
                  ? FSL_JSON_E_ALLOC : FSL_JSON_E_UNKNOWN,      \
@@ -158,6 +158,8 @@ struct Global {
   int fSqlTrace;          /* True if --sqltrace flag is present */
   int fSqlStats;          /* True if --sqltrace or --sqlstats are present */
   int fSqlPrint;          /* True if --sqlprint flag is present */
+  const char *zMmapSize;  /* Value of --mmap-size, or NULL */
+  const char *zCacheSize; /* Value of --cache-size, or NULL */
   int fCgiTrace;          /* True if --cgitrace is enabled */
   int fQuiet;             /* True if -quiet flag is present */
   int fJail;              /* True if running with a chroot jail */
@@ -687,6 +689,8 @@ int main(int argc, char **argv)
       fossil_fatal("no such VFS: \"%s\"", g.zVfsName);
     }
   }
+  g.zMmapSize = find_option("mmap-size",0,1);
+  g.zCacheSize = find_option("cache-size",0,1);
   if( fossil_getenv("GATEWAY_INTERFACE")!=0 && !find_option("nocgi", 0, 0)){
     zCmdName = "cgi";
     g.isHTTP = 1;
@@ -1788,13 +1792,28 @@ static void process_one_web_page(
       @ the administrator to run <b>fossil rebuild</b>.</p>
     }
   }else{
+    char *zPageKey = 0;         /* Key for the page cache */
     if( (pCmd->eCmdFlags & CMDFLAG_RAWCONTENT)==0 ){
       cgi_decode_post_parameters();
     }
+    if( db_get_boolean("sql-profile",0) ){
+      db_sqlprof_start();
+    }else if( P("sqlprof")!=0 ){
+      /* The ?sqlprof query parameter is for administrators only */
+      login_check_credentials();
+      if( g.perm.Admin ) db_sqlprof_start();
+    }
     if( g.fCgiTrace ){
       fossil_trace("######## Calling %s #########\n", pCmd->zName);
       cgi_print_all(1, 1);
     }
+    if( (pCmd->eCmdFlags & CMDFLAG_CACHEABLE)!=0 ){
+      zPageKey = cache_page_key();
+    }
+    if( zPageKey && cache_page_serve(zPageKey) ){
+      cgi_reply();
+      return;
+    }
 #ifdef FOSSIL_ENABLE_TH1_HOOKS
     {
       /*
@@ -1832,6 +1851,7 @@ static void process_one_web_page(
       }
     }
 #endif
+    if( zPageKey ) cache_page_store(zPageKey);
   }
 
   /* Return the result.
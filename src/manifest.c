@@ -51,6 +51,7 @@
 #define MC_NONE           0  /*  default handling           */
 #define MC_PERMIT_HOOKS   1  /*  permit hooks to execute    */
 #define MC_NO_ERRORS      2  /*  do not issue errors for a bad parse */
+#define MC_HASH_VERIFIED  4  /*  artifact hash checked.  Skip the Z-card */
 
 /*
 ** A single F-card within a manifest
@@ -96,6 +97,7 @@ struct Manifest {
   int nParentAlloc;     /* Slots allocated in azParent[] */
   char **azParent;      /* Hashes of parents.  One for each P card argument */
   int nCherrypick;      /* Number of entries in aCherrypick[] */
+  int nCherrypickAlloc; /* Slots allocated in aCherrypick[] */
   struct {
     char *zCPTarget;    /* Hash for cherry-picked version w/ +|- prefix */
     char *zCPBase;      /* Hash for cherry-pick baseline. NULL for singletons */
@@ -116,6 +118,14 @@ struct Manifest {
     char *zName;           /* Key or field name */
     char *zValue;          /* Value of the field */
   } *aField;            /* One for each J card */
+  int iBaseFile;        /* Iterator position within pBaseline->aFile[] */
+  int nRef;             /* Delta manifests using this one as pBaseline */
+  int nArenaByte;       /* Size of the allocation holding this object */
+  int inCache;          /* True if held in the manifest cache */
+  int nCacheByte;       /* Memory charged to the manifest cache */
+  Manifest *pHashNext;  /* Next manifest in the same cache hash bucket */
+  Manifest *pLruNext;   /* Next older unreferenced manifest in the cache */
+  Manifest *pLruPrev;   /* Next newer unreferenced manifest in the cache */
 };
 #endif
 
@@ -154,15 +164,28 @@ static const char *const azNameOfMType[] = {
 };
 
 /*
-** A cache of parsed manifests.  This reduces the number of
-** calls to manifest_parse() when doing a rebuild.
+** A cache of parsed check-in manifests, so that operations that walk
+** many check-ins do not parse the same manifests over and over.
+**
+** Every manifest in the cache is in the hash table, found by rid.  A
+** manifest in the cache is either unreferenced, in which case it is also
+** on the LRU list and may be handed out to a caller or evicted, or it
+** is the baseline of one or more delta manifests (nRef>0).  Baselines
+** are shared by all of the delta manifests that use them and stay in
+** the cache while any of those delta manifests are alive.
+**
+** Manifests are evicted, least recently used first, to keep the memory
+** used by the cache within the limit of the "manifest-cache-size"
+** setting.
 */
-#define MX_MANIFEST_CACHE 6
+#define MANIFEST_CACHE_NHASH 1021
 static struct {
-  int nxAge;
-  int aAge[MX_MANIFEST_CACHE];
-  Manifest *apManifest[MX_MANIFEST_CACHE];
-} manifestCache;
+  Manifest **aHash;     /* Hash table of cached manifests, by rid */
+  Manifest *pLruFirst;  /* Most recently used unreferenced manifest */
+  Manifest *pLruLast;   /* Least recently used unreferenced manifest */
+  sqlite3_int64 nByte;  /* Memory used by manifests in the cache */
+  sqlite3_int64 mxByte; /* Memory budget for the cache.  -1 if unknown */
+} manifestCache = { 0, 0, 0, 0, -1 };
 
 /*
 ** True if manifest_crosslink_begin() has been called but
@@ -171,20 +194,31 @@ static struct {
 static int manifest_crosslink_busy = 0;
 
 /*
-** Clear the memory allocated in a manifest object
+** Clear the memory allocated in a manifest object and release
+** its baseline.  The card arrays live in the same allocation as
+** the Manifest object itself.  See manifest_alloc().
 */
-void manifest_destroy(Manifest *p){
+static void manifest_free(Manifest *p){
   if( p ){
+    Manifest *pBaseline = p->pBaseline;
     blob_reset(&p->content);
-    fossil_free(p->aFile);
-    fossil_free(p->azParent);
-    fossil_free(p->azCChild);
-    fossil_free(p->aTag);
-    fossil_free(p->aField);
-    fossil_free(p->aCherrypick);
-    if( p->pBaseline ) manifest_destroy(p->pBaseline);
     memset(p, 0, sizeof(*p));
     fossil_free(p);
+    if( pBaseline ) manifest_baseline_release(pBaseline);
+  }
+}
+
+/*
+** Release a manifest object obtained from manifest_get() or
+** manifest_parse().  Check-in manifests are returned to the manifest
+** cache for reuse.  Other manifests are freed.
+*/
+void manifest_destroy(Manifest *p){
+  if( p==0 ) return;
+  if( p->type==CFTYPE_MANIFEST && p->rid>0 ){
+    manifest_cache_insert(p);
+  }else{
+    manifest_free(p);
   }
 }
 
@@ -214,62 +248,202 @@ static char maskToType(unsigned int x){
 }
 
 /*
-** Add an element to the manifest cache using LRU replacement.
+** Return the manifest with the given rid from the cache hash table,
+** or NULL if there is no such manifest in the cache.
+*/
+static Manifest *manifest_cache_lookup(int rid){
+  Manifest *p;
+  if( manifestCache.aHash==0 ) return 0;
+  p = manifestCache.aHash[rid % MANIFEST_CACHE_NHASH];
+  while( p && p->rid!=rid ) p = p->pHashNext;
+  return p;
+}
+
+/*
+** Add manifest p to the hash table of the cache.
+*/
+static void manifest_cache_hash_add(Manifest *p){
+  int h;
+  if( manifestCache.aHash==0 ){
+    manifestCache.aHash =
+       fossil_malloc( sizeof(Manifest*)*MANIFEST_CACHE_NHASH );
+    memset(manifestCache.aHash, 0, sizeof(Manifest*)*MANIFEST_CACHE_NHASH);
+  }
+  h = p->rid % MANIFEST_CACHE_NHASH;
+  p->pHashNext = manifestCache.aHash[h];
+  manifestCache.aHash[h] = p;
+  p->inCache = 1;
+  p->nCacheByte = p->nArenaByte + blob_size(&p->content);
+  manifestCache.nByte += p->nCacheByte;
+}
+
+/*
+** Remove manifest p from the hash table of the cache.
+*/
+static void manifest_cache_hash_remove(Manifest *p){
+  Manifest **pp = &manifestCache.aHash[p->rid % MANIFEST_CACHE_NHASH];
+  while( *pp!=p ) pp = &(*pp)->pHashNext;
+  *pp = p->pHashNext;
+  p->pHashNext = 0;
+  p->inCache = 0;
+  manifestCache.nByte -= p->nCacheByte;
+}
+
+/*
+** Put manifest p at the most recently used end of the LRU list.
+*/
+static void manifest_lru_push(Manifest *p){
+  p->pLruPrev = 0;
+  p->pLruNext = manifestCache.pLruFirst;
+  if( manifestCache.pLruFirst ){
+    manifestCache.pLruFirst->pLruPrev = p;
+  }else{
+    manifestCache.pLruLast = p;
+  }
+  manifestCache.pLruFirst = p;
+}
+
+/*
+** Remove manifest p from the LRU list.
+*/
+static void manifest_lru_remove(Manifest *p){
+  if( p->pLruPrev ){
+    p->pLruPrev->pLruNext = p->pLruNext;
+  }else{
+    manifestCache.pLruFirst = p->pLruNext;
+  }
+  if( p->pLruNext ){
+    p->pLruNext->pLruPrev = p->pLruPrev;
+  }else{
+    manifestCache.pLruLast = p->pLruPrev;
+  }
+  p->pLruNext = p->pLruPrev = 0;
+}
+
+/*
+** Evict unreferenced manifests, least recently used first, until the
+** cache fits within its memory budget.
+*/
+static void manifest_cache_trim(void){
+  if( manifestCache.mxByte<0 ){
+    manifestCache.mxByte =
+       (sqlite3_int64)db_get_int("manifest-cache-size", 32)*1048576;
+  }
+  while( manifestCache.nByte>manifestCache.mxByte && manifestCache.pLruLast ){
+    Manifest *p = manifestCache.pLruLast;
+    manifest_lru_remove(p);
+    manifest_cache_hash_remove(p);
+    manifest_free(p);
+  }
+}
+
+/*
+** Add a check-in manifest to the manifest cache.  The cache takes
+** ownership of p.
 */
 void manifest_cache_insert(Manifest *p){
-  while( p ){
-    int i;
-    Manifest *pBaseline = p->pBaseline;
-    p->pBaseline = 0;
-    for(i=0; i<MX_MANIFEST_CACHE; i++){
-      if( manifestCache.apManifest[i]==0 ) break;
-    }
-    if( i>=MX_MANIFEST_CACHE ){
-      int oldest = 0;
-      int oldestAge = manifestCache.aAge[0];
-      for(i=1; i<MX_MANIFEST_CACHE; i++){
-        if( manifestCache.aAge[i]<oldestAge ){
-          oldest = i;
-          oldestAge = manifestCache.aAge[i];
-        }
-      }
-      manifest_destroy(manifestCache.apManifest[oldest]);
-      i = oldest;
-    }
-    manifestCache.aAge[i] = ++manifestCache.nxAge;
-    manifestCache.apManifest[i] = p;
-    p = pBaseline;
+  if( p==0 ) return;
+  if( p->rid<=0 || manifest_cache_lookup(p->rid)!=0 ){
+    manifest_free(p);
+    return;
   }
+  manifest_cache_hash_add(p);
+  manifest_lru_push(p);
+  manifest_cache_trim();
 }
 
 /*
-** Try to extract a line from the manifest cache. Return 1 if found.
-** Return 0 if not found.
+** Remove the manifest with the given rid from the cache and return it.
+** The caller becomes the owner of the returned manifest.  Return NULL
+** if the manifest is not in the cache, or if it is in use as the
+** baseline of some delta manifest and so cannot be handed out.
 */
 static Manifest *manifest_cache_find(int rid){
-  int i;
-  Manifest *p;
-  for(i=0; i<MX_MANIFEST_CACHE; i++){
-    if( manifestCache.apManifest[i] && manifestCache.apManifest[i]->rid==rid ){
-      p = manifestCache.apManifest[i];
-      manifestCache.apManifest[i] = 0;
-      return p;
-    }
+  Manifest *p = manifest_cache_lookup(rid);
+  if( p==0 || p->nRef>0 ) return 0;
+  manifest_lru_remove(p);
+  manifest_cache_hash_remove(p);
+  p->iFile = 0;
+  p->iBaseFile = 0;
+  return p;
+}
+
+/*
+** Return the baseline manifest with the given rid for use by a delta
+** manifest, or NULL if it cannot be loaded.  The baseline is shared
+** with every other delta manifest that uses it.  Release it with
+** manifest_baseline_release().
+*/
+static Manifest *manifest_baseline_get(int rid){
+  Manifest *p = manifest_cache_lookup(rid);
+  if( p==0 ){
+    p = manifest_get(rid, CFTYPE_MANIFEST, 0);
+    if( p==0 ) return 0;
+    manifest_cache_hash_add(p);
+  }else if( p->type!=CFTYPE_MANIFEST ){
+    return 0;
+  }else if( p->nRef==0 ){
+    manifest_lru_remove(p);
+  }
+  p->nRef++;
+  return p;
+}
+
+/*
+** Release a baseline obtained from manifest_baseline_get().  When no
+** delta manifest uses it any longer, the baseline becomes an ordinary
+** entry in the cache.
+*/
+LOCAL void manifest_baseline_release(Manifest *p){
+  assert( p->nRef>0 );
+  if( --p->nRef>0 ) return;
+  if( p->inCache ){
+    manifest_lru_push(p);
+    manifest_cache_trim();
+  }else{
+    manifest_free(p);
   }
-  return 0;
 }
 
 /*
 ** Clear the manifest cache.
+**
+** Baselines still in use by delta manifests outside of the cache are
+** dropped from the cache and freed when their last user releases them.
 */
 void manifest_cache_clear(void){
   int i;
-  for(i=0; i<MX_MANIFEST_CACHE; i++){
-    if( manifestCache.apManifest[i] ){
-      manifest_destroy(manifestCache.apManifest[i]);
+  while( manifestCache.pLruLast ){
+    Manifest *p = manifestCache.pLruLast;
+    manifest_lru_remove(p);
+    manifest_cache_hash_remove(p);
+    manifest_free(p);
+  }
+  if( manifestCache.aHash ){
+    for(i=0; i<MANIFEST_CACHE_NHASH; i++){
+      while( manifestCache.aHash[i] ){
+        manifest_cache_hash_remove(manifestCache.aHash[i]);
+      }
     }
+    fossil_free(manifestCache.aHash);
   }
   memset(&manifestCache, 0, sizeof(manifestCache));
+  manifestCache.mxByte = -1;
+}
+
+/*
+** The RIDs of artifacts whose Z-card has been verified during the
+** current transaction.  A RID can name different content after a
+** rollback or a purge, so this is cleared whenever a transaction ends.
+*/
+static Bag manifestZOk;
+
+/*
+** Forget which Z-cards have been verified.  Called by db_end_transaction()
+** and db_force_rollback() when the outermost transaction ends.
+*/
+void manifest_zcard_forget(void){
+  bag_clear(&manifestZOk);
 }
 
 #ifdef FOSSIL_DONT_VERIFY_MANIFEST_MD5SUM
@@ -380,6 +554,70 @@ static char next_card(ManifestText *p){
   return c;
 }
 
+/*
+** Allocate a new, zeroed Manifest object for the n bytes of artifact
+** text in z[].
+**
+** The aFile[], aField[], azCChild[], azParent[], aCherrypick[] and aTag[]
+** arrays are carved out of the same allocation as the Manifest object,
+** so that parsing does no further memory allocation and the object is
+** released with a single free.  A quick pass over the text finds how
+** many cards of each kind there are, to size those arrays.  Lines of
+** W-card text that happen to look like cards are counted too, which
+** only makes the arrays a little larger than needed.
+*/
+static Manifest *manifest_alloc(const char *z, int n){
+  int nF = 0, nJ = 0, nM = 0, nP = 0, nQ = 0, nT = 0;
+  const char *zEnd = &z[n];
+  sqlite3_int64 nByte;
+  Manifest *p;
+  char *pSpace;
+
+  while( z<zEnd ){
+    switch( z[0] ){
+      case 'F':  nF++;  break;
+      case 'J':  nJ++;  break;
+      case 'M':  nM++;  break;
+      case 'Q':  nQ++;  break;
+      case 'T':  nT++;  break;
+      case 'P': {
+        for(z++; z<zEnd && z[0]!='\n'; z++){
+          if( z[0]==' ' ) nP++;
+        }
+        break;
+      }
+    }
+    z = memchr(z, '\n', zEnd-z);
+    if( z==0 ) break;
+    z++;
+  }
+  nByte = sizeof(*p) + nF*sizeof(p->aFile[0]) + nJ*sizeof(p->aField[0])
+        + nM*sizeof(p->azCChild[0]) + nP*sizeof(p->azParent[0])
+        + nQ*sizeof(p->aCherrypick[0]) + nT*sizeof(p->aTag[0]);
+  p = fossil_malloc( nByte );
+  memset(p, 0, sizeof(*p));
+  p->nArenaByte = (int)nByte;
+  pSpace = (char*)&p[1];
+  p->aFile = (ManifestFile*)pSpace;
+  p->nFileAlloc = nF;
+  pSpace += nF*sizeof(p->aFile[0]);
+  p->aField = (void*)pSpace;
+  p->nFieldAlloc = nJ;
+  pSpace += nJ*sizeof(p->aField[0]);
+  p->azCChild = (char**)pSpace;
+  p->nCChildAlloc = nM;
+  pSpace += nM*sizeof(p->azCChild[0]);
+  p->azParent = (char**)pSpace;
+  p->nParentAlloc = nP;
+  pSpace += nP*sizeof(p->azParent[0]);
+  p->aCherrypick = (void*)pSpace;
+  p->nCherrypickAlloc = nQ;
+  pSpace += nQ*sizeof(p->aCherrypick[0]);
+  p->aTag = (struct TagType*)pSpace;
+  p->nTagAlloc = nT;
+  return p;
+}
+
 /*
 ** Shorthand for a control-artifact parsing error
 */
@@ -414,8 +652,17 @@ static char next_card(ManifestText *p){
 ** The first token is a single upper-case letter which is the card type.
 ** The card type determines the other parameters to the card.
 ** Cards must occur in lexicographical order.
+**
+** If mFlags includes MC_HASH_VERIFIED, the caller has already checked
+** the content against the artifact hash, which is a stronger check than
+** the MD5 checksum on the Z-card, so the Z-card checksum is not verified.
 */
-Manifest *manifest_parse(Blob *pContent, int rid, Blob *pErr){
+Manifest *manifest_parse_ex(
+  Blob *pContent,         /* The artifact to parse */
+  int rid,                /* The blob-id of the artifact, or 0 */
+  int mFlags,             /* MC_HASH_VERIFIED or 0 */
+  Blob *pErr              /* Write error messages here, if not NULL */
+){
   Manifest *p;
   int i, lineNo=0;
   ManifestText x;
@@ -467,18 +714,26 @@ Manifest *manifest_parse(Blob *pContent, int rid, Blob *pErr){
     blob_appendf(pErr, "line 1 not recognized");
     return 0;
   }
-  /* Then verify the Z-card.
+  /* Then verify the Z-card.  That can be skipped if the hash of the
+  ** artifact is known to be correct, or if the Z-card of the same
+  ** artifact was verified by an earlier parse in the same transaction.
   */
-  if( verify_z_card(z, n)==2 ){
-    blob_reset(pContent);
-    blob_appendf(pErr, "incorrect Z-card cksum");
-    return 0;
+  if( (mFlags & MC_HASH_VERIFIED)==0
+   && (rid==0 || !bag_find(&manifestZOk, rid))
+  ){
+    if( verify_z_card(z, n)==2 ){
+      blob_reset(pContent);
+      blob_appendf(pErr, "incorrect Z-card cksum");
+      return 0;
+    }
+    if( rid && db_transaction_nesting_depth()>0 ){
+      bag_insert(&manifestZOk, rid);
+    }
   }
 
   /* Allocate a Manifest object to hold the parsed control artifact.
   */
-  p = fossil_malloc( sizeof(*p) );
-  memset(p, 0, sizeof(*p));
+  p = manifest_alloc(z, n);
   memcpy(&p->content, pContent, sizeof(p->content));
   p->rid = rid;
   blob_zero(pContent);
@@ -626,11 +881,7 @@ Manifest *manifest_parse(Blob *pContent, int rid, Blob *pErr){
             SYNTAX("F-card old filename is not a simple path");
           }
         }
-        if( p->nFile>=p->nFileAlloc ){
-          p->nFileAlloc = p->nFileAlloc*2 + 10;
-          p->aFile = fossil_realloc(p->aFile,
-                                    p->nFileAlloc*sizeof(p->aFile[0]) );
-        }
+        if( p->nFile>=p->nFileAlloc ) SYNTAX("too many F-cards");
         i = p->nFile++;
         p->aFile[i].zName = zName;
         p->aFile[i].zUuid = zUuid;
@@ -706,11 +957,7 @@ Manifest *manifest_parse(Blob *pContent, int rid, Blob *pErr){
         if( zName==0 ) SYNTAX("name missing from J-card");
         if( zValue==0 ) zValue = "";
         defossilize(zValue);
-        if( p->nField>=p->nFieldAlloc ){
-          p->nFieldAlloc = p->nFieldAlloc*2 + 10;
-          p->aField = fossil_realloc(p->aField,
-                               p->nFieldAlloc*sizeof(p->aField[0]) );
-        }
+        if( p->nField>=p->nFieldAlloc ) SYNTAX("too many J-cards");
         i = p->nField++;
         p->aField[i].zName = zName;
         p->aField[i].zValue = zValue;
@@ -769,11 +1016,7 @@ Manifest *manifest_parse(Blob *pContent, int rid, Blob *pErr){
         if( !hname_validate(zUuid,sz) ){
           SYNTAX("Invalid hash on M-card");
         }
-        if( p->nCChild>=p->nCChildAlloc ){
-          p->nCChildAlloc = p->nCChildAlloc*2 + 10;
-          p->azCChild = fossil_realloc(p->azCChild
-                                 , p->nCChildAlloc*sizeof(p->azCChild[0]) );
-        }
+        if( p->nCChild>=p->nCChildAlloc ) SYNTAX("too many M-cards");
         i = p->nCChild++;
         p->azCChild[i] = zUuid;
         if( i>0 && fossil_strcmp(p->azCChild[i-1], zUuid)>=0 ){
@@ -810,11 +1053,7 @@ Manifest *manifest_parse(Blob *pContent, int rid, Blob *pErr){
           if( !hname_validate(zUuid, sz) ){
              SYNTAX("invalid hash on P-card");
           }
-          if( p->nParent>=p->nParentAlloc ){
-            p->nParentAlloc = p->nParentAlloc*2 + 5;
-            p->azParent = fossil_realloc(p->azParent,
-                               p->nParentAlloc*sizeof(char*));
-          }
+          if( p->nParent>=p->nParentAlloc ) SYNTAX("too many hashes on P-card");
           i = p->nParent++;
           p->azParent[i] = zUuid;
         }
@@ -835,10 +1074,8 @@ Manifest *manifest_parse(Blob *pContent, int rid, Blob *pErr){
         if( !hname_validate(&zUuid[1], sz-1) ){
           SYNTAX("invalid hash on Q-card");
         }
-        n = p->nCherrypick;
-        p->nCherrypick++;
-        p->aCherrypick = fossil_realloc(p->aCherrypick,
-                                 p->nCherrypick*sizeof(p->aCherrypick[0]));
+        if( p->nCherrypick>=p->nCherrypickAlloc ) SYNTAX("too many Q-cards");
+        n = p->nCherrypick++;
         p->aCherrypick[n].zCPTarget = zUuid;
         p->aCherrypick[n].zCPBase = zUuid = next_token(&x, &sz);
         if( zUuid && !hname_validate(zUuid,sz) ){
@@ -903,10 +1140,7 @@ Manifest *manifest_parse(Blob *pContent, int rid, Blob *pErr){
           /* Do not allow tags whose names look like a hash */
           SYNTAX("T-card name looks like a hexadecimal hash");
         }
-        if( p->nTag>=p->nTagAlloc ){
-          p->nTagAlloc = p->nTagAlloc*2 + 10;
-          p->aTag = fossil_realloc(p->aTag, p->nTagAlloc*sizeof(p->aTag[0]) );
-        }
+        if( p->nTag>=p->nTagAlloc ) SYNTAX("too many T-cards");
         i = p->nTag++;
         p->aTag[i].zName = zName;
         p->aTag[i].zUuid = zUuid;
@@ -1065,10 +1299,17 @@ manifest_syntax_error:
     blob_appendf(pErr, "unknown error on line %d", lineNo);
   }
   md5sum_init();
-  manifest_destroy(p);
+  manifest_free(p);
   return 0;
 }
 
+/*
+** Parse a blob into a Manifest object.  See manifest_parse_ex().
+*/
+Manifest *manifest_parse(Blob *pContent, int rid, Blob *pErr){
+  return manifest_parse_ex(pContent, rid, 0, pErr);
+}
+
 /*
 ** Get a manifest given the rid for the control artifact.  Return
 ** a pointer to the manifest on success or NULL if there is a failure.
@@ -1193,7 +1434,7 @@ void manifest_test_parse_all_blobs_cmd(void){
 static int fetch_baseline(Manifest *p, int throwError){
   if( p->zBaseline!=0 && p->pBaseline==0 ){
     int rid = uuid_to_rid(p->zBaseline, 1);
-    p->pBaseline = manifest_get(rid, CFTYPE_MANIFEST, 0);
+    p->pBaseline = manifest_baseline_get(rid);
     if( p->pBaseline==0 ){
       if( !throwError ){
         db_multi_exec(
@@ -1214,9 +1455,7 @@ static int fetch_baseline(Manifest *p, int throwError){
 void manifest_file_rewind(Manifest *p){
   p->iFile = 0;
   fetch_baseline(p, 1);
-  if( p->pBaseline ){
-    p->pBaseline->iFile = 0;
-  }
+  p->iBaseFile = 0;
 }
 
 /*
@@ -1242,7 +1481,7 @@ ManifestFile *manifest_file_next(
     Manifest *pB = p->pBaseline;
     int cmp;
     while(1){
-      if( pB->iFile>=pB->nFile ){
+      if( p->iBaseFile>=pB->nFile ){
         /* We have used all entries out of the baseline.  Return the next
         ** entry from the delta. */
         if( p->iFile<p->nFile ) pOut = &p->aFile[p->iFile++];
@@ -1250,13 +1489,13 @@ ManifestFile *manifest_file_next(
       }else if( p->iFile>=p->nFile ){
         /* We have used all entries from the delta.  Return the next
         ** entry from the baseline. */
-        if( pB->iFile<pB->nFile ) pOut = &pB->aFile[pB->iFile++];
+        if( p->iBaseFile<pB->nFile ) pOut = &pB->aFile[p->iBaseFile++];
         break;
-      }else if( (cmp = fossil_strcmp(pB->aFile[pB->iFile].zName,
+      }else if( (cmp = fossil_strcmp(pB->aFile[p->iBaseFile].zName,
                               p->aFile[p->iFile].zName)) < 0 ){
         /* The next baseline entry comes before the next delta entry.
         ** So return the baseline entry. */
-        pOut = &pB->aFile[pB->iFile++];
+        pOut = &pB->aFile[p->iBaseFile++];
         break;
       }else if( cmp>0 ){
         /* The next delta entry comes before the next baseline
@@ -1266,14 +1505,14 @@ ManifestFile *manifest_file_next(
       }else if( p->aFile[p->iFile].zUuid ){
         /* The next delta entry is a replacement for the next baseline
         ** entry.  Skip the baseline entry and return the delta entry */
-        pB->iFile++;
+        p->iBaseFile++;
         pOut = &p->aFile[p->iFile++];
         break;
       }else{
         /* The next delta entry is a delete of the next baseline
         ** entry.  Skip them both.  Repeat the loop to find the next
         ** non-delete entry. */
-        pB->iFile++;
+        p->iBaseFile++;
         p->iFile++;
         continue;
       }
@@ -1321,6 +1560,165 @@ int manifest_file_mperm(ManifestFile *pFile){
   return mperm;
 }
 
+/*
+** Parameters of the per-check-in path bloom filters stored in the
+** PATHBLOOM table.  With 10 bits per name and 6 probes the false
+** positive rate is just under 1%.
+*/
+#define PATHBLOOM_BITS_PER_NAME  10
+#define PATHBLOOM_NPROBE         6
+
+/*
+** Check-ins whose PATHBLOOM entry needs to be recomputed.
+*/
+static Bag pathbloomPending;
+
+/*
+** Probe number i of the bloom filter for a name with hash h.  The
+** probes are derived from the two halves of a single 64-bit hash.
+*/
+static unsigned int pathbloom_probe(u64 h, int i, unsigned int nBit){
+  unsigned int h1 = (unsigned int)h;
+  unsigned int h2 = (unsigned int)(h>>32) | 1;
+  return (h1 + i*h2) % nBit;
+}
+
+/*
+** Add the next nByte characters of z to the FNV-1a hash h.
+*/
+static u64 pathbloom_hash(u64 h, const char *z, int nByte){
+  int i;
+  for(i=0; i<nByte; i++){
+    h ^= (unsigned char)z[i];
+    h *= 0x100000001b3LL;
+  }
+  return h;
+}
+#define PATHBLOOM_HASH_INIT  0xcbf29ce484222325LL
+
+/*
+** Recompute the PATHBLOOM entry for check-in mid from its MLINK rows.
+*/
+static void manifest_pathbloom_update(int mid){
+  static Stmt q;
+  static Stmt ins;
+  u64 *aHash = 0;
+  int nHash = 0;
+  int nAlloc = 0;
+  unsigned int nBit;
+  unsigned char *aBit;
+  Blob filter;
+  int i, j;
+
+  db_static_prepare(&q,
+    "SELECT filename.name FROM mlink, filename"
+    " WHERE mlink.mid=:mid AND filename.fnid=mlink.fnid"
+  );
+  db_bind_int(&q, ":mid", mid);
+  while( db_step(&q)==SQLITE_ROW ){
+    const char *zName = db_column_text(&q, 0);
+    u64 h = PATHBLOOM_HASH_INIT;
+    if( zName==0 ) continue;
+    for(i=j=0; zName[i]; i++){
+      if( zName[i]!='/' ) continue;
+      h = pathbloom_hash(h, &zName[j], i+1-j);
+      j = i+1;
+      if( nHash>=nAlloc ){
+        nAlloc = nAlloc*2 + 20;
+        aHash = fossil_realloc(aHash, sizeof(aHash[0])*nAlloc);
+      }
+      aHash[nHash++] = h;
+    }
+    h = pathbloom_hash(h, &zName[j], i-j);
+    if( nHash>=nAlloc ){
+      nAlloc = nAlloc*2 + 20;
+      aHash = fossil_realloc(aHash, sizeof(aHash[0])*nAlloc);
+    }
+    aHash[nHash++] = h;
+  }
+  db_reset(&q);
+  nBit = (nHash*PATHBLOOM_BITS_PER_NAME + 7) & ~7;
+  if( nBit<64 ) nBit = 64;
+  blob_zero(&filter);
+  blob_resize(&filter, nBit/8);
+  aBit = (unsigned char*)blob_buffer(&filter);
+  memset(aBit, 0, nBit/8);
+  for(i=0; i<nHash; i++){
+    for(j=0; j<PATHBLOOM_NPROBE; j++){
+      unsigned int k = pathbloom_probe(aHash[i], j, nBit);
+      aBit[k/8] |= 1<<(k%8);
+    }
+  }
+  db_static_prepare(&ins,
+    "REPLACE INTO pathbloom(rid,filter) VALUES(:rid,:filter)"
+  );
+  db_bind_int(&ins, ":rid", mid);
+  db_bind_blob(&ins, ":filter", &filter);
+  db_step(&ins);
+  db_reset(&ins);
+  blob_reset(&filter);
+  fossil_free(aHash);
+}
+
+/*
+** Recompute the PATHBLOOM entries of all check-ins whose MLINK rows
+** have changed since the last call.
+*/
+static void manifest_pathbloom_flush(void){
+  int rid;
+  if( bag_count(&pathbloomPending)>0
+   && db_table_exists("repository", "pathbloom")
+  ){
+    for(rid=bag_first(&pathbloomPending); rid;
+        rid=bag_next(&pathbloomPending, rid)){
+      manifest_pathbloom_update(rid);
+    }
+  }
+  bag_clear(&pathbloomPending);
+}
+
+/*
+** Implementation of the SQL function
+**
+**      pathbloom_test(FILTER, NAME)
+**
+** FILTER is a PATHBLOOM.FILTER value.  Return false if the check-in
+** certainly did not change the file NAME, or any file within NAME when
+** NAME ends with "/".  Return true otherwise, including when FILTER
+** is NULL.
+*/
+void manifest_pathbloom_test_func(
+  sqlite3_context *context,
+  int argc,
+  sqlite3_value **argv
+){
+  const unsigned char *aBit;
+  const char *zName;
+  unsigned int nBit;
+  u64 h;
+  int i;
+  if( sqlite3_value_type(argv[0])==SQLITE_NULL ){
+    sqlite3_result_int(context, 1);
+    return;
+  }
+  aBit = sqlite3_value_blob(argv[0]);
+  nBit = sqlite3_value_bytes(argv[0])*8;
+  zName = (const char*)sqlite3_value_text(argv[1]);
+  if( nBit==0 || zName==0 ){
+    sqlite3_result_int(context, nBit==0 ? 1 : 0);
+    return;
+  }
+  h = pathbloom_hash(PATHBLOOM_HASH_INIT, zName, (int)strlen(zName));
+  for(i=0; i<PATHBLOOM_NPROBE; i++){
+    unsigned int k = pathbloom_probe(h, i, nBit);
+    if( (aBit[k/8] & (1<<(k%8)))==0 ){
+      sqlite3_result_int(context, 0);
+      return;
+    }
+  }
+  sqlite3_result_int(context, 1);
+}
+
 /*
 ** Add a single entry to the mlink table.  Also add the filename to
 ** the filename table if it is not there already.
@@ -1387,6 +1785,7 @@ static void add_one_mlink(
     db_bind_int(&s1, ":mp", mperm);
     db_bind_int(&s1, ":isaux", isPrimary==0);
     db_exec(&s1);
+    bag_insert(&pathbloomPending, mid);
   }
   if( pid && fid ){
     content_deltify(pid, &fid, 1, 0);
@@ -1410,7 +1809,7 @@ static ManifestFile *manifest_file_seek_base(
   int lwr, upr;
   int c;
   int i;
-  if( p->aFile==0 ){
+  if( p->nFile==0 ){
     return 0;
   }
   lwr = 0;
@@ -1702,6 +2101,7 @@ static int manifest_add_checkin_linkages(
 ){
   int i;
   int parentid = 0;
+  int bHasChild = 0;   /* True if rid already has child check-ins */
   char zBaseId[30];    /* Baseline manifest RID for deltas.  "NULL" otherwise */
   Stmt q;
 
@@ -1719,6 +2119,12 @@ static int manifest_add_checkin_linkages(
        pid, rid, i==0, p->rDate, zBaseId/*safe-for-%s*/);
     if( i==0 ) parentid = pid;
   }
+  if( manifest_crosslink_busy ){
+    ancestry_eventually_update(rid);
+  }else{
+    ancestry_update(rid);
+  }
+  bag_insert(&pathbloomPending, rid);
   add_mlink(parentid, 0, rid, p, 1);
   if( nParent>1 ){
     /* Change MLINK.PID from 0 to -1 for files that are added by merge. */
@@ -1737,8 +2143,13 @@ static int manifest_add_checkin_linkages(
     int cid = db_column_int(&q, 0);
     int isprim = db_column_int(&q, 1);
     add_mlink(rid, p, cid, 0, isprim);
+    bHasChild = 1;
   }
   db_finalize(&q);
+  if( bHasChild ){
+    /* The ancestry of existing check-ins grew */
+    lastchange_invalidate();
+  }
   if( nParent==0 ){
     /* For root files (files without parents) add mlink entries
     ** showing all content as new. */
@@ -1748,6 +2159,7 @@ static int manifest_add_checkin_linkages(
                     isPublic, 1, manifest_file_mperm(&p->aFile[i]));
     }
   }
+  if( !manifest_crosslink_busy ) manifest_pathbloom_flush();
   return parentid;
 }
 
@@ -1789,6 +2201,7 @@ void manifest_reparent_checkin(int rid, const char *zValue){
        "DELETE FROM mlink WHERE mid=%d;",
        rid, rid
     );
+    lastchange_invalidate();
     manifest_add_checkin_linkages(rid,p,nParent,azParent);
   }
   manifest_destroy(p);
@@ -1861,6 +2274,8 @@ int manifest_crosslink_end(int flags){
     manifest_reparent_checkin(rid, zValue);
   }
   db_finalize(&q);
+  ancestry_do_pending_updates();
+  manifest_pathbloom_flush();
   db_prepare(&q, "SELECT uuid FROM pending_tkt");
   while( db_step(&q)==SQLITE_ROW ){
     const char *zUuid = db_column_text(&q, 0);
@@ -2078,7 +2493,7 @@ int manifest_crosslink(int rid, Blob *pContent, int flags){
   }
   if( (p = manifest_cache_find(rid))!=0 ){
     blob_reset(pContent);
-  }else if( (p = manifest_parse(pContent, rid, 0))==0 ){
+  }else if( (p = manifest_parse_ex(pContent, rid, flags, 0))==0 ){
     assert( blob_is_reset(pContent) || pContent==0 );
     if( (flags & MC_NO_ERRORS)==0 ){
       fossil_error(1, "syntax error in manifest [%S]",
@@ -220,6 +220,8 @@ static void vmerge_insert(int id, int rid){
 **
 **   -n|--dry-run            If given, display instead of run actions
 **
+**   --stats                 Show the CPU time spent on each 3-way merge
+**
 **   -v|--verbose            Show additional details of the merge
 */
 void merge_cmd(void){
@@ -237,6 +239,9 @@ void merge_cmd(void){
   const char *zBinGlob; /* The value of --binary */
   const char *zPivot;   /* The value of --baseline */
   int debugFlag;        /* True if --debug is present */
+  int statsFlag;        /* True if --stats is present */
+  int nStatsFile = 0;   /* Number of 3-way merges timed for --stats */
+  u64 nStatsTime = 0;   /* Total microseconds of 3-way merges for --stats */
   int nConflict = 0;    /* Number of conflicts seen */
   int nOverwrite = 0;   /* Number of unmanaged files overwritten */
   char vAncestor = 'p'; /* If P is an ancestor of V then 'p', else 'n' */
@@ -261,6 +266,7 @@ void merge_cmd(void){
   integrateFlag = find_option("integrate",0,0)!=0;
   backoutFlag = find_option("backout",0,0)!=0;
   debugFlag = find_option("debug",0,0)!=0;
+  statsFlag = find_option("stats",0,0)!=0;
   zBinGlob = find_option("binary",0,1);
   dryRunFlag = find_option("dry-run","n",0)!=0;
   if( !dryRunFlag ){
@@ -407,15 +413,17 @@ void merge_cmd(void){
     fossil_fatal("missing content, unable to merge");
   }
   if( zPivot ){
+    char *zPrune = ancestry_prune_sql("plink.pid", pid);
     vAncestor = db_exists(
       "WITH RECURSIVE ancestor(id) AS ("
       "  VALUES(%d)"
       "  UNION"
       "  SELECT pid FROM plink, ancestor"
-      "   WHERE cid=ancestor.id AND pid!=%d AND cid!=%d)"
+      "   WHERE cid=ancestor.id AND pid!=%d AND cid!=%d%s)"
       "SELECT 1 FROM ancestor WHERE id=%d LIMIT 1",
-      vid, nid, pid, pid
+      vid, nid, pid, zPrune/*safe-for-%s*/, pid
     ) ? 'p' : 'n';
+    fossil_free(zPrune);
   }
   if( debugFlag ){
     char *z;
@@ -636,9 +644,11 @@ void merge_cmd(void){
     int islinkv = db_column_int(&q, 7);
     int islinkm = db_column_int(&q, 8);
     int rc;
+    int iTimer = 0;
     char *zFullPath;
     Blob m, p, r;
     /* Do a 3-way merge of idp->idm into idp->idv.  The results go into idv. */
+    if( statsFlag ) iTimer = fossil_timer_start();
     if( verboseFlag ){
       fossil_print("MERGE %s  (pivot=%d v1=%d v2=%d)\n",
                    zName, ridp, ridm, ridv);
@@ -678,9 +688,19 @@ void merge_cmd(void){
       blob_reset(&m);
       blob_reset(&r);
     }
+    if( statsFlag ){
+      u64 nTime = fossil_timer_stop(iTimer);
+      fossil_print("  %.3f ms for %s\n", nTime/1000.0, zName);
+      nStatsTime += nTime;
+      nStatsFile++;
+    }
     vmerge_insert(idv, ridm);
   }
   db_finalize(&q);
+  if( statsFlag ){
+    fossil_print("%d 3-way merge%s in %.3f ms\n",
+                 nStatsFile, nStatsFile==1 ? "" : "s", nStatsTime/1000.0);
+  }
 
   /*
   ** Drop files that are in P and V but not in M
@@ -169,6 +169,23 @@ static int blob_merge(Blob *pPivot, Blob *pV1, Blob *pV2, Blob *pOut){
 
   blob_zero(pOut);         /* Merge results stored in pOut */
 
+  /* If one side is unchanged from the pivot, or if both sides made the
+  ** same change, then the result is already known and there is no need
+  ** to compute either diff.  Files that might be binary take the slow
+  ** path so that they are still reported as unmergeable.
+  */
+  if( !looks_like_binary(pPivot) && !looks_like_binary(pV1)
+   && !looks_like_binary(pV2) ){
+    if( blob_compare(pPivot, pV1)==0 || blob_compare(pV1, pV2)==0 ){
+      blob_append(pOut, blob_buffer(pV2), blob_size(pV2));
+      return 0;
+    }
+    if( blob_compare(pPivot, pV2)==0 ){
+      blob_append(pOut, blob_buffer(pV1), blob_size(pV1));
+      return 0;
+    }
+  }
+
   /* Compute the edits that occur from pPivot => pV1 (into aC1)
   ** and pPivot => pV2 (into aC2).  Each of the aC1 and aC2 arrays is
   ** an array of integer triples.  Within each triple, the first integer
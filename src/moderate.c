@@ -127,6 +127,7 @@ void moderation_disapprove(int objid){
       "DELETE FROM attachment WHERE attachid=%d;",
       rid, rid, rid, rid, rid, rid
     );
+    cache_content_removed();
     if( db_table_exists("repository","forumpost") ){
       db_multi_exec("DELETE FROM forumpost WHERE fpid=%d", rid);
     }
@@ -26,6 +26,7 @@
 */
 struct PathNode {
   int rid;                 /* ID for this node */
+  int gen;                 /* Generation number.  0x7fffffff if unknown */
   u8 fromIsParent;         /* True if pFrom is the parent of rid */
   u8 isPrim;               /* True if primary side of common ancestor */
   u8 isHidden;             /* Abbreviate output in "fossil bisect ls" */
@@ -135,14 +136,24 @@ PathNode *path_shortest(
     path.pEnd = path.pStart;
     return path.pStart;
   }
-  if( oneWayOnly && directOnly ){
-    db_prepare(&s,
-        "SELECT cid, 1 FROM plink WHERE pid=:pid AND isprim"
-    );
-  }else if( oneWayOnly ){
+  if( oneWayOnly ){
+    /* Every check-in on a parent-to-child path into iTo is an ancestor
+    ** of iTo and so has a smaller generation number.  Children with a
+    ** generation number above that of iTo cannot be on the path.  The
+    ** ceiling must still admit iTo itself, so it is inclusive. */
+    int toGen = ancestry_gen(iTo);
+    int fromGen = ancestry_gen(iFrom);
+    char *zCeil;
+    if( toGen>0 && fromGen>=toGen ){
+      path_reset();
+      return 0;
+    }
+    zCeil = ancestry_ceiling_sql("cid", iTo);
     db_prepare(&s,
-        "SELECT cid, 1 FROM plink WHERE pid=:pid "
+        "SELECT cid, 1 FROM plink WHERE pid=:pid%s%s",
+        directOnly ? " AND isprim" : "", zCeil/*safe-for-%s*/
     );
+    fossil_free(zCeil);
   }else if( directOnly ){
     db_prepare(&s,
         "SELECT cid, 1 FROM plink WHERE pid=:pid AND isprim "
@@ -284,20 +295,41 @@ void shortest_path_test_cmd(void){
 /*
 ** Find the closest common ancestor of two nodes.  "Closest" means the
 ** fewest number of arcs.
+**
+** When generation numbers are available, a node is not expanded while
+** the frontier on the other side still holds a node of a higher
+** generation.  This keeps one side from walking deep into history
+** while the other side catches up, and it means that when one of the
+** two nodes is an ancestor of the other, that node is the result.
 */
 int path_common_ancestor(int iMe, int iYou){
   Stmt s;
   PathNode *pPrev;
+  PathNode *pNextPeer;
   PathNode *p;
   Bag me, you;
+  int hasGen;                  /* True if generation numbers are available */
+  int mxGen[2];                /* Highest generation in each frontier */
 
   if( iMe==iYou ) return iMe;
   if( iMe==0 || iYou==0 ) return 0;
   path_reset();
+  hasGen = ancestry_available();
   path.pStart = path_new_node(iMe, 0, 0);
   path.pStart->isPrim = 1;
+  path.pStart->gen = ancestry_gen(iMe);
   path.pEnd = path_new_node(iYou, 0, 0);
-  db_prepare(&s, "SELECT pid FROM plink WHERE cid=:cid");
+  path.pEnd->gen = ancestry_gen(iYou);
+  if( path.pStart->gen==0 ) path.pStart->gen = 0x7fffffff;
+  if( path.pEnd->gen==0 ) path.pEnd->gen = 0x7fffffff;
+  if( hasGen ){
+    db_prepare(&s,
+      "SELECT pid, coalesce((SELECT gen FROM cgen WHERE rid=pid),%d)"
+      "  FROM plink WHERE cid=:cid", 0x7fffffff
+    );
+  }else{
+    db_prepare(&s, "SELECT pid, %d FROM plink WHERE cid=:cid", 0x7fffffff);
+  }
   bag_init(&me);
   bag_insert(&me, iMe);
   bag_init(&you);
@@ -305,7 +337,19 @@ int path_common_ancestor(int iMe, int iYou){
   while( path.pCurrent ){
     pPrev = path.pCurrent;
     path.pCurrent = 0;
+    mxGen[0] = mxGen[1] = 0;
+    for(p=pPrev; p; p=p->u.pPeer){
+      if( p->gen>mxGen[p->isPrim] ) mxGen[p->isPrim] = p->gen;
+    }
     while( pPrev ){
+      pNextPeer = pPrev->u.pPeer;
+      if( pPrev->gen<mxGen[!pPrev->isPrim] ){
+        /* Wait for the other side to come down to this generation */
+        pPrev->u.pPeer = path.pCurrent;
+        path.pCurrent = pPrev;
+        pPrev = pNextPeer;
+        continue;
+      }
       db_bind_int(&s, ":cid", pPrev->rid);
       while( db_step(&s)==SQLITE_ROW ){
         int pid = db_column_int(&s, 0);
@@ -332,10 +376,11 @@ int path_common_ancestor(int iMe, int iYou){
         }
         p = path_new_node(pid, pPrev, 0);
         p->isPrim = pPrev->isPrim;
+        p->gen = db_column_int(&s, 1);
         bag_insert(pPrev->isPrim ? &me : &you, pid);
       }
       db_reset(&s);
-      pPrev = pPrev->u.pPeer;
+      pPrev = pNextPeer;
     }
   }
   db_finalize(&s);
@@ -1071,7 +1071,9 @@ static int fossil_print_error(int rc, const char *z){
   }
   else
 #endif
-  if( g.cgiOutput==1 && g.db ){
+  if( g.cgiOutput==1 && g.db && cgi_stream_abort() ){
+    g.cgiOutput = 2;
+  }else if( g.cgiOutput==1 && g.db ){
     g.cgiOutput = 2;
     cgi_reset_content();
     cgi_set_content_type("text/html");
@@ -177,6 +177,13 @@ int purge_artifact_list(
 
   /* Remove the artifacts being purged.  Also remove all references to those
   ** artifacts from the secondary tables. */
+  if( codeidx_exists() ){
+    db_prepare(&q, "SELECT rid FROM \"%w\"", zTab);
+    while( db_step(&q)==SQLITE_ROW ){
+      codeidx_forget(db_column_int(&q, 0));
+    }
+    db_finalize(&q);
+  }
   db_multi_exec("DELETE FROM blob WHERE rid IN \"%w\"", zTab);
   db_multi_exec("DELETE FROM delta WHERE rid IN \"%w\"", zTab);
   db_multi_exec("DELETE FROM delta WHERE srcid IN \"%w\"", zTab);
@@ -185,6 +192,8 @@ int purge_artifact_list(
   db_multi_exec("DELETE FROM mlink WHERE mid IN \"%w\"", zTab);
   db_multi_exec("DELETE FROM plink WHERE pid IN \"%w\"", zTab);
   db_multi_exec("DELETE FROM plink WHERE cid IN \"%w\"", zTab);
+  lastchange_invalidate();
+  cache_content_removed();
   db_multi_exec("DELETE FROM leaf WHERE rid IN \"%w\"", zTab);
   db_multi_exec("DELETE FROM phantom WHERE rid IN \"%w\"", zTab);
   db_multi_exec("DELETE FROM unclustered WHERE rid IN \"%w\"", zTab);
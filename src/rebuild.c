@@ -382,9 +382,10 @@ int rebuild_db(int randomize, int doOut, int doClustering){
      " WHERE type='table'"
      " AND name NOT IN ('admin_log', 'blob','delta','rcvfrom','user','alias',"
                        "'config','shun','private','reportfmt',"
-                       "'concealed','accesslog','modreq',"
+                       "'concealed','accesslog','modreq','sqlprof',"
                        "'purgeevent','purgeitem','unversioned',"
-                       "'subscriber','pending_alert','alert_bounce')"
+                       "'subscriber','pending_alert','alert_bounce',"
+                       "'codeidx_doc','codeidx_tri')"
      " AND name NOT GLOB 'sqlite_*'"
      " AND name NOT GLOB 'fx_*'"
   );
@@ -397,6 +398,7 @@ int rebuild_db(int randomize, int doOut, int doClustering){
   db_multi_exec("%s", zRepositorySchema2/*safe-for-%s*/);
   ticket_create_table(0);
   shun_artifacts();
+  cache_content_removed();
 
   db_multi_exec(
      "INSERT INTO unclustered"
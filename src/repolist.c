@@ -141,6 +141,7 @@ int repo_list_page(void){
   }
   n = db_int(0, "SELECT count(*) FROM sfile");
   if( n==0 ){
+    db_stmt_cache_clear();
     sqlite3_close(g.db);
     return 0;
   }else{
@@ -470,6 +470,28 @@ const char zRepositorySchema2[] =
 @   PRIMARY KEY(parentid, childid)
 @ ) WITHOUT ROWID;
 @ CREATE INDEX cherrypick_cid ON cherrypick(childid);
+@
+@ -- The generation number of each check-in is larger than the generation
+@ -- number of every one of its parents.  A rebuild numbers root check-ins
+@ -- 1 and every other check-in one more than its highest-numbered parent.
+@ -- Ancestry walks use these numbers to stop early.  Repositories created
+@ -- before this table existed acquire it on the next rebuild.
+@ --
+@ CREATE TABLE cgen(
+@   rid INTEGER PRIMARY KEY,        -- The check-in
+@   gen INTEGER NOT NULL            -- Longest path from a root, plus 1
+@ );
+@
+@ -- A bloom filter over the names of the files changed by each check-in,
+@ -- together with every directory that holds one of those files.  The
+@ -- directory names end with "/", so "src/main.c" adds both "src/main.c"
+@ -- and "src/".  This lets path filters on the timeline skip check-ins
+@ -- without consulting MLINK.  Like CGEN, this table is created on rebuild.
+@ --
+@ CREATE TABLE pathbloom(
+@   rid INTEGER PRIMARY KEY,        -- The check-in
+@   filter BLOB                     -- Bloom filter bits
+@ );
 ;
 
 /*
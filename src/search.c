@@ -31,10 +31,17 @@
 **    (2) The indexed search engine
 **    (3) Higher level interfaces that use either (1) or (b2) according
 **        to the current search configuration settings
+**    (4) The trigram code index over file content, used by /codesearch
 */
 #include "config.h"
 #include "search.h"
 #include <assert.h>
+#if !defined(_WIN32)
+# include <unistd.h>
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <errno.h>
+#endif
 
 #if INTERFACE
 
@@ -526,13 +533,40 @@ static void search_urlencode_sqlfunc(
   sqlite3_result_text(context, z, -1, fossil_free);
 }
 
+/*
+** The share of the documents that this process looks at during a
+** full-scan search, when the scan is split among worker processes.
+** See search_fullscan_pool().
+*/
+static int iSearchPart = 0;     /* Share of this process */
+static int nSearchPart = 1;     /* Number of shares */
+
+/*
+**    search_part(ID)
+**
+** Return true if the document whose numeric id is ID is in the share of
+** this process.
+*/
+static void search_part_sqlfunc(
+  sqlite3_context *context,
+  int argc,
+  sqlite3_value **argv
+){
+  sqlite3_int64 id = sqlite3_value_int64(argv[0]);
+  sqlite3_result_int(context,
+                     nSearchPart<=1 || id%nSearchPart==iSearchPart);
+}
+
 /*
 ** Register the various SQL functions (defined above) needed to implement
 ** full-scan search.
 */
 void search_sql_setup(sqlite3 *db){
-  static int once = 0;
-  if( once++ ) return;
+  static sqlite3 *dbDone = 0;
+  if( db==dbDone ) return;
+  dbDone = db;
+  sqlite3_create_function(db, "search_part", 1, SQLITE_UTF8, 0,
+     search_part_sqlfunc, 0, 0);
   sqlite3_create_function(db, "search_match", -1, SQLITE_UTF8, 0,
      search_match_sqlfunc, 0, 0);
   sqlite3_create_function(db, "search_score", 0, SQLITE_UTF8, 0,
@@ -678,27 +712,11 @@ unsigned int search_restrict(unsigned int srchFlags){
 }
 
 /*
-** When this routine is called, there already exists a table
-**
-**       x(label,url,score,id,snip).
-**
-** label:  The "name" of the document containing the match
-** url:    A URL for the document
-** score:  How well the document matched
-** id:     The document id.  Format: xNNNNN, x: type, N: number
-** snip:   A snippet for the match
-**
-** And the srchFlags parameter has been validated.  This routine
-** fills the X table with search results using a full-scan search.
-**
-** The companion indexed search routine is search_indexed().
+** Add to the X table the documents of the share of this process that
+** match the pattern given to search_init().  All documents are looked
+** at unless the scan is split by search_fullscan_pool().
 */
-static void search_fullscan(
-  const char *zPattern,       /* The query pattern */
-  unsigned int srchFlags      /* What to search over */
-){
-  search_init(zPattern, "<mark>", "</mark>", " ... ",
-          SRCHFLG_STATIC|SRCHFLG_HTML);
+static void search_fullscan_part(unsigned int srchFlags){
   if( (srchFlags & SRCH_DOC)!=0 ){
     char *zDocGlob = db_get("doc-glob","");
     char *zDocBr = db_get("doc-branch","trunk");
@@ -718,6 +736,7 @@ static void search_fullscan(
         "    FROM foci CROSS JOIN blob"
         "   WHERE checkinID=symbolic_name_to_rid('trunk')"
         "     AND blob.uuid=foci.uuid"
+        "     AND search_part(blob.rid)"
         "     AND search_match(title('d',blob.rid,foci.filename),"
         "                      body('d',blob.rid,foci.filename))"
         "     AND %z",
@@ -742,7 +761,8 @@ static void search_fullscan(
       "         datetime(mtime),"
       "         search_snippet()"
       "    FROM wiki"
-      "   WHERE search_match(title('w',rid,name),body('w',rid,name));"
+      "   WHERE search_part(rid)"
+      "     AND search_match(title('w',rid,name),body('w',rid,name));"
     );
   }
   if( (srchFlags & SRCH_CKIN)!=0 ){
@@ -761,7 +781,8 @@ static void search_fullscan(
       "         datetime(mtime),"
       "         search_snippet()"
       "    FROM ckin"
-      "   WHERE search_match('',body('c',rid,NULL));"
+      "   WHERE search_part(rid)"
+      "     AND search_match('',body('c',rid,NULL));"
     );
   }
   if( (srchFlags & SRCH_TKT)!=0 ){
@@ -775,7 +796,8 @@ static void search_fullscan(
       "         datetime(tkt_mtime),"
       "         search_snippet()"
       "    FROM ticket"
-      "   WHERE search_match(title('t',tkt_id,NULL),body('t',tkt_id,NULL));"
+      "   WHERE search_part(tkt_id)"
+      "     AND search_match(title('t',tkt_id,NULL),body('t',tkt_id,NULL));"
     );
   }
   if( (srchFlags & SRCH_TECHNOTE)!=0 ){
@@ -795,7 +817,8 @@ static void search_fullscan(
       "         datetime(mtime),"
       "         search_snippet()"
       "    FROM technote"
-      "   WHERE search_match('',body('e',rid,NULL));"
+      "   WHERE search_part(rid)"
+      "     AND search_match('',body('e',rid,NULL));"
     );
   }
   if( (srchFlags & SRCH_FORUM)!=0 ){
@@ -808,11 +831,232 @@ static void search_fullscan(
       "         datetime(event.mtime),"
       "         search_snippet()"
       "    FROM event JOIN blob on event.objid=blob.rid"
-      "   WHERE search_match('',body('f',rid,NULL));"
+      "   WHERE search_part(rid)"
+      "     AND search_match('',body('f',rid,NULL));"
     );
   }
 }
 
+#if !defined(_WIN32)
+/*
+** The full-scan search can be split among worker processes, as set by
+** the "search-jobs" setting.  Fossil is single-threaded and an SQLite
+** connection cannot be shared across fork(), so each worker opens a
+** connection of its own with db_reopen_after_fork(), which it uses only
+** to read the repository and to fill an X table of its own in the TEMP
+** database with the matches of its share of the documents.  The worker
+** sends the rows of its X table back through a pipe.  A row is the
+** letter 'r' followed by its six columns.  Each column is a type letter,
+** 'n' for NULL or 't' for text, then the text and a zero byte.  The
+** letter 'e' ends the stream, so that the parent can tell a worker that
+** finished from one that failed.  The parent scans the share of a failed
+** worker itself.
+*/
+#define SEARCH_POOL_MAX 32
+
+/*
+** The body of a worker process, which looks at share iPart of nPart and
+** writes its results to fd.
+*/
+static void search_worker(
+  int iPart,                  /* Share of this worker */
+  int nPart,                  /* Number of shares */
+  int fd,                     /* Pipe to write the results to */
+  unsigned int srchFlags      /* What to search over */
+){
+  Stmt q;
+  Blob out;
+  int i;
+  g.cgiOutput = 0;
+  g.httpIn = 0;
+  g.httpOut = 0;
+  g.fQuiet = 1;
+#ifdef FOSSIL_ENABLE_JSON
+  g.json.isJsonMode = 0;
+#endif
+  backoffice_disable();
+  db_reopen_after_fork();
+  search_sql_setup(g.db);
+  add_content_sql_commands(g.db);
+  db_multi_exec("CREATE TEMP TABLE x(label,url,score,id,date,snip);");
+  iSearchPart = iPart;
+  nSearchPart = nPart;
+  search_fullscan_part(srchFlags);
+  blob_zero(&out);
+  db_prepare(&q, "SELECT label, url, score, id, date, snip FROM x");
+  while( db_step(&q)==SQLITE_ROW ){
+    blob_append_char(&out, 'r');
+    for(i=0; i<6; i++){
+      if( db_column_type(&q, i)==SQLITE_NULL ){
+        blob_append_char(&out, 'n');
+      }else{
+        blob_append_char(&out, 't');
+        blob_append(&out, db_column_text(&q, i), -1);
+      }
+      blob_append_char(&out, 0);
+    }
+  }
+  db_finalize(&q);
+  blob_append_char(&out, 'e');
+  i = 0;
+  while( i<blob_size(&out) ){
+    ssize_t got = write(fd, blob_buffer(&out)+i, blob_size(&out)-i);
+    if( got<=0 ){
+      if( got<0 && errno==EINTR ) continue;
+      break;
+    }
+    i += got;
+  }
+}
+
+/*
+** Walk the rows sent by a worker.  If pIns is not NULL, add each row to
+** the X table with it.  Return true if the stream is complete.
+*/
+static int search_pool_rows(Blob *pRows, Stmt *pIns){
+  static const char *azParam[] = {
+    ":label", ":url", ":score", ":id", ":date", ":snip"
+  };
+  const char *z = blob_buffer(pRows);
+  int n = blob_size(pRows);
+  int i = 0, k;
+  while( i<n && z[i]=='r' ){
+    i++;
+    for(k=0; k<6; k++){
+      const char *zEnd;
+      if( i>=n ) return 0;
+      zEnd = memchr(&z[i], 0, n-i);
+      if( zEnd==0 ) return 0;
+      if( pIns ){
+        if( z[i]=='n' ){
+          db_bind_null(pIns, azParam[k]);
+        }else{
+          db_bind_text(pIns, azParam[k], &z[i+1]);
+        }
+      }
+      i = (int)(zEnd - z) + 1;
+    }
+    if( pIns ){
+      db_step(pIns);
+      db_reset(pIns);
+    }
+  }
+  return i==n-1 && z[i]=='e';
+}
+#endif
+
+/*
+** Split the full-scan search among "search-jobs" worker processes and
+** add their results to the X table.  Return false, having done nothing,
+** if there is only one job or if no worker can be started.
+*/
+static int search_fullscan_pool(unsigned int srchFlags){
+#if defined(_WIN32)
+  return 0;
+#else
+  struct {
+    pid_t pid;                /* Process id of the worker */
+    int fd;                   /* Pipe to read its results from */
+  } a[SEARCH_POOL_MAX];
+  int nJob = db_get_int("search-jobs", 1);
+  int nWorker = 0;
+  int i;
+  Stmt ins;
+  if( nJob<=0 ) nJob = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if( nJob>SEARCH_POOL_MAX ) nJob = SEARCH_POOL_MAX;
+  if( nJob<=1 ) return 0;
+  for(i=0; i<nJob; i++){
+    int aFd[2];
+    pid_t pid;
+    if( pipe(aFd)<0 ) break;
+    pid = fork();
+    if( pid<0 ){
+      close(aFd[0]);
+      close(aFd[1]);
+      break;
+    }
+    if( pid==0 ){
+      /* This is the worker.  It must not flush stdio buffers inherited
+      ** from the parent or close its connections, so it leaves by
+      ** _exit() */
+      int j;
+      for(j=0; j<i; j++) close(a[j].fd);
+      close(aFd[0]);
+      search_worker(i, nJob, aFd[1], srchFlags);
+      _exit(0);
+    }
+    close(aFd[1]);
+    a[i].pid = pid;
+    a[i].fd = aFd[0];
+    nWorker = i+1;
+  }
+  if( nWorker==0 ) return 0;
+  db_prepare(&ins,
+    "INSERT INTO x(label,url,score,id,date,snip)"
+    " VALUES(:label,:url,CAST(:score AS INT),:id,:date,:snip)"
+  );
+  for(i=0; i<nJob; i++){
+    int bDone = 0;
+    if( i<nWorker ){
+      Blob rows;
+      char zBuf[8192];
+      blob_zero(&rows);
+      for(;;){
+        ssize_t got = read(a[i].fd, zBuf, sizeof(zBuf));
+        if( got<0 && errno==EINTR ) continue;
+        if( got<=0 ) break;
+        blob_append(&rows, zBuf, (int)got);
+      }
+      close(a[i].fd);
+      waitpid(a[i].pid, 0, 0);
+      if( search_pool_rows(&rows, 0) ){
+        search_pool_rows(&rows, &ins);
+        bDone = 1;
+      }
+      blob_reset(&rows);
+    }
+    if( !bDone ){
+      iSearchPart = i;
+      nSearchPart = nJob;
+      search_fullscan_part(srchFlags);
+    }
+  }
+  db_finalize(&ins);
+  iSearchPart = 0;
+  nSearchPart = 1;
+  return 1;
+#endif
+}
+
+/*
+** When this routine is called, there already exists a table
+**
+**       x(label,url,score,id,snip).
+**
+** label:  The "name" of the document containing the match
+** url:    A URL for the document
+** score:  How well the document matched
+** id:     The document id.  Format: xNNNNN, x: type, N: number
+** snip:   A snippet for the match
+**
+** And the srchFlags parameter has been validated.  This routine
+** fills the X table with search results using a full-scan search,
+** split among worker processes if the "search-jobs" setting asks for
+** more than one.
+**
+** The companion indexed search routine is search_indexed().
+*/
+static void search_fullscan(
+  const char *zPattern,       /* The query pattern */
+  unsigned int srchFlags      /* What to search over */
+){
+  search_init(zPattern, "<mark>", "</mark>", " ... ",
+          SRCHFLG_STATIC|SRCHFLG_HTML);
+  if( !search_fullscan_pool(srchFlags) ){
+    search_fullscan_part(srchFlags);
+  }
+}
+
 /*
 ** Number of significant bits in a u32
 */
@@ -885,6 +1129,53 @@ static void search_rank_sqlfunc(
 #endif
 }
 
+/*
+** Convert a search pattern into an FTS5 query.  FTS5 rejects barewords
+** that contain punctuation, such as "fts-config", where FTS4 would
+** split them into a phrase.  So every term becomes a quoted phrase.
+** A trailing "*" stays outside the quotes as a prefix query.  The AND,
+** OR and NOT operators are passed through when they stand between two
+** terms, and dropped elsewhere as FTS5 would reject the query.
+**
+** The returned string is obtained from fossil_malloc().
+*/
+static char *search_fts5_pattern(const char *zPattern){
+  Blob out;
+  int i, j, n;
+  const char *zOp = 0;      /* Operator waiting for the next term */
+  blob_init(&out, 0, 0);
+  for(i=0; zPattern[i]; i+=n){
+    int bPrefix;
+    if( fossil_isspace(zPattern[i]) ){
+      n = 1;
+      continue;
+    }
+    for(n=0; zPattern[i+n] && !fossil_isspace(zPattern[i+n]); n++){}
+    if( (n==2 && strncmp(&zPattern[i],"OR",2)==0)
+     || (n==3 && strncmp(&zPattern[i],"AND",3)==0)
+     || (n==3 && strncmp(&zPattern[i],"NOT",3)==0)
+    ){
+      if( blob_size(&out) ) zOp = &zPattern[i];
+      continue;
+    }
+    if( zOp ){
+      blob_append(&out, " ", 1);
+      blob_append(&out, zOp, zOp[0]=='O' ? 2 : 3);
+      zOp = 0;
+    }
+    if( blob_size(&out) ) blob_append(&out, " ", 1);
+    bPrefix = n>1 && zPattern[i+n-1]=='*';
+    blob_append(&out, "\"", 1);
+    for(j=0; j<n-bPrefix; j++){
+      if( zPattern[i+j]=='"' ) blob_append(&out, "\"", 1);
+      blob_append(&out, &zPattern[i+j], 1);
+    }
+    blob_append(&out, bPrefix ? "\"*" : "\"", -1);
+  }
+  if( blob_size(&out)==0 ) blob_append(&out, "\"\"", 2);
+  return blob_materialize(&out);
+}
+
 /*
 ** When this routine is called, there already exists a table
 **
@@ -898,6 +1189,7 @@ static void search_rank_sqlfunc(
 **
 ** And the srchFlags parameter has been validated.  This routine
 ** fills the X table with search results using FTS indexed search.
+** FTS5 indexes are ranked with bm25() and FTS4 indexes by rank().
 **
 ** The companion full-scan search routine is search_fullscan().
 */
@@ -907,22 +1199,41 @@ static void search_indexed(
 ){
   Blob sql;
   if( srchFlags==0 ) return;
-  sqlite3_create_function(g.db, "rank", 1, SQLITE_UTF8, 0,
-     search_rank_sqlfunc, 0, 0);
   blob_init(&sql, 0, 0);
-  blob_appendf(&sql,
-    "INSERT INTO x(label,url,score,id,date,snip) "
-    " SELECT ftsdocs.label,"
-    "        ftsdocs.url,"
-    "        rank(matchinfo(ftsidx,'pcsx')),"
-    "        ftsdocs.type || ftsdocs.rid,"
-    "        datetime(ftsdocs.mtime),"
-    "        snippet(ftsidx,'<mark>','</mark>',' ... ',-1,35)"
-    "   FROM ftsidx CROSS JOIN ftsdocs"
-    "  WHERE ftsidx MATCH %Q"
-    "    AND ftsdocs.rowid=ftsidx.docid",
-    zPattern
-  );
+  if( search_index_is_fts5() ){
+    /* The title column weighs ten times as much as the body */
+    char *zQuery = search_fts5_pattern(zPattern);
+    blob_appendf(&sql,
+      "INSERT INTO x(label,url,score,id,date,snip) "
+      " SELECT ftsdocs.label,"
+      "        ftsdocs.url,"
+      "        -bm25(ftsidx,10.0,1.0),"
+      "        ftsdocs.type || ftsdocs.rid,"
+      "        datetime(ftsdocs.mtime),"
+      "        snippet(ftsidx,-1,'<mark>','</mark>',' ... ',35)"
+      "   FROM ftsidx CROSS JOIN ftsdocs"
+      "  WHERE ftsidx MATCH %Q"
+      "    AND ftsdocs.rowid=ftsidx.rowid",
+      zQuery
+    );
+    fossil_free(zQuery);
+  }else{
+    sqlite3_create_function(g.db, "rank", 1, SQLITE_UTF8, 0,
+       search_rank_sqlfunc, 0, 0);
+    blob_appendf(&sql,
+      "INSERT INTO x(label,url,score,id,date,snip) "
+      " SELECT ftsdocs.label,"
+      "        ftsdocs.url,"
+      "        rank(matchinfo(ftsidx,'pcsx')),"
+      "        ftsdocs.type || ftsdocs.rid,"
+      "        datetime(ftsdocs.mtime),"
+      "        snippet(ftsidx,'<mark>','</mark>',' ... ',-1,35)"
+      "   FROM ftsidx CROSS JOIN ftsdocs"
+      "  WHERE ftsidx MATCH %Q"
+      "    AND ftsdocs.rowid=ftsidx.docid",
+      zPattern
+    );
+  }
   if( srchFlags!=SRCH_ALL ){
     const char *zSep = " AND (";
     static const struct { unsigned m; char c; } aMask[] = {
@@ -1027,7 +1338,9 @@ int search_run_and_output(
   if( !search_index_exists() ){
     search_fullscan(zPattern, srchFlags);  /* Full-scan search */
   }else{
-    search_update_index(srchFlags);        /* Update the index, if necessary */
+    if( db_get_boolean("backoffice-disable",0) ){
+      search_update_index(srchFlags);      /* Update the index, if necessary */
+    }
     search_indexed(zPattern, srchFlags);   /* Indexed search */
   }
   db_prepare(&q, "SELECT url, snip, label, score, id"
@@ -1393,6 +1706,43 @@ void search_stext(
   }
 }
 
+/*
+** Compute the search text for a document, the same as search_stext(),
+** but reuse text kept in the repository cache database when there is
+** one.  Only documents, wiki pages, tech notes and forum posts are kept,
+** as their text depends on nothing but the artifact and, for documents,
+** the mimetype implied by the name.  Check-in comments and tickets can
+** change without a new artifact and are always recomputed.
+*/
+static void search_stext_persistent(
+  char cType,            /* Type of document */
+  int rid,               /* BLOB.RID or TAG.TAGID value for document */
+  const char *zName,     /* Auxiliary information */
+  Blob *pOut             /* OUT: Initialize to the search text */
+){
+  char *zUuid;
+  char *zKey;
+  if( (cType!='d' && cType!='w' && cType!='e' && cType!='f')
+   || !cache_exists()
+   || (zUuid = rid_to_uuid(rid))==0
+  ){
+    search_stext(cType, rid, zName, pOut);
+    return;
+  }
+  if( cType=='d' ){
+    zKey = mprintf("stext-d-%s-%s", zUuid, mimetype_from_name(zName));
+  }else{
+    zKey = mprintf("stext-%c-%s", cType, zUuid);
+  }
+  blob_init(pOut, 0, 0);
+  if( !cache_fragment_read(zKey, pOut) ){
+    search_stext(cType, rid, zName, pOut);
+    cache_fragment_write(zKey, pOut);
+  }
+  fossil_free(zKey);
+  fossil_free(zUuid);
+}
+
 /*
 ** This routine is a wrapper around search_stext().
 **
@@ -1412,20 +1762,26 @@ char *search_stext_cached(
     Blob stext;          /* Cached search text */
     char cType;          /* The type */
     int rid;             /* The RID */
+    char *zName;         /* The auxiliary name */
     int nTitle;          /* Number of bytes in title */
   } cache;
   int i;
   char *z;
-  if( cType!=cache.cType || rid!=cache.rid ){
-    if( cache.rid>0 ){
+  if( cType==0 || cType!=cache.cType || rid!=cache.rid
+   || fossil_strcmp(zName, cache.zName)!=0
+  ){
+    if( cache.cType ){
       blob_reset(&cache.stext);
+      fossil_free(cache.zName);
+      cache.zName = 0;
     }else{
       blob_init(&cache.stext,0,0);
     }
     cache.cType = cType;
     cache.rid = rid;
     if( cType==0 ) return 0;
-    search_stext(cType, rid, zName, &cache.stext);
+    cache.zName = zName ? fossil_strdup(zName) : 0;
+    search_stext_persistent(cType, rid, zName, &cache.stext);
     z  = blob_str(&cache.stext);
     for(i=0; z[i] && z[i]!='\n'; i++){}
     cache.nTitle = i;
@@ -1473,12 +1829,15 @@ void test_convert_stext(void){
   blob_reset(&out);
 }
 
+/* The automerge level for FTS5 indexes */
+#define SEARCH_FTS5_AUTOMERGE  8
+
 /* The schema for the full-text index
 */
 static const char zFtsSchema[] =
 @ -- One entry for each possible search result
 @ CREATE TABLE IF NOT EXISTS repository.ftsdocs(
-@   rowid INTEGER PRIMARY KEY, -- Maps to the ftsidx.docid
+@   rowid INTEGER PRIMARY KEY, -- Maps to the ftsidx.rowid
 @   type CHAR(1),              -- Type of document
 @   rid INTEGER,               -- BLOB.RID or TAG.TAGID for the document
 @   name TEXT,                 -- Additional document description
@@ -1496,7 +1855,7 @@ static const char zFtsSchema[] =
 @          title(type,rid,name) AS 'title', body(type,rid,name) AS 'body'
 @     FROM ftsdocs;
 @ CREATE VIRTUAL TABLE IF NOT EXISTS repository.ftsidx
-@   USING fts4(content="ftscontent", title, body%s);
+@   USING %s;
 ;
 static const char zFtsDrop[] =
 @ DROP TABLE IF EXISTS repository.ftsidx;
@@ -1506,18 +1865,56 @@ static const char zFtsDrop[] =
 
 /*
 ** Create or drop the tables associated with a full-text index.
+**
+** New indexes use FTS5 when SQLite has it, with prefix indexes for
+** two- and three-character prefixes.  An automerge level above the
+** default of 4 keeps the many small incremental updates from merging
+** b-tree segments too eagerly.  FTS4 is the fallback.
 */
 static int searchIdxExists = -1;
+static int searchIdxFts5 = -1;
 void search_create_index(void){
   int useStemmer = db_get_boolean("search-stemmer",0);
-  const char *zExtra = useStemmer ? ",tokenize=porter" : "";
+  char *zArgs;
   search_sql_setup(g.db);
-  db_multi_exec(zFtsSchema/*works-like:"%s"*/, zExtra/*safe-for-%s*/);
+  if( sqlite3_compileoption_used("ENABLE_FTS5") ){
+    zArgs = mprintf("fts5(title, body, content=\"ftscontent\","
+                    " content_rowid=\"rowid\", prefix='2 3'%s)",
+                    useStemmer ? ", tokenize='porter unicode61'" : "");
+    searchIdxFts5 = 1;
+  }else{
+    zArgs = mprintf("fts4(content=\"ftscontent\", title, body%s)",
+                    useStemmer ? ",tokenize=porter" : "");
+    searchIdxFts5 = 0;
+  }
+  db_multi_exec(zFtsSchema/*works-like:"%s"*/, zArgs/*safe-for-%s*/);
+  if( searchIdxFts5 ){
+    db_multi_exec(
+      "INSERT INTO ftsidx(ftsidx, rank) VALUES('automerge', %d)",
+      SEARCH_FTS5_AUTOMERGE
+    );
+  }
+  fossil_free(zArgs);
   searchIdxExists = 1;
 }
 void search_drop_index(void){
   db_multi_exec(zFtsDrop/*works-like:""*/);
   searchIdxExists = 0;
+  searchIdxFts5 = -1;
+}
+
+/*
+** Return true if the full-text index is an FTS5 table.  Indexes made
+** before FTS5 support was added remain FTS4 until they are rebuilt.
+*/
+int search_index_is_fts5(void){
+  if( searchIdxFts5<0 ){
+    searchIdxFts5 = db_exists(
+      "SELECT 1 FROM repository.sqlite_master"
+      " WHERE name='ftsidx' AND sql LIKE '%%USING fts5%%'"
+    );
+  }
+  return searchIdxFts5;
 }
 
 /*
@@ -1576,7 +1973,7 @@ void search_doc_touch(char cType, int rid, const char *zName){
     zType[1] = 0;
     search_sql_setup(g.db);
     db_multi_exec(
-       "DELETE FROM ftsidx WHERE docid IN"
+       "DELETE FROM ftsidx WHERE rowid IN"
        "    (SELECT rowid FROM ftsdocs WHERE type=%Q AND rid=%d AND idxed)",
        zType, rid
     );
@@ -1587,7 +1984,7 @@ void search_doc_touch(char cType, int rid, const char *zName){
     );
     if( cType=='w' || cType=='e' ){
       db_multi_exec(
-        "DELETE FROM ftsidx WHERE docid IN"
+        "DELETE FROM ftsidx WHERE rowid IN"
         "    (SELECT rowid FROM ftsdocs WHERE type='%c' AND name=%Q AND idxed)",
         cType, zName
       );
@@ -1627,7 +2024,7 @@ static void search_update_doc_index(void){
     ckid, glob_expr("foci.filename", db_get("doc-glob",""))
   );
   db_multi_exec(
-    "DELETE FROM ftsidx WHERE docid IN"
+    "DELETE FROM ftsidx WHERE rowid IN"
     "  (SELECT rowid FROM ftsdocs WHERE type='d'"
     "      AND rid NOT IN (SELECT rid FROM current_docs))"
   );
@@ -1646,7 +2043,7 @@ static void search_update_doc_index(void){
     zDocBr, rTime
   );
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     "  SELECT rowid, label, bx FROM ftsdocs WHERE type='d' AND NOT idxed"
   );
   db_multi_exec(
@@ -1661,11 +2058,12 @@ static void search_update_doc_index(void){
 /*
 ** Deal with all of the unindexed 'c' terms in FTSDOCS
 */
-static void search_update_checkin_index(void){
+static void search_update_checkin_index(int mxRowid){
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     " SELECT rowid, '', body('c',rid,NULL) FROM ftsdocs"
-    "  WHERE type='c' AND NOT idxed;"
+    "  WHERE type='c' AND NOT idxed AND rowid<=%d;",
+    mxRowid
   );
   db_multi_exec(
     "UPDATE ftsdocs SET idxed=1, name=NULL,"
@@ -1678,17 +2076,20 @@ static void search_update_checkin_index(void){
     "    WHERE event.objid=ftsdocs.rid"
     "      AND blob.rid=ftsdocs.rid)"
     "WHERE ftsdocs.type='c' AND NOT ftsdocs.idxed"
+    "   AND ftsdocs.rowid<=%d",
+    mxRowid
   );
 }
 
 /*
 ** Deal with all of the unindexed 't' terms in FTSDOCS
 */
-static void search_update_ticket_index(void){
+static void search_update_ticket_index(int mxRowid){
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     " SELECT rowid, title('t',rid,NULL), body('t',rid,NULL) FROM ftsdocs"
-    "  WHERE type='t' AND NOT idxed;"
+    "  WHERE type='t' AND NOT idxed AND rowid<=%d;",
+    mxRowid
   );
   if( db_changes()==0 ) return;
   db_multi_exec(
@@ -1701,17 +2102,20 @@ static void search_update_ticket_index(void){
     "     FROM ticket"
     "    WHERE tkt_id=ftsdocs.rid)"
     "WHERE ftsdocs.type='t' AND NOT ftsdocs.idxed"
+    "   AND ftsdocs.rowid<=%d",
+    mxRowid
   );
 }
 
 /*
 ** Deal with all of the unindexed 'w' terms in FTSDOCS
 */
-static void search_update_wiki_index(void){
+static void search_update_wiki_index(int mxRowid){
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     " SELECT rowid, title('w',rid,NULL),body('w',rid,NULL) FROM ftsdocs"
-    "  WHERE type='w' AND NOT idxed;"
+    "  WHERE type='w' AND NOT idxed AND rowid<=%d;",
+    mxRowid
   );
   if( db_changes()==0 ) return;
   db_multi_exec(
@@ -1723,17 +2127,20 @@ static void search_update_wiki_index(void){
     "            tagxref.mtime"
     "       FROM tagxref WHERE tagxref.rid=ftsdocs.rid)"
     " WHERE ftsdocs.type='w' AND NOT ftsdocs.idxed"
+    "   AND ftsdocs.rowid<=%d",
+    mxRowid
   );
 }
 
 /*
 ** Deal with all of the unindexed 'f' terms in FTSDOCS
 */
-static void search_update_forum_index(void){
+static void search_update_forum_index(int mxRowid){
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     " SELECT rowid, title('f',rid,NULL),body('f',rid,NULL) FROM ftsdocs"
-    "  WHERE type='f' AND NOT idxed;"
+    "  WHERE type='f' AND NOT idxed AND rowid<=%d;",
+    mxRowid
   );
   if( db_changes()==0 ) return;
   db_multi_exec(
@@ -1746,17 +2153,20 @@ static void search_update_forum_index(void){
     "    WHERE event.objid=ftsdocs.rid"
     "      AND blob.rid=ftsdocs.rid)"
     "WHERE ftsdocs.type='f' AND NOT ftsdocs.idxed"
+    "   AND ftsdocs.rowid<=%d",
+    mxRowid
   );
 }
 
 /*
 ** Deal with all of the unindexed 'e' terms in FTSDOCS
 */
-static void search_update_technote_index(void){
+static void search_update_technote_index(int mxRowid){
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     " SELECT rowid, title('e',rid,NULL),body('e',rid,NULL) FROM ftsdocs"
-    "  WHERE type='e' AND NOT idxed;"
+    "  WHERE type='e' AND NOT idxed AND rowid<=%d;",
+    mxRowid
   );
   if( db_changes()==0 ) return;
   db_multi_exec(
@@ -1770,36 +2180,110 @@ static void search_update_technote_index(void){
     "      WHERE tagxref.rid=ftsdocs.rid"
     "        AND tagname GLOB 'event-*')"
     " WHERE ftsdocs.type='e' AND NOT ftsdocs.idxed"
+    "   AND ftsdocs.rowid<=%d",
+    mxRowid
   );
 }
 
 /*
-** Deal with all of the unindexed entries in the FTSDOCS table - that
-** is to say, all the entries with FTSDOCS.IDXED=0.  Add them to the
-** index.
+** Add unindexed entries of the FTSDOCS table with a rowid no greater
+** than mxRowid to the index.  The 'd' entries are not handled here, as
+** they do not depend on mxRowid.  The caller runs search_update_doc_index()
+** once, first.
 */
-void search_update_index(unsigned int srchFlags){
-  if( !search_index_exists() ) return;
-  if( !db_exists("SELECT 1 FROM ftsdocs WHERE NOT idxed") ) return;
+static void search_update_index_upto(unsigned int srchFlags, int mxRowid){
   search_sql_setup(g.db);
+  search_stext_cached(0, 0, 0, 0);  /* Documents may have changed */
   if( srchFlags & (SRCH_CKIN|SRCH_DOC) ){
-    search_update_doc_index();
-    search_update_checkin_index();
+    search_update_checkin_index(mxRowid);
   }
   if( srchFlags & SRCH_TKT ){
-    search_update_ticket_index();
+    search_update_ticket_index(mxRowid);
   }
   if( srchFlags & SRCH_WIKI ){
-    search_update_wiki_index();
+    search_update_wiki_index(mxRowid);
   }
   if( srchFlags & SRCH_TECHNOTE ){
-    search_update_technote_index();
+    search_update_technote_index(mxRowid);
   }
   if( srchFlags & SRCH_FORUM ){
-    search_update_forum_index();
+    search_update_forum_index(mxRowid);
   }
 }
 
+/*
+** Deal with all of the unindexed entries in the FTSDOCS table - that
+** is to say, all the entries with FTSDOCS.IDXED=0.  Add them to the
+** index.
+*/
+void search_update_index(unsigned int srchFlags){
+  if( !search_index_exists() ) return;
+  if( !db_exists("SELECT 1 FROM ftsdocs WHERE NOT idxed") ) return;
+  if( srchFlags & (SRCH_CKIN|SRCH_DOC) ){
+    search_sql_setup(g.db);
+    search_update_doc_index();
+  }
+  search_update_index_upto(srchFlags, 0x7fffffff);
+}
+
+/*
+** Number of FTSDOCS entries indexed by each transaction of
+** search_backoffice(), and the CPU time in microseconds after which
+** search_backoffice() stops starting new slices.
+*/
+#define SEARCH_BACKOFFICE_SLICE   100
+#define SEARCH_BACKOFFICE_BUDGET  2000000
+
+/*
+** Drain the queue of unindexed FTSDOCS entries in slices of
+** SEARCH_BACKOFFICE_SLICE documents, each in its own transaction, so
+** that web searches do not have to update the index themselves.  The
+** embedded documents are brought up to date once, before the first slice.
+**
+** This routine is called by the backoffice.  Any entries that remain
+** once the time budget is spent are picked up by a later run.
+*/
+void search_backoffice(void){
+  unsigned int srchFlags;
+  int iTimer;
+  char zTypes[8];
+  int n = 0;
+  struct FossilUserPerms savedPerm;
+  if( !search_index_exists() ) return;
+  savedPerm = g.perm;
+  g.perm.Read = g.perm.RdTkt = g.perm.RdWiki = g.perm.RdForum = 1;
+  srchFlags = search_restrict(SRCH_ALL);
+  g.perm = savedPerm;
+  if( srchFlags & (SRCH_CKIN|SRCH_DOC) ) zTypes[n++] = 'c';
+  if( srchFlags & SRCH_TKT )      zTypes[n++] = 't';
+  if( srchFlags & SRCH_WIKI )     zTypes[n++] = 'w';
+  if( srchFlags & SRCH_TECHNOTE ) zTypes[n++] = 'e';
+  if( srchFlags & SRCH_FORUM )    zTypes[n++] = 'f';
+  zTypes[n] = 0;
+  if( n==0 ) return;
+  iTimer = fossil_timer_start();
+  if( srchFlags & (SRCH_CKIN|SRCH_DOC) ){
+    db_begin_transaction();
+    search_sql_setup(g.db);
+    search_update_doc_index();
+    db_end_transaction(0);
+  }
+  while( fossil_timer_fetch(iTimer)<SEARCH_BACKOFFICE_BUDGET ){
+    int mxRowid = db_int(0,
+       "SELECT max(rowid) FROM"
+       " (SELECT rowid FROM ftsdocs"
+       "   WHERE NOT idxed AND instr(%Q,type)>0"
+       "   ORDER BY rowid LIMIT %d)",
+       zTypes, SEARCH_BACKOFFICE_SLICE
+    );
+    if( mxRowid==0 ) break;
+    db_begin_transaction();
+    search_update_index_upto(srchFlags, mxRowid);
+    db_end_transaction(0);
+  }
+  fossil_timer_stop(iTimer);
+}
+
 /*
 ** Construct, prepopulate, and then update the full-text index.
 */
@@ -1833,6 +2317,9 @@ void search_rebuild_index(void){
 **     stemmer (on|off)   Turn the Porter stemmer on or off for indexed
 **                        search.  (Unindexed search is never stemmed.)
 **
+**     codeindex (on|off) Turn the trigram index of file content used by
+**                        "fossil codesearch" and /codesearch on or off
+**
 ** The current search settings are displayed after any changes are applied.
 ** Run this command with no arguments to simply see the settings.
 */
@@ -1843,6 +2330,7 @@ void fts_config_cmd(void){
      { 3,  "disable"  },
      { 4,  "enable"   },
      { 5,  "stemmer"  },
+     { 6,  "codeindex" },
   };
   static const struct { const char *zSetting; const char *zName; const char *zSw; } aSetng[] = {
      { "search-ci",       "check-in search:",  "c" },
@@ -1900,6 +2388,15 @@ void fts_config_cmd(void){
     if( g.argc<4 ) usage("porter ON/OFF");
     db_set_int("search-stemmer", is_truth(g.argv[3]), 0);
   }
+  if( iCmd==6 ){
+    if( g.argc<4 ) usage("codeindex (on|off)");
+    if( is_truth(g.argv[3]) ){
+      codeidx_create();
+      codeidx_update(1, 0);
+    }else{
+      codeidx_drop();
+    }
+  }
 
 
   /* destroy or rebuild the index, if requested */
@@ -1924,6 +2421,13 @@ void fts_config_cmd(void){
   }else{
     fossil_print("%-17s disabled\n", "full-text index:");
   }
+  if( codeidx_exists() ){
+    fossil_print("%-17s %d files, %d indexed\n", "code index:",
+       db_int(0, "SELECT count(*) FROM codeidx_doc"),
+       db_int(0, "SELECT count(*) FROM codeidx_doc WHERE ntri>=0"));
+  }else{
+    fossil_print("%-17s disabled\n", "code index:");
+  }
   db_end_transaction(0);
 }
 
@@ -2017,3 +2521,480 @@ void search_data_page(void){
   @ </table>
   style_footer();
 }
+
+/****************************************************************************
+** The code index.
+**
+** The code index maps every trigram (three consecutive bytes, with ASCII
+** letters folded to lower case) to the file artifacts that contain it.
+** Each distinct file artifact is indexed once, however many check-ins
+** and filenames share it.  The MLINK table then maps a matching artifact
+** to the check-ins and filenames where it appears.
+**
+** A search looks up the trigrams of the pattern, intersects the lists
+** of artifacts, and scans only the surviving artifacts for the pattern.
+** Without the index, every file artifact is scanned.
+*/
+
+/* Largest file artifact that is added to the code index */
+#define CODEIDX_MAX_SIZE  5000000
+
+/* Maximum number of matching lines shown for each file */
+#define CODEIDX_MAX_LINE  5
+
+/* Maximum number of distinct trigrams of a pattern looked up in the
+** code index.  The scan of the surviving artifacts checks the rest. */
+#define CODEIDX_MAX_TRI   32
+
+static const char zCodeIdxSchema[] =
+@ CREATE TABLE IF NOT EXISTS repository.codeidx_doc(
+@   rid INTEGER PRIMARY KEY,   -- BLOB.RID of a file artifact
+@   ntri INTEGER               -- Distinct trigrams, or -1 if not indexed
+@ );
+@ CREATE TABLE IF NOT EXISTS repository.codeidx_tri(
+@   tri INTEGER,               -- Three bytes of content, ASCII case folded
+@   rid INTEGER,               -- File artifact that contains the trigram
+@   PRIMARY KEY(tri,rid)
+@ ) WITHOUT ROWID;
+;
+static const char zCodeIdxDrop[] =
+@ DROP TABLE IF EXISTS repository.codeidx_tri;
+@ DROP TABLE IF EXISTS repository.codeidx_doc;
+;
+
+/*
+** Create or drop the tables of the code index.
+*/
+static int codeIdxExists = -1;
+void codeidx_create(void){
+  db_multi_exec(zCodeIdxSchema/*works-like:""*/);
+  codeIdxExists = 1;
+}
+void codeidx_drop(void){
+  db_multi_exec(zCodeIdxDrop/*works-like:""*/);
+  codeIdxExists = 0;
+}
+
+/*
+** Return true if the code index exists
+*/
+int codeidx_exists(void){
+  if( codeIdxExists<0 ){
+    codeIdxExists = db_table_exists("repository","codeidx_doc");
+  }
+  return codeIdxExists;
+}
+
+/*
+** Return the trigram that starts at z[0], with ASCII letters folded
+** to lower case.
+*/
+#define CODEIDX_FOLD(c)  ((c)>='A' && (c)<='Z' ? (c)+'a'-'A' : (c))
+static unsigned int codeidx_trigram(const unsigned char *z){
+  return (CODEIDX_FOLD(z[0])<<16) | (CODEIDX_FOLD(z[1])<<8)
+          | CODEIDX_FOLD(z[2]);
+}
+
+/*
+** Add file artifacts that are not yet in the code index, other than
+** shunned artifacts.  Stop after mxTime microseconds, if mxTime is
+** positive.  Otherwise add them all.
+** Show progress on the console if bVerbose is true.
+**
+** The code index is only updated from the command-line and from the
+** backoffice, never by a web page.
+*/
+void codeidx_update(int bVerbose, int mxTime){
+  Stmt q, ins, doc;
+  unsigned char *aSeen;         /* One bit for each possible trigram */
+  unsigned int *aTri = 0;       /* Distinct trigrams of one artifact */
+  int nAlloc = 0;
+  int nDone = 0, nTotal;
+  int iTimer;
+
+  if( !codeidx_exists() ) return;
+  db_multi_exec(
+    "CREATE TEMP TABLE IF NOT EXISTS codeidx_todo(rid INTEGER PRIMARY KEY);"
+    "DELETE FROM codeidx_todo;"
+    "INSERT INTO codeidx_todo SELECT DISTINCT fid FROM mlink"
+    " WHERE fid>0 AND fid NOT IN (SELECT rid FROM codeidx_doc)"
+    "   AND fid NOT IN (SELECT rid FROM blob, shun WHERE blob.uuid=shun.uuid)"
+  );
+  nTotal = db_int(0, "SELECT count(*) FROM codeidx_todo");
+  if( nTotal==0 ) return;
+  aSeen = fossil_malloc( (1<<24)/8 );
+  memset(aSeen, 0, (1<<24)/8);
+  db_begin_transaction();
+  db_prepare(&ins, "INSERT OR IGNORE INTO codeidx_tri(tri,rid)"
+                   " VALUES(:tri,:rid)");
+  db_prepare(&doc, "REPLACE INTO codeidx_doc(rid,ntri) VALUES(:rid,:n)");
+  db_prepare(&q, "SELECT rid FROM codeidx_todo");
+  iTimer = fossil_timer_start();
+  while( db_step(&q)==SQLITE_ROW ){
+    int rid = db_column_int(&q, 0);
+    Blob content;
+    int nTri = -1;
+    if( mxTime>0 && fossil_timer_fetch(iTimer)>=(sqlite3_uint64)mxTime ){
+      break;
+    }
+    if( content_get(rid, &content)
+     && blob_size(&content)<=CODEIDX_MAX_SIZE
+     && !looks_like_binary(&content)
+    ){
+      const unsigned char *z = (const unsigned char*)blob_buffer(&content);
+      int n = blob_size(&content);
+      int i;
+      nTri = 0;
+      for(i=0; i+2<n; i++){
+        unsigned int t = codeidx_trigram(&z[i]);
+        if( aSeen[t>>3] & (1<<(t&7)) ) continue;
+        aSeen[t>>3] |= 1<<(t&7);
+        if( nTri>=nAlloc ){
+          nAlloc = nAlloc*2 + 1000;
+          aTri = fossil_realloc(aTri, sizeof(aTri[0])*nAlloc);
+        }
+        aTri[nTri++] = t;
+      }
+      for(i=0; i<nTri; i++){
+        aSeen[aTri[i]>>3] = 0;
+        db_bind_int(&ins, ":tri", aTri[i]);
+        db_bind_int(&ins, ":rid", rid);
+        db_step(&ins);
+        db_reset(&ins);
+      }
+    }
+    blob_reset(&content);
+    db_bind_int(&doc, ":rid", rid);
+    db_bind_int(&doc, ":n", nTri);
+    db_step(&doc);
+    db_reset(&doc);
+    nDone++;
+    if( bVerbose && (nDone%100==0 || nDone==nTotal) ){
+      fossil_print("\rcode index: %d of %d files", nDone, nTotal);
+      fflush(stdout);
+    }
+  }
+  if( bVerbose ) fossil_print("\n");
+  fossil_timer_stop(iTimer);
+  db_finalize(&q);
+  db_finalize(&ins);
+  db_finalize(&doc);
+  db_end_transaction(0);
+  fossil_free(aTri);
+  fossil_free(aSeen);
+}
+
+/*
+** Index file artifacts added since the last run, for at most
+** SEARCH_BACKOFFICE_BUDGET microseconds.  Called by the backoffice.
+*/
+void codeidx_backoffice(void){
+  if( !codeidx_exists() ) return;
+  codeidx_update(0, SEARCH_BACKOFFICE_BUDGET);
+}
+
+/*
+** Remove artifact rid from the code index.  This is called before the
+** artifact is purged or shunned.  The rows of CODEIDX_TRI are found from
+** the trigrams of the content, as that table is keyed by trigram first.
+** If the content is not available, the whole table is searched.
+*/
+void codeidx_forget(int rid){
+  Blob content;
+  if( !codeidx_exists() ) return;
+  if( db_int(-1, "SELECT ntri FROM codeidx_doc WHERE rid=%d", rid)<0 ){
+    db_multi_exec("DELETE FROM codeidx_doc WHERE rid=%d", rid);
+    return;
+  }
+  if( content_get(rid, &content) ){
+    const unsigned char *z = (const unsigned char*)blob_buffer(&content);
+    int n = blob_size(&content);
+    int i;
+    Stmt del;
+    db_prepare(&del, "DELETE FROM codeidx_tri WHERE tri=:tri AND rid=%d",
+               rid);
+    for(i=0; i+2<n; i++){
+      db_bind_int(&del, ":tri", codeidx_trigram(&z[i]));
+      db_step(&del);
+      db_reset(&del);
+    }
+    db_finalize(&del);
+  }else{
+    db_multi_exec("DELETE FROM codeidx_tri WHERE rid=%d", rid);
+  }
+  blob_reset(&content);
+  db_multi_exec("DELETE FROM codeidx_doc WHERE rid=%d", rid);
+}
+
+/*
+** Return a pointer to the first occurrence of zPat[0..nPat-1] within
+** z[0..n-1], or NULL if there is none.  Ignore ASCII case differences
+** if bNoCase is true.
+*/
+static const char *codeidx_find(
+  const char *z, int n,
+  const char *zPat, int nPat,
+  int bNoCase
+){
+  int i;
+  for(i=0; i+nPat<=n; i++){
+    if( bNoCase ){
+      if( fossil_strnicmp(&z[i], zPat, nPat)==0 ) return &z[i];
+    }else{
+      if( z[i]==zPat[0] && memcmp(&z[i], zPat, nPat)==0 ) return &z[i];
+    }
+  }
+  return 0;
+}
+
+/*
+** Fill the temporary table CODEHIT with the file artifacts that contain
+** the literal text zPat.  The LINES column of each row holds up to
+** CODEIDX_MAX_LINE of the matching lines, each one as the line number,
+** a ":", the text of the line, and a newline.
+**
+** The trigrams of zPat narrow down the artifacts to scan when the code
+** index exists.  Only the first CODEIDX_MAX_TRI distinct trigrams are
+** looked up.  File artifacts added since the code index was last updated
+** are missed.  Return the number of artifacts that match.
+*/
+static int codeidx_search(const char *zPat, int bNoCase){
+  int nPat = (int)strlen(zPat);
+  Blob sql;
+  Stmt q, ins;
+  int nHit = 0;
+  unsigned int aTri[CODEIDX_MAX_TRI];
+  int nTri = 0;
+  int i, j;
+
+  db_multi_exec(
+    "CREATE TEMP TABLE IF NOT EXISTS codehit(rid INTEGER PRIMARY KEY, lines);"
+    "DELETE FROM codehit;"
+  );
+  if( nPat==0 ) return 0;
+  blob_init(&sql, 0, 0);
+  if( codeidx_exists() ){
+    for(i=0; i+2<nPat && nTri<CODEIDX_MAX_TRI; i++){
+      unsigned int t = codeidx_trigram((const unsigned char*)&zPat[i]);
+      for(j=0; j<nTri && aTri[j]!=t; j++){}
+      if( j==nTri ) aTri[nTri++] = t;
+    }
+    if( nTri==0 ){
+      blob_append_sql(&sql, "SELECT rid FROM codeidx_doc WHERE ntri>=0");
+    }
+    for(i=0; i<nTri; i++){
+      blob_append_sql(&sql, "%sSELECT rid FROM codeidx_tri WHERE tri=%u",
+         i ? " INTERSECT " : "", aTri[i]);
+    }
+  }else{
+    blob_append_sql(&sql, "SELECT DISTINCT fid FROM mlink WHERE fid>0");
+  }
+  db_prepare(&ins, "INSERT INTO codehit(rid,lines) VALUES(:rid,:lines)");
+  db_prepare(&q, "%s", blob_sql_text(&sql));
+  while( db_step(&q)==SQLITE_ROW ){
+    int rid = db_column_int(&q, 0);
+    Blob content, lines;
+    const char *z, *zEnd, *zHit;
+    int iLine = 1;
+    int nLine = 0;
+    if( !content_get(rid, &content) ) continue;
+    z = blob_buffer(&content);
+    zEnd = z + blob_size(&content);
+    blob_init(&lines, 0, 0);
+    while( nLine<CODEIDX_MAX_LINE
+        && (zHit = codeidx_find(z, zEnd-z, zPat, nPat, bNoCase))!=0
+    ){
+      const char *zEol;
+      for(; z<zHit; z++){
+        if( z[0]=='\n' ) iLine++;
+      }
+      while( z>blob_buffer(&content) && z[-1]!='\n' ) z--;
+      for(zEol=zHit; zEol<zEnd && zEol[0]!='\n'; zEol++){}
+      blob_appendf(&lines, "%d:%.*s\n", iLine, (int)(zEol-z), z);
+      nLine++;
+      z = zEol;
+    }
+    if( nLine>0 ){
+      db_bind_int(&ins, ":rid", rid);
+      db_bind_text(&ins, ":lines", blob_str(&lines));
+      db_step(&ins);
+      db_reset(&ins);
+      nHit++;
+    }
+    blob_reset(&lines);
+    blob_reset(&content);
+  }
+  db_finalize(&q);
+  db_finalize(&ins);
+  blob_reset(&sql);
+  return nHit;
+}
+
+/*
+** Prepare a statement that returns each check-in and filename where
+** a file artifact in the CODEHIT table appears, newest first, as:
+**
+**     0:  The file artifact hash
+**     1:  The filename
+**     2:  The check-in hash
+**     3:  The check-in date
+**     4:  Matching lines, as stored in CODEHIT.LINES
+*/
+static void codeidx_prepare_hits(Stmt *pQuery, int nLimit){
+  db_prepare(pQuery,
+    "SELECT b.uuid, filename.name, c.uuid, datetime(event.mtime,toLocal()),"
+    "       codehit.lines"
+    "  FROM codehit, mlink, filename, event, blob b, blob c"
+    " WHERE mlink.fid=codehit.rid"
+    "   AND mlink.fid!=mlink.pid"
+    "   AND filename.fnid=mlink.fnid"
+    "   AND event.objid=mlink.mid"
+    "   AND b.rid=codehit.rid"
+    "   AND c.rid=mlink.mid"
+    "   %s"
+    " ORDER BY event.mtime DESC LIMIT %d",
+    g.perm.Private ? "" :
+      "AND NOT EXISTS(SELECT 1 FROM private"
+      "                WHERE private.rid IN (codehit.rid,mlink.mid))"
+      /*safe-for-%s*/,
+    nLimit
+  );
+}
+
+/*
+** COMMAND: codesearch
+**
+** Usage: %fossil codesearch ?OPTIONS? PATTERN
+**
+** Search every version of every file for lines that contain PATTERN.
+** PATTERN is literal text, not a regular expression.  Each hit shows
+** the check-in where a matching version of a file first appeared, the
+** name of the file, and the matching lines.  The most recent hits are
+** shown first.
+**
+** The search uses the code index when it exists, after adding any files
+** that are not yet indexed.  Otherwise the content of every file is
+** scanned.  Use "fossil fts-config codeindex on" to create the code index.
+**
+** Options:
+**
+**     -i|--ignore-case       Ignore differences in ASCII letter case
+**     -n|--limit N           Show at most N hits.  Default: 50
+*/
+void codesearch_cmd(void){
+  int bNoCase = find_option("ignore-case","i",0)!=0;
+  const char *zLimit = find_option("limit","n",1);
+  int nLimit = zLimit ? atoi(zLimit) : 50;
+  Stmt q;
+
+  db_find_and_open_repository(0, 0);
+  verify_all_options();
+  if( g.argc!=3 ) usage("?OPTIONS? PATTERN");
+  if( nLimit<=0 ) nLimit = 50;
+  g.perm.Private = 1;
+  if( db_is_writeable("repository") ) codeidx_update(0, 0);
+  codeidx_search(g.argv[2], bNoCase);
+  codeidx_prepare_hits(&q, nLimit);
+  while( db_step(&q)==SQLITE_ROW ){
+    const char *zName = db_column_text(&q, 1);
+    char *zLines = fossil_strdup(db_column_text(&q, 4));
+    char *z, *zNext;
+    fossil_print("%.10s %s %s\n", db_column_text(&q, 2),
+                 db_column_text(&q, 3), zName);
+    for(z=zLines; z[0]; z=zNext){
+      zNext = strchr(z, '\n');
+      zNext[0] = 0;
+      zNext++;
+      fossil_print("    %s:%s\n", zName, z);
+    }
+    fossil_free(zLines);
+  }
+  db_finalize(&q);
+}
+
+/*
+** WEBPAGE: codesearch
+**
+** Search the content of every version of every file for a literal
+** string.  Hits are listed by the check-in where the matching version
+** of the file first appeared, most recent first.  Files are added to the
+** code index by the backoffice.  Without a code index, or for a pattern
+** shorter than a trigram, only the administrator may search, as every
+** file would be scanned.
+**
+**    s=PATTERN       The text to search for
+**    i               Ignore ASCII letter case
+**    n=N             Show at most N hits.  Default: 50
+*/
+void codesearch_page(void){
+  const char *zPattern = PD("s","");
+  int bNoCase = PB("i");
+  int nLimit = atoi(PD("n","50"));
+  int nHit = 0;
+  Stmt q;
+
+  login_check_credentials();
+  if( !g.perm.Read ){ login_needed(g.anon.Read); return; }
+  style_header("Code Search");
+  if( nLimit<=0 ) nLimit = 50;
+  @ <form method='GET' action='%R/codesearch'>
+  @ <div class='searchForm'>
+  @ <input type="text" name="s" size="40" value="%h(zPattern)">
+  @ <label><input type="checkbox" name="i"%s(bNoCase?" checked":"")>
+  @ Ignore case</label>
+  @ <input type="submit" value="Search Code">
+  @ </div></form>
+  if( zPattern[0]==0 ){
+    style_footer();
+    return;
+  }
+  if( !codeidx_exists() && !g.perm.Admin ){
+    @ <p class='searchEmpty'>Code search is not available because this
+    @ repository has no code index.</p>
+    style_footer();
+    return;
+  }
+  if( strlen(zPattern)<3 && !g.perm.Admin ){
+    @ <p class='searchEmpty'>The search pattern must be at least
+    @ 3 characters long.</p>
+    style_footer();
+    return;
+  }
+  @ <div class='searchResult'>
+  codeidx_search(zPattern, bNoCase);
+  codeidx_prepare_hits(&q, nLimit);
+  while( db_step(&q)==SQLITE_ROW ){
+    const char *zFUuid = db_column_text(&q, 0);
+    const char *zName = db_column_text(&q, 1);
+    const char *zCUuid = db_column_text(&q, 2);
+    char *zLines = fossil_strdup(db_column_text(&q, 4));
+    char *z, *zNext;
+    if( nHit==0 ){
+      @ <ol>
+    }
+    nHit++;
+    @ <li><p>%z(href("%R/artifact/%!S",zFUuid))%h(zName)</a>
+    @ in check-in %z(href("%R/info/%!S",zCUuid))%S(zCUuid)</a>
+    @ on %h(db_column_text(&q,3))</p>
+    @ <pre>
+    for(z=zLines; z[0]; z=zNext){
+      int iLine = atoi(z);
+      zNext = strchr(z, '\n');
+      zNext[0] = 0;
+      zNext++;
+      z = strchr(z, ':') + 1;
+      @ %z(href("%R/artifact/%!S?ln=%d",zFUuid,iLine))%5d(iLine)</a>: \
+      @ %h(z)
+    }
+    @ </pre></li>
+    fossil_free(zLines);
+  }
+  db_finalize(&q);
+  if( nHit ){
+    @ </ol>
+  }else{
+    @ <p class='searchEmpty'>No matches for: <span>%h(zPattern)</span></p>
+  }
+  @ </div>
+  style_footer();
+}
@@ -1627,18 +1627,36 @@ void page_srchsetup(){
     search_update_index(search_restrict(SRCH_ALL));
   }
   if( search_index_exists() ){
-    @ <p>Currently using an SQLite FTS4 search index. This makes search
-    @ run faster, especially on large repositories, but takes up space.</p>
+    @ <p>Currently using an SQLite %s(search_index_is_fts5()?"FTS5":"FTS4")
+    @ search index. This makes search run faster, especially on large
+    @ repositories, but takes up space.</p>
     onoff_attribute("Use Porter Stemmer","search-stemmer","ss",0,0);
     @ <p><input type="submit" name="fts0" value="Delete The Full-Text Index">
     @ <input type="submit" name="fts1" value="Rebuild The Full-Text Index">
   }else{
-    @ <p>The SQLite FTS4 search index is disabled.  All searching will be
-    @ a full-text scan.  This usually works fine, but can be slow for
-    @ larger repositories.</p>
+    @ <p>The SQLite full-text search index is disabled.  All searching
+    @ will be a full-text scan.  This usually works fine, but can be slow
+    @ for larger repositories.</p>
     onoff_attribute("Use Porter Stemmer","search-stemmer","ss",0,0);
     @ <p><input type="submit" name="fts1" value="Create A Full-Text Index">
   }
+  @ <hr />
+  if( P("codeidx0") ){
+    codeidx_drop();
+  }else if( P("codeidx1") ){
+    codeidx_create();
+  }
+  if( codeidx_exists() ){
+    @ <p>The <a href="%R/codesearch">/codesearch</a> page uses a trigram
+    @ index of the content of every file.  New files are added to the
+    @ index by the backoffice.</p>
+    @ <p><input type="submit" name="codeidx0" value="Delete The Code Index">
+  }else{
+    @ <p>There is no code index.  The <a href="%R/codesearch">/codesearch</a>
+    @ page scans the content of every file, and only the administrator
+    @ may use it.</p>
+    @ <p><input type="submit" name="codeidx1" value="Create A Code Index">
+  }
   @ </div></form>
   style_footer();
 }
@@ -141,6 +141,7 @@ void shun_page(void){
       rid = db_int(0, "SELECT rid FROM blob WHERE uuid=%Q", p);
       if( rid ){
         db_multi_exec("DELETE FROM event WHERE objid=%d", rid);
+        codeidx_forget(rid);
       }
       tagid = db_int(0, "SELECT tagid FROM tag WHERE tagname='tkt-%q'", p);
       if( tagid ){
@@ -151,6 +152,7 @@ void shun_page(void){
       admin_log("Shunned %Q", p);
       p += strlen(p)+1;
     }
+    cache_content_removed();
     @ <p class="shunned">Artifact(s)<br />
     for( p = zUuid ; *p ; p += strlen(p)+1 ){
       @ <a href="%R/artifact/%s(p)">%s(p)</a><br />
@@ -286,6 +288,13 @@ void shun_artifacts(void){
     content_undelta(srcid);
   }
   db_finalize(&q);
+  if( codeidx_exists() ){
+    db_prepare(&q, "SELECT rid FROM toshun");
+    while( db_step(&q)==SQLITE_ROW ){
+      codeidx_forget(db_column_int(&q, 0));
+    }
+    db_finalize(&q);
+  }
   db_multi_exec(
      "DELETE FROM delta WHERE rid IN toshun;"
      "DELETE FROM blob WHERE rid IN toshun;"
@@ -235,6 +235,7 @@ void fossil_key(const char **pzKey, int *pnKey){
 */
 static void fossil_close(int bDb, int noRepository){
   if( bDb ) db_close(1);
+  db_stmt_cache_clear();
   if( noRepository ) g.zRepositoryName = 0;
   g.db = 0;
   g.repositoryOpen = 0;
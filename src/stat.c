@@ -139,6 +139,7 @@ void stat_page(void){
     style_submenu_element("URLs", "urllist");
     style_submenu_element("Schema", "repo_schema");
     style_submenu_element("Web-Cache", "cachestat");
+    style_submenu_element("SQL Profile", "sqlprof");
   }
   style_submenu_element("Activity Reports", "reports");
   style_submenu_element("Hash Collisions", "hash-collisions");
@@ -584,6 +585,112 @@ void repo_stat1_page(void){
   style_footer();
 }
 
+/*
+** Render the content of the zSchema.sqlprof table written by
+** db_sqlprof_save() as an HTML table, most expensive statements first.
+** If zPage is not NULL, show only the statements run by that page.
+** Otherwise the statistics for each SQL text are summed over all pages.
+*/
+void sqlprof_render(const char *zSchema, const char *zPage){
+  Stmt q;
+  db_prepare(&q,
+    "SELECT sum(ncall), sum(nrow), sum(ns), sql, count(*)"
+    "  FROM \"%w\".sqlprof"
+    " WHERE %Q IS NULL OR page=%Q"
+    " GROUP BY sql ORDER BY 3 DESC LIMIT 500",
+    zSchema, zPage, zPage
+  );
+  @ <table border="1" cellpadding="3" class="sortable sqlprof" \
+  @  data-column-types='NNNNNt' data-init-sort='3'>
+  @ <thead><tr><th>Calls</th><th>Rows</th><th>Total ms</th><th>Avg ms</th>
+  @ <th>Pages</th><th>SQL</th></tr></thead><tbody>
+  while( db_step(&q)==SQLITE_ROW ){
+    int nCall = db_column_int(&q, 0);
+    i64 nRow = db_column_int64(&q, 1);
+    double rMs = db_column_int64(&q, 2)/1.0e6;
+    const char *zSql = db_column_text(&q, 3);
+    int nPage = db_column_int(&q, 4);
+    @ <tr><td>%d(nCall)</td><td>%lld(nRow)</td><td>%.3f(rMs)</td>
+    @ <td>%.3f(nCall>0 ? rMs/nCall : 0.0)</td><td>%d(nPage)</td>
+    @ <td><code>%h(zSql)</code></td></tr>
+  }
+  @ </tbody></table>
+  db_finalize(&q);
+}
+
+/*
+** WEBPAGE: sqlprof
+**
+** Show the SQL profile collected while the "sql-profile" setting is on.
+** Requires Admin privileges.
+**
+** Query parameters:
+**
+**    page=NAME     Show only the statements run by page NAME.
+**
+** Add the "sqlprof" query parameter to any other page to see the
+** profile of that one request at the bottom of the page.
+*/
+void sqlprof_page(void){
+  const char *zPage = P("page");
+  int bOn;
+  Stmt q;
+
+  login_check_credentials();
+  if( !g.perm.Admin ){ login_needed(0); return; }
+  if( P("reset")!=0 && cgi_csrf_safe(1) ){
+    db_multi_exec("DROP TABLE IF EXISTS repository.sqlprof");
+    cgi_redirectf("%R/sqlprof");
+    return;
+  }
+  style_header("SQL Profile");
+  style_adunit_config(ADUNIT_RIGHT_OK);
+  style_submenu_element("Stat", "stat");
+  style_submenu_element("Schema", "repo_schema");
+  if( zPage ){
+    style_submenu_element("All Pages", "sqlprof");
+  }
+  bOn = db_get_boolean("sql-profile",0);
+  @ <p>SQL profiling of web requests is %s(bOn?"on":"off").
+  @ (Change this with the "sql-profile" setting on the
+  @ <a href="%R/setup_settings">settings</a> page.)</p>
+  if( !db_table_exists("repository","sqlprof") ){
+    @ <p>No profile has been recorded.</p>
+    style_footer();
+    return;
+  }
+  db_prepare(&q,
+    "SELECT page, sum(ncall), sum(ns) FROM repository.sqlprof"
+    " GROUP BY page ORDER BY 3 DESC"
+  );
+  @ <div class="section">Pages</div>
+  @ <table border="1" cellpadding="3" class="sortable" \
+  @  data-column-types='tNN' data-init-sort='3'>
+  @ <thead><tr><th>Page</th><th>Statements Run</th><th>Total ms</th>
+  @ </tr></thead><tbody>
+  while( db_step(&q)==SQLITE_ROW ){
+    const char *zName = db_column_text(&q, 0);
+    @ <tr><td>%z(href("%R/sqlprof?page=%t",zName))%h(zName)</a></td>
+    @ <td>%d(db_column_int(&q,1))</td>
+    @ <td>%.3f(db_column_int64(&q,2)/1.0e6)</td></tr>
+  }
+  @ </tbody></table>
+  db_finalize(&q);
+  if( zPage ){
+    @ <div class="section">Statements run by /%h(zPage)</div>
+  }else{
+    @ <div class="section">Statements</div>
+  }
+  sqlprof_render("repository", zPage);
+  @ <hr>
+  @ <form method="post" action="%R/sqlprof">
+  login_insert_csrf_secret();
+  @ <input type="submit" name="reset" value="Reset Profile">
+  @ </form>
+  style_table_sorter();
+  style_footer();
+}
+
 /*
 ** WEBPAGE: repo-tabsize
 **
@@ -883,6 +883,15 @@ void style_footer(void){
     cgi_append_content("</span>\n", -1);
   }
 
+  /* Show the SQL profile of this request to an administrator who
+  ** asked for it with the "sqlprof" query parameter. */
+  if( g.perm.Admin && P("sqlprof")!=0 && db_sqlprof_active() ){
+    db_sqlprof_save("temp", g.zPath);
+    @ <div class="sqlprof"><hr>
+    sqlprof_render("temp", 0);
+    @ </div>
+  }
+
   /* Add document end mark if it was not in the footer */
   if( sqlite3_strlike("%</body>%", zFooter, 0)!=0 ){
     style_load_all_js_files();
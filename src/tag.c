@@ -30,6 +30,16 @@
 ** If tagtype is 2 then the tag is being propagated from an
 ** ancestor node.  If tagtype is 0 it means a propagating tag is
 ** being blocked.
+**
+** Tags only propagate along primary parent links, and every check-in
+** has at most one primary parent, so the set of check-ins reached does
+** not depend on the order in which they are visited.  The whole set is
+** described by a single recursive query against TAGXREF and the changes
+** are applied with one statement each.  TAGXREF is modified last so
+** that the earlier statements see it unchanged.
+**
+** This routine runs in the middle of a rebuild scan, so it must not
+** create any tables.
 */
 static void tag_propagate(
   int pid,             /* Propagate the tag to children of this node */
@@ -39,77 +49,67 @@ static void tag_propagate(
   const char *zValue,  /* Value of the tag.  Might be NULL */
   double mtime         /* Timestamp on the tag */
 ){
-  PQueue queue;        /* Queue of check-ins to be tagged */
-  Stmt s;              /* Query the children of :pid to which to propagate */
-  Stmt ins;            /* INSERT INTO tagxref */
-  Stmt eventupdate;    /* UPDATE event */
+  char *zProp;         /* CTE "prop" holding all check-ins to be changed */
+  Stmt s;
 
   assert( tagType==0 || tagType==2 );
-  pqueuex_init(&queue);
-  pqueuex_insert(&queue, pid, 0.0, 0);
+  if( tagType==0 ) zValue = 0;
 
-  /* Query for children of :pid to which to propagate the tag.
-  ** Three returns:  (1) rid of the child.  (2) timestamp of child.
-  ** (3) True to propagate or false to block.
+  /* The recursive part follows primary links from each check-in already
+  ** found to the children that should receive the tag.  A child is
+  ** skipped, along with everything below it, if it carries its own copy
+  ** of the tag or a propagated copy that is newer than this one.
   */
-  db_prepare(&s,
-     "SELECT cid, plink.mtime,"
-     "       coalesce(srcid=0 AND tagxref.mtime<:mtime, %d) AS doit"
-     "  FROM plink LEFT JOIN tagxref ON cid=rid AND tagid=%d"
-     " WHERE pid=:pid AND isprim",
-     tagType==2, tagid
+  zProp = mprintf(
+     "WITH RECURSIVE prop(rid) AS ("
+     "  VALUES(%d)"
+     "  UNION"
+     "  SELECT cid FROM prop, plink"
+     "   WHERE pid=prop.rid AND isprim"
+     "     AND coalesce((SELECT srcid=0 AND mtime<:mtime FROM tagxref"
+     "                    WHERE tagxref.rid=plink.cid AND tagid=%d), %d)"
+     ")",
+     pid, tagid, tagType==2
   );
-  db_bind_double(&s, ":mtime", mtime);
-
-  if( tagType==2 ){
-    /* Set the propagated tag marker on check-in :rid */
-    db_prepare(&ins,
-       "REPLACE INTO tagxref(tagid, tagtype, srcid, origid, value, mtime, rid)"
-       "VALUES(%d,2,0,%d,%Q,:mtime,:rid)",
-       tagid, origId, zValue
-    );
-    db_bind_double(&ins, ":mtime", mtime);
-  }else{
-    /* Remove all references to the tag from check-in :rid */
-    zValue = 0;
-    db_prepare(&ins,
-       "DELETE FROM tagxref WHERE tagid=%d AND rid=:rid", tagid
-    );
-  }
   if( tagid==TAG_BGCOLOR ){
-    db_prepare(&eventupdate,
-      "UPDATE event SET bgcolor=%Q WHERE objid=:rid", zValue
+    db_prepare(&s,
+      "%s UPDATE event SET bgcolor=%Q"
+      " WHERE objid IN (SELECT rid FROM prop WHERE rid<>%d)",
+      zProp/*safe-for-%s*/, zValue, pid
     );
+    db_bind_double(&s, ":mtime", mtime);
+    db_step(&s);
+    db_finalize(&s);
   }
-  while( (pid = pqueuex_extract(&queue, 0))!=0 ){
-    db_bind_int(&s, ":pid", pid);
+  if( tagid==TAG_BRANCH ){
+    db_prepare(&s, "%s SELECT rid FROM prop WHERE rid<>%d",
+               zProp/*safe-for-%s*/, pid);
+    db_bind_double(&s, ":mtime", mtime);
     while( db_step(&s)==SQLITE_ROW ){
-      int doit = db_column_int(&s, 2);
-      if( doit ){
-        int cid = db_column_int(&s, 0);
-        double mtime = db_column_double(&s, 1);
-        pqueuex_insert(&queue, cid, mtime, 0);
-        db_bind_int(&ins, ":rid", cid);
-        db_step(&ins);
-        db_reset(&ins);
-        if( tagid==TAG_BGCOLOR ){
-          db_bind_int(&eventupdate, ":rid", cid);
-          db_step(&eventupdate);
-          db_reset(&eventupdate);
-        }
-        if( tagid==TAG_BRANCH ){
-          leaf_eventually_check(cid);
-        }
-      }
+      leaf_eventually_check(db_column_int(&s, 0));
     }
-    db_reset(&s);
+    db_finalize(&s);
   }
-  pqueuex_clear(&queue);
-  db_finalize(&ins);
-  db_finalize(&s);
-  if( tagid==TAG_BGCOLOR ){
-    db_finalize(&eventupdate);
+  if( tagType==2 ){
+    /* Set the propagated tag marker on each check-in */
+    db_prepare(&s,
+       "%s REPLACE INTO tagxref(tagid, tagtype, srcid, origid, value,"
+       " mtime, rid)"
+       " SELECT %d,2,0,%d,%Q,:mtime,rid FROM prop WHERE rid<>%d",
+       zProp/*safe-for-%s*/, tagid, origId, zValue, pid
+    );
+  }else{
+    /* Remove all references to the tag from each check-in */
+    db_prepare(&s,
+       "%s DELETE FROM tagxref WHERE tagid=%d"
+       " AND rid IN (SELECT rid FROM prop WHERE rid<>%d)",
+       zProp/*safe-for-%s*/, tagid, pid
+    );
   }
+  db_bind_double(&s, ":mtime", mtime);
+  db_step(&s);
+  db_finalize(&s);
+  fossil_free(zProp);
 }
 
 /*
@@ -232,6 +232,7 @@ int tag_insert(
                   "       omtime=coalesce(omtime,mtime)"
                   " WHERE objid=%d",
                   zValue, rid);
+    lastchange_invalidate();
   }
   if( tagid==TAG_PARENT && tagtype==1 ){
     manifest_reparent_checkin(rid, zValue);
@@ -281,6 +282,69 @@ void testtag_cmd(void){
   db_end_transaction(0);
 }
 
+/*
+** COMMAND: test-tag-bench
+**
+** Usage: %fossil test-tag-bench ?--depth N? ?--fork N?
+**
+** Measure the speed of tag propagation.  A synthetic history is added
+** to the PLINK table of the repository: a chain of N check-ins (default
+** 10000) with a ten check-in side branch forking off every 100 check-ins
+** or as set by --fork.  A propagating tag is then added at the root of
+** the chain, replaced with a newer value, and finally cancelled.  The
+** time for each step and the number of check-ins carrying the tag
+** afterwards are reported.  All changes are rolled back at the end.
+*/
+void test_tag_bench_cmd(void){
+  const char *zDepth = find_option("depth",0,1);
+  const char *zFork = find_option("fork",0,1);
+  int nDepth = zDepth ? atoi(zDepth) : 10000;
+  int nFork = zFork ? atoi(zFork) : 100;
+  int base;            /* RID of the root of the synthetic history */
+  int tagid;
+  int i;
+  static const char *const azStep[] = { "propagate", "update", "cancel" };
+
+  db_find_and_open_repository(0, 0);
+  verify_all_options();
+  if( nDepth<1 ) nDepth = 1;
+  if( nFork<1 ) nFork = nDepth+1;
+  db_begin_transaction();
+  base = db_int(0, "SELECT max(rid) FROM blob") + 1;
+  db_multi_exec(
+    "WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<%d)"
+    "INSERT INTO plink(pid,cid,isprim,mtime,baseid)"
+    "  SELECT %d+i-1, %d+i, 1, 2440587.5+i/86400.0, NULL FROM c;",
+    nDepth, base, base
+  );
+  db_multi_exec(
+    "WITH RECURSIVE f(j) AS (VALUES(1) UNION ALL SELECT j+1 FROM f"
+    "                         WHERE j<%d),"
+    "  k(k) AS (VALUES(1) UNION ALL SELECT k+1 FROM k WHERE k<10)"
+    "INSERT INTO plink(pid,cid,isprim,mtime,baseid)"
+    "  SELECT CASE WHEN k=1 THEN %d+j*%d ELSE %d+j*10+k-1 END,"
+    "         %d+j*10+k, 1, 2440587.5+(j*%d+k)/86400.0, NULL"
+    "    FROM f, k;",
+    nDepth/nFork, base, nFork, base+nDepth, base+nDepth, nFork
+  );
+  fossil_print("synthetic history: %d check-ins\n",
+               db_int(0, "SELECT count(*)+1 FROM plink WHERE cid>%d", base));
+  tagid = tag_findid("sym-test-tag-bench", 1);
+  for(i=0; i<count(azStep); i++){
+    int iTimer = fossil_timer_start();
+    if( i<2 ){
+      tag_insert("sym-test-tag-bench", 2, azStep[i], 0, 2440587.5+i, base);
+    }else{
+      tag_insert("sym-test-tag-bench", 0, 0, 0, 2440587.5+i, base);
+    }
+    fossil_print("%-10s %8d check-ins %10.3f ms\n", azStep[i],
+       db_int(0, "SELECT count(*) FROM tagxref WHERE tagid=%d"
+                 "   AND tagtype>0", tagid),
+       fossil_timer_stop(iTimer)/1000.0);
+  }
+  db_end_transaction(1);
+}
+
 /*
 ** OR this value into the tagtype argument to tag_add_artifact to
 ** cause the tag to be displayed on standard output rather than be
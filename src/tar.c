@@ -50,8 +50,10 @@ static struct tarball_t {
 ** Begin the process of generating a tarball.
 **
 ** Initialize the GZIP compressor and the table of directory names.
+** If xOut is not NULL, the compressed tarball is handed to xOut as it
+** is produced instead of being accumulated for tar_finish().
 */
-static void tar_begin(sqlite3_int64 mTime){
+static void tar_begin(sqlite3_int64 mTime, void (*xOut)(const char*,int)){
   assert( tball.aHdr==0 );
   tball.aHdr = fossil_malloc(512+512);
   memset(tball.aHdr, 0, 512+512);
@@ -67,7 +69,11 @@ static void tar_begin(sqlite3_int64 mTime){
   memcpy(&tball.aHdr[257], "ustar\00000", 8);  /* POSIX.1 format */
   memcpy(&tball.aHdr[265], "nobody", 7);   /* Owner name */
   memcpy(&tball.aHdr[297], "nobody", 7);   /* Group name */
-  gzip_begin(mTime);
+  if( xOut ){
+    gzip_begin_stream(mTime, xOut);
+  }else{
+    gzip_begin(mTime);
+  }
   db_multi_exec(
     "CREATE TEMP TABLE dir(name UNIQUE);"
   );
@@ -405,7 +411,7 @@ static void tar_add_file(
 
 /*
 ** Finish constructing the tarball.  Put the content of the tarball
-** in Blob pOut.
+** in Blob pOut, or finish sending it if it is being streamed.
 */
 static void tar_finish(Blob *pOut){
   db_multi_exec("DROP TABLE dir");
@@ -440,7 +446,7 @@ void test_tarball_cmd(void){
     eFType = ExtFILE;
   }
   sqlite3_open(":memory:", &g.db);
-  tar_begin(-1);
+  tar_begin(-1, 0);
   for(i=3; i<g.argc; i++){
     Blob file;
     blob_zero(&file);
@@ -464,6 +470,11 @@ void test_tarball_cmd(void){
 ** If the RID object does not exist in the repository, then
 ** pTar is zeroed.
 **
+** If pTar is NULL, the tarball is handed to xOut as it is built, such
+** as cache_spool_and_send() to stream it as the reply to the current
+** request, or cache_spool_write() to only spool it for the cache.  Only
+** one file of the check-in is held in memory at a time.
+**
 ** zDir is a "synthetic" subdirectory which all files get
 ** added to as part of the tarball. It may be 0 or an empty string, in
 ** which case it is ignored. The intention is to create a tarball which
@@ -473,7 +484,8 @@ void test_tarball_cmd(void){
 */
 void tarball_of_checkin(
   int rid,             /* The RID of the checkin from which to form a tarball */
-  Blob *pTar,          /* Write the tarball into this blob */
+  Blob *pTar,          /* Write the tarball into this blob, or NULL */
+  void (*xOut)(const char*,int),  /* Or hand the tarball to this routine */
   const char *zDir,    /* Directory prefix for all file added to tarball */
   Glob *pInclude,      /* Only add files matching this pattern */
   Glob *pExclude       /* Exclude files matching this pattern */
@@ -482,17 +494,19 @@ void tarball_of_checkin(
   Manifest *pManifest;
   ManifestFile *pFile;
   Blob filename;
+  Blob tarball;
   int nPrefix;
   char *zName = 0;
   unsigned int mTime;
 
   content_get(rid, &mfile);
   if( blob_size(&mfile)==0 ){
-    blob_zero(pTar);
+    if( pTar ) blob_zero(pTar);
     return;
   }
   blob_set_dynamic(&hash, rid_to_uuid(rid));
   blob_zero(&filename);
+  deflate_pool_start(db_get_int("archive-jobs", 1));
 
   if( zDir && zDir[0] ){
     blob_appendf(&filename, "%s/", zDir);
@@ -503,7 +517,7 @@ void tarball_of_checkin(
   if( pManifest ){
     int flg, eflg = 0;
     mTime = (pManifest->rDate - 2440587.5)*86400.0;
-    tar_begin(mTime);
+    tar_begin(mTime, xOut);
     flg = db_get_manifest_setting();
     if( flg ){
       /* eflg is the effective flags, taking include/exclude into account */
@@ -571,14 +585,15 @@ void tarball_of_checkin(
     blob_append(&filename, blob_str(&hash), 16);
     zName = blob_str(&filename);
     mTime = db_int64(0, "SELECT (julianday('now') -  2440587.5)*86400.0;");
-    tar_begin(mTime);
+    tar_begin(mTime, xOut);
     tar_add_file(zName, &mfile, 0, mTime);
   }
   manifest_destroy(pManifest);
   blob_reset(&mfile);
   blob_reset(&hash);
   blob_reset(&filename);
-  tar_finish(pTar);
+  tar_finish(pTar ? pTar : &tarball);
+  deflate_pool_stop();
 }
 
 /*
@@ -642,7 +657,7 @@ void tarball_cmd(void){
        db_get("project-name", "unnamed"), rid, rid
     );
   }
-  tarball_of_checkin(rid, &tarball, zName, pInclude, pExclude);
+  tarball_of_checkin(rid, &tarball, 0, zName, pInclude, pExclude);
   glob_free(pInclude);
   glob_free(pExclude);
   blob_write_to_file(&tarball, g.argv[3]);
@@ -724,10 +739,8 @@ void tarball_page(void){
   int nName, nRid;
   const char *zInclude;         /* The in= query parameter */
   const char *zExclude;         /* The ex= query parameter */
-  Blob cacheKey;                /* The key to cache */
   Glob *pInclude = 0;           /* The compiled in= glob pattern */
   Glob *pExclude = 0;           /* The compiled ex= glob pattern */
-  Blob tarball;                 /* Tarball accumulated here */
   const char *z;
 
   login_check_credentials();
@@ -768,12 +781,7 @@ void tarball_page(void){
   if( nRid==0 && nName>10 ) zName[10] = 0;
 
   /* Compute a unique key for the cache entry based on query parameters */
-  blob_init(&cacheKey, 0, 0);
-  blob_appendf(&cacheKey, "/tarball/%z", rid_to_uuid(rid));
-  blob_appendf(&cacheKey, "/%q", zName);
-  if( zInclude ) blob_appendf(&cacheKey, ",in=%Q", zInclude);
-  if( zExclude ) blob_appendf(&cacheKey, ",ex=%Q", zExclude);
-  zKey = blob_str(&cacheKey);
+  zKey = cache_archive_key("tarball", rid, zName, zInclude, zExclude);
   etag_check(ETAG_HASH, zKey);
 
   if( P("debug")!=0 ){
@@ -801,17 +809,33 @@ void tarball_page(void){
     style_footer();
     return;
   }
-  blob_zero(&tarball);
-  if( cache_read(&tarball, zKey)==0 ){
-    tarball_of_checkin(rid, &tarball, zName, pInclude, pExclude);
-    cache_write(&tarball, zKey);
+  cgi_set_content_type("application/x-compressed");
+  if( cache_send(zKey)==0 ){
+    cgi_stream_begin(-1);
+    cache_spool_begin(zKey);
+    tarball_of_checkin(rid, 0, cache_spool_and_send, zName,
+                       pInclude, pExclude);
+    cache_spool_finish();
   }
   glob_free(pInclude);
   glob_free(pExclude);
   fossil_free(zName);
   fossil_free(zRid);
+  fossil_free(zKey);
   g.zOpenRevision = 0;
-  blob_reset(&cacheKey);
-  cgi_set_content(&tarball);
-  cgi_set_content_type("application/x-compressed");
+}
+
+/*
+** Build the tarball of check-in rid with top-level directory zName into
+** the cache, as /tarball would build it, unless the cache already holds
+** it.  This is used by the backoffice to prepare release downloads.
+*/
+void tarball_pregenerate(int rid, const char *zName){
+  char *zKey = cache_archive_key("tarball", rid, zName, 0, 0);
+  if( !cache_contains(zKey) ){
+    cache_spool_begin(zKey);
+    tarball_of_checkin(rid, 0, cache_spool_write, zName, 0, 0);
+    cache_spool_finish();
+  }
+  fossil_free(zKey);
 }
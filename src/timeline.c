@@ -1095,6 +1095,81 @@ double symbolic_name_to_mtime(const char *z, const char **pzDisplay){
   return mtime;
 }
 
+/*
+** Return a 32-bit checksum of the filter text zFilter, used to tie a
+** timeline cursor to the filter that produced it.
+*/
+static unsigned int timeline_filter_cksum(const char *zFilter){
+  unsigned int h = 0;
+  if( zFilter ){
+    while( *zFilter ) h = (h<<3) ^ (h>>29) ^ (unsigned char)*(zFilter++);
+  }
+  return h;
+}
+
+/*
+** Return a cursor for paging a timeline past the event with mtime rMtime
+** and objid rid.  zFilter is the text of the SQL conditions that select
+** the events of the timeline.  Space to hold the cursor is obtained from
+** fossil_malloc() and should be freed by the caller.
+**
+** A cursor is opaque to its users.  It holds the exact (mtime,objid)
+** key of the event, so that the next page of the timeline is a range
+** scan of the event.mtime index that neither repeats nor skips events
+** that share a timestamp, and a checksum of the filter, so that a
+** cursor from one timeline is not applied to another.
+*/
+char *timeline_cursor(double rMtime, int rid, const char *zFilter){
+  u64 x;
+  memcpy(&x, &rMtime, sizeof(x));
+  return mprintf("%016llx%08x%08x", x, (unsigned int)rid,
+                 timeline_filter_cksum(zFilter));
+}
+
+/*
+** Decode the timeline cursor zCursor.  Return true and write the
+** (mtime,objid) key into *prMtime and *pRid if zCursor is well-formed
+** and was generated for the same zFilter.  Return false otherwise.
+*/
+int timeline_cursor_decode(
+  const char *zCursor,      /* The cursor from timeline_cursor() */
+  const char *zFilter,      /* Filter text of the current timeline */
+  double *prMtime,          /* OUT: mtime of the last event shown */
+  int *pRid                 /* OUT: objid of the last event shown */
+){
+  u64 x = 0;
+  unsigned int aPart[2] = {0, 0};
+  int i;
+  if( zCursor==0 || strlen(zCursor)!=32 || !validate16(zCursor, 32) ){
+    return 0;
+  }
+  for(i=0; i<16; i++) x = (x<<4) | hex_digit_value(zCursor[i]);
+  for(i=16; i<32; i++){
+    aPart[i/24] = (aPart[i/24]<<4) | hex_digit_value(zCursor[i]);
+  }
+  if( aPart[1]!=timeline_filter_cksum(zFilter) ) return 0;
+  memcpy(prMtime, &x, sizeof(x));
+  *pRid = (int)aPart[0];
+  return *prMtime>0.0 && *pRid>0;
+}
+
+/*
+** Append to pSql the conditions that select events older than the
+** (rMtime,rid) key of a timeline cursor.  The mtime is taken from the
+** event table when the event still exists, as a double does not survive
+** the round trip through SQL text exactly.  Callers should order the
+** result by "event.mtime DESC, event.objid DESC".
+*/
+void timeline_cursor_sql(Blob *pSql, double rMtime, int rid){
+  blob_append_sql(pSql,
+     " AND event.mtime<=coalesce((SELECT mtime FROM event WHERE objid=%d),"
+                               "%.17g)"
+     " AND (event.mtime<coalesce((SELECT mtime FROM event WHERE objid=%d),"
+                               "%.17g)"
+     "      OR event.objid<%d)",
+     rid, rMtime, rid, rMtime, rid);
+}
+
 /*
 ** zDate is a localtime date.  Insert records into the
 ** "timeline" table to cause <hr> to be inserted on zDate.
@@ -1213,6 +1288,45 @@ int timeline_ss_submenu(void){
   return timeline_ss_cookie();
 }
 
+/*
+** Return an SQL expression, in memory obtained from fossil_malloc(), that
+** is false for a PATHBLOOM entry whose check-in cannot have changed any
+** file that matches one of the globs in zChng.  Each glob contributes the
+** literal directory in front of its first wildcard, or the whole name if
+** it has no wildcard.  Return NULL if there is no PATHBLOOM table or if
+** some glob has no such literal part, as with "*.c".
+*/
+static char *fileGlobBloomExpr(const char *zChng){
+  Glob *pGlob;
+  Blob expr;
+  int i;
+  if( !db_table_exists("repository", "pathbloom") ) return 0;
+  pGlob = glob_create(zChng);
+  if( pGlob==0 ) return 0;
+  blob_zero(&expr);
+  for(i=0; i<pGlob->nPattern; i++){
+    const char *zPat = pGlob->azPattern[i];
+    int n = (int)strcspn(zPat, "*?[");
+    char *zKey;
+    if( zPat[n] ){
+      while( n>0 && zPat[n-1]!='/' ) n--;
+      if( n==0 ) break;
+    }
+    zKey = mprintf("%.*s", n, zPat);
+    blob_append_sql(&expr, "%spathbloom_test(filter,%Q)",
+                    i ? " OR " : "(", zKey);
+    fossil_free(zKey);
+  }
+  if( pGlob->nPattern==0 || i<pGlob->nPattern ){
+    blob_reset(&expr);
+    glob_free(pGlob);
+    return 0;
+  }
+  glob_free(pGlob);
+  blob_append_sql(&expr, ")");
+  return blob_str(&expr);
+}
+
 /*
 ** If the zChng string is not NULL, then it should be a comma-separated
 ** list of glob patterns for filenames.  Add an term to the WHERE clause
@@ -1223,7 +1337,22 @@ static void addFileGlobExclusion(
   const char *zChng,        /* The filename GLOB list */
   Blob *pSql                /* The SELECT statement under construction */
 ){
+  char *zBloom;
   if( zChng==0 || zChng[0]==0 ) return;
+  zBloom = fileGlobBloomExpr(zChng);
+  if( zBloom ){
+    /* Check each check-in's path bloom filter first and only look at
+    ** MLINK for the check-ins that pass. */
+    blob_append_sql(pSql,
+        " AND coalesce((SELECT %s FROM pathbloom"
+                       " WHERE pathbloom.rid=event.objid),1)"
+        " AND EXISTS(SELECT 1 FROM mlink, filename"
+        " WHERE mlink.mid=event.objid AND mlink.fnid=filename.fnid AND %s)",
+        zBloom/*safe-for-%s*/,
+        glob_expr("filename.name", zChng)/*safe-for-%s*/);
+    fossil_free(zBloom);
+    return;
+  }
   blob_append_sql(pSql," AND event.objid IN ("
       "SELECT mlink.mid FROM mlink, filename"
       " WHERE mlink.fnid=filename.fnid AND %s)",
@@ -1494,13 +1623,14 @@ const char *timeline_expand_datetime(const char *zIn){
 
 
 /*
-** WEBPAGE: timeline
+** WEBPAGE: timeline cacheable
 **
 ** Query parameters:
 **
 **    a=TIMEORTAG     After this event
 **    b=TIMEORTAG     Before this event
 **    c=TIMEORTAG     "Circa" this event
+**    cur=CURSOR      Events older than the last event of a prior page
 **    cf=FILEHASH     "Circa" the first use of the file with FILEHASH
 **    m=TIMEORTAG     Mark this event
 **    n=COUNT         Maximum number of events.  "all" for no limit
@@ -1549,6 +1679,10 @@ const char *timeline_expand_datetime(const char *zIn){
 **
 ** If both a= and b= appear then both upper and lower bounds are honored.
 **
+** The cur= parameter is the opaque cursor used by the "More" button at
+** the bottom of a page of the most recent events.  It overrides a=, b=,
+** and c=, and is ignored if it was generated for different filters.
+**
 ** CHECKIN or TIMEORTAG can be a check-in hash prefix, or a tag, or the
 ** name of a branch.
 */
@@ -1565,6 +1699,7 @@ void page_timeline(void){
   const char *zAfter = P("a");       /* Events after this time */
   const char *zBefore = P("b");      /* Events before this time */
   const char *zCirca = P("c");       /* Events near this time */
+  const char *zCursor = P("cur");    /* Events older than this cursor */
   const char *zMark = P("m");        /* Mark this event or an event this time */
   const char *zTagName = P("t");     /* Show events with this tag */
   const char *zBrName = P("r");      /* Equivalent to t=TAG&rel */
@@ -1997,7 +2132,11 @@ void page_timeline(void){
     int n;
     const char *zEType = "event";
     char *zDate;
+    char *zFilter;
     Blob cond;
+    double rCursor = 0.0;
+    int ridCursor = 0;
+    int bCursor = 0;
     blob_zero(&cond);
     tmFlags |= TIMELINE_FILLGAPS;
     if( zChng && *zChng ){
@@ -2046,6 +2185,7 @@ void page_timeline(void){
           zYearWeekStart = 0;
         }
         if( zYearWeekStart==0 || zYearWeekStart[0]==0 ){
+          cache_page_veto();
           zYearWeekStart = db_text(0,
              "SELECT date('now','-6 days','weekday 1');");
           zYearWeek = db_text(0,
@@ -2060,6 +2200,7 @@ void page_timeline(void){
       zDay = timeline_expand_datetime(zDay);
       zDay = db_text(0, "SELECT date(%Q)", zDay);
       if( zDay==0 || zDay[0]==0 ){
+        cache_page_veto();
         zDay = db_text(0, "SELECT date('now')");
       }
       blob_append_sql(&cond, " AND %Q=date(event.mtime) ",
@@ -2069,6 +2210,7 @@ void page_timeline(void){
     else if( zNDays ){
       nDays = atoi(zNDays);
       if( nDays<1 ) nDays = 1;
+      cache_page_veto();
       blob_append_sql(&cond, " AND event.mtime>=julianday('now','-%d days') ",
                       nDays);
       nEntry = -1;
@@ -2193,11 +2335,25 @@ void page_timeline(void){
         " AND (event.comment LIKE '%%%q%%' OR event.brief LIKE '%%%q%%')",
         zSearch, zSearch);
     }
+    zFilter = mprintf("%s|%s|%d", blob_sql_text(&cond),
+                      zTagSql ? zTagSql : "", P("mionly")!=0);
+    if( zCursor && nEntry>0
+     && timeline_cursor_decode(zCursor, zFilter, &rCursor, &ridCursor)
+    ){
+      bCursor = 1;
+      zAfter = zBefore = zCirca = 0;
+    }
     rBefore = symbolic_name_to_mtime(zBefore, &zBefore);
     rAfter = symbolic_name_to_mtime(zAfter, &zAfter);
     rCirca = symbolic_name_to_mtime(zCirca, &zCirca);
     blob_append_sql(&sql, "%s", blob_sql_text(&cond));
-    if( rAfter>0.0 ){
+    if( bCursor ){
+      timeline_cursor_sql(&sql, rCursor, ridCursor);
+      blob_append_sql(&sql, " ORDER BY event.mtime DESC, event.objid DESC");
+      url_add_parameter(&url, "a", 0);
+      url_add_parameter(&url, "b", 0);
+      url_add_parameter(&url, "c", 0);
+    }else if( rAfter>0.0 ){
       if( rBefore>0.0 ){
         blob_append_sql(&sql,
            " AND event.mtime>=%.17g AND event.mtime<=%.17g"
@@ -2236,7 +2392,7 @@ void page_timeline(void){
       );
       if( zMark==0 ) zMark = zCirca;
     }else{
-      blob_append_sql(&sql, " ORDER BY event.mtime DESC");
+      blob_append_sql(&sql, " ORDER BY event.mtime DESC, event.objid DESC");
     }
     if( nEntry>0 ) blob_append_sql(&sql, " LIMIT %d", nEntry);
     db_multi_exec("%s", blob_sql_text(&sql));
@@ -2253,7 +2409,7 @@ void page_timeline(void){
     }else if( zNDays ){
       blob_appendf(&desc, "%d %s%s within the past %d day%s",
                           n, zEType, zPlural, nDays, nDays>1 ? "s" : "");
-    }else if( zBefore==0 && zCirca==0 && n>=nEntry && nEntry>0 ){
+    }else if( zBefore==0 && zCirca==0 && !bCursor && n>=nEntry && nEntry>0 ){
       blob_appendf(&desc, "%d most recent %s%s", n, zEType, zPlural);
     }else{
       blob_appendf(&desc, "%d %s%s", n, zEType, zPlural);
@@ -2312,6 +2468,10 @@ void page_timeline(void){
       blob_appendf(&desc, " occurring on or before %h.<br />", zBefore);
     }else if( rCirca>0.0 ){
       blob_appendf(&desc, " occurring around %h.<br />", zCirca);
+    }else if( bCursor ){
+      zDate = db_text(0, "SELECT datetime(%.17g,toLocal())", rCursor);
+      blob_appendf(&desc, " occurring before %h.<br />", zDate);
+      free(zDate);
     }
     if( zSearch ){
       blob_appendf(&desc, " matching \"%h\"", zSearch);
@@ -2321,9 +2481,37 @@ void page_timeline(void){
         "exact", "Exact", "glob", "Glob", "like", "Like", "regexp", "Regexp"
       };
       double rDate;
-      zDate = db_text(0, "SELECT min(timestamp) FROM timeline /*scan*/");
-      if( (!zDate || !zDate[0]) && ( zAfter || zBefore ) ){
-        zDate = mprintf("%s", (zAfter ? zAfter : zBefore));
+      Stmt qLast;
+      zDate = 0;
+      if( rAfter<=0.0 && rCirca<=0.0 && nEntry>0 && n>=nEntry ){
+        /* A full page of the newest events.  Page onward with a cursor. */
+        db_prepare(&qLast,
+          "SELECT sortby, rid FROM timeline WHERE etype!='div'"
+          " ORDER BY sortby, rid LIMIT 1 /*scan*/");
+        if( db_step(&qLast)==SQLITE_ROW ){
+          Blob older;
+          rDate = db_column_double(&qLast, 0);
+          blob_init(&older, 0, 0);
+          timeline_cursor_sql(&older, rDate, db_column_int(&qLast, 1));
+          if( db_int(0,
+              "SELECT EXISTS (SELECT 1 FROM event CROSS JOIN blob"
+              " WHERE blob.rid=event.objid%s%s)",
+              blob_sql_text(&older), blob_sql_text(&cond))
+          ){
+            char *zCur = timeline_cursor(rDate, db_column_int(&qLast, 1),
+                                         zFilter);
+            zOlderButton = fossil_strdup(url_render(&url, "cur", zCur,
+                                                    "b", 0));
+            free(zCur);
+          }
+          blob_reset(&older);
+        }
+        db_finalize(&qLast);
+      }else{
+        zDate = db_text(0, "SELECT min(timestamp) FROM timeline /*scan*/");
+        if( (!zDate || !zDate[0]) && ( zAfter || zBefore ) ){
+          zDate = mprintf("%s", (zAfter ? zAfter : zBefore));
+        }
       }
       if( zDate ){
         rDate = symbolic_name_to_mtime(zDate, 0);
@@ -2347,7 +2535,8 @@ void page_timeline(void){
             " WHERE blob.rid=event.objid AND mtime>=%.17g%s)",
             rDate+ONE_SECOND, blob_sql_text(&cond))
         ){
-          zNewerButton = fossil_strdup(url_render(&url, "a", zDate, "b", 0));
+          zNewerButton = fossil_strdup(url_render(&url, "a", zDate,
+                                                  bCursor ? "cur" : "b", 0));
         }
         free(zDate);
       }
@@ -2365,6 +2554,7 @@ void page_timeline(void){
       }
     }
     blob_zero(&cond);
+    fossil_free(zFilter);
   }
   if( PB("showsql") ){
     @ <pre>%h(blob_sql_text(&sql))</pre>
@@ -466,9 +466,12 @@ void wiki_page(void){
   const char *zPageName;
   const char *zMimetype = 0;
   char *zBody = mprintf("%s","<i>Empty Page</i>");
+  char *zCacheKey = 0;              /* Key for the rendering cache */
+  Blob cached;                      /* Rendering from the cache */
 
   login_check_credentials();
   if( !g.perm.RdWiki ){ login_needed(g.anon.RdWiki); return; }
+  blob_init(&cached, 0, 0);
   zPageName = P("name");
   if( zPageName==0 ){
     if( search_restrict(SRCH_WIKI)!=0 ){
@@ -496,7 +499,21 @@ void wiki_page(void){
       );
       free(zTag);
     }
-    pWiki = manifest_get(rid, CFTYPE_WIKI, 0);
+    if( rid ){
+      /* The reply depends on the artifact and its rendering, and on
+      ** the user and capabilities, which decide the menu items. */
+      char *zUuid = rid_to_uuid(rid);
+      char *zCap = cache_capabilities();
+      zCacheKey = cache_render_key(zUuid, "wiki");
+      etag_check(ETAG_HASH, mprintf("%s %s %s",
+                 zCacheKey, g.zLogin ? g.zLogin : "", zCap));
+      fossil_free(zCap);
+      fossil_free(zUuid);
+      cache_fragment_read(zCacheKey, &cached);
+    }
+    if( blob_size(&cached)==0 ){
+      pWiki = manifest_get(rid, CFTYPE_WIKI, 0);
+    }
     if( pWiki ){
       zBody = pWiki->zWiki;
       zMimetype = pWiki->zMimetype;
@@ -523,12 +540,21 @@ void wiki_page(void){
   style_set_current_page("%T?name=%T", g.zPath, zPageName);
   wiki_page_header(WIKITYPE_UNKNOWN, zPageName, "");
   wiki_standard_submenu(submenuFlags);
-  if( zBody[0]==0 ){
+  if( blob_size(&cached)>0 ){
+    cgi_append_content(blob_buffer(&cached), blob_size(&cached));
+    blob_reset(&cached);
+  }else if( zBody[0]==0 ){
     @ <i>This page has been deleted</i>
   }else{
+    int iStart = blob_size(cgi_output_blob());
     blob_init(&wiki, zBody, -1);
     wiki_render_by_mimetype(&wiki, zMimetype);
     blob_reset(&wiki);
+    if( zCacheKey ){
+      blob_init(&wiki, blob_buffer(cgi_output_blob())+iStart,
+                blob_size(cgi_output_blob())-iStart);
+      cache_fragment_write(zCacheKey, &wiki);
+    }
   }
   attachment_list(zPageName, "<hr /><h2>Attachments:</h2><ul>");
   manifest_destroy(pWiki);
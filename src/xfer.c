@@ -128,6 +128,7 @@ static void xfer_accept_file(
   Blob content;
   int isPriv;
   Blob *pUuid;
+  int mFlags = MC_NO_ERRORS;
 
   isPriv = pXfer->nextIsPrivate;
   pXfer->nextIsPrivate = 0;
@@ -195,6 +196,8 @@ static void xfer_accept_file(
   }
   if( hname_verify_hash(&content, blob_buffer(pUuid), blob_size(pUuid))==0 ){
     blob_appendf(&pXfer->err, "wrong hash on received artifact: %b", pUuid);
+  }else{
+    mFlags |= MC_HASH_VERIFIED;
   }
   rid = content_put_ex(&content, blob_str(pUuid), 0, 0, isPriv);
   Th_AppendToList(pzUuidList, pnUuidList, blob_str(pUuid), blob_size(pUuid));
@@ -203,7 +206,7 @@ static void xfer_accept_file(
     blob_reset(&content);
   }else{
     if( !isPriv ) content_make_public(rid);
-    manifest_crosslink(rid, &content, MC_NO_ERRORS);
+    manifest_crosslink(rid, &content, mFlags);
   }
   assert( blob_is_reset(&content) );
   remote_has(rid);
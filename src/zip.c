@@ -51,6 +51,7 @@ static void put32(char *z, int v){
 ** Variables in which to accumulate a growing ZIP archive.
 */
 static Blob body;    /* The body of the ZIP archive */
+static int nSent;    /* Bytes of body already handed to Archive.xOut */
 static Blob toc;     /* The table of contents */
 static int nEntry;   /* Number of files */
 static int dosTime;  /* DOS-format time */
@@ -63,6 +64,7 @@ typedef struct Archive Archive;
 struct Archive {
   int eType;                      /* Type of archive (SQLAR or ZIP) */
   Blob *pBlob;                    /* Output blob */
+  void (*xOut)(const char*,int);  /* Or send the ZIP archive here */
   Blob tmp;                       /* Blob used as temp space for compression */
   sqlite3 *db;                    /* Db used to assemble sqlar archive */
   sqlite3_stmt *pInsert;          /* INSERT statement for SQLAR */
@@ -212,6 +214,7 @@ static int archiveGetLastError(sqlite3_vfs *pVfs, int nBuf, char *aBuf){
 */
 void zip_open(void){
   blob_zero(&body);
+  nSent = 0;
   blob_zero(&toc);
   nEntry = 0;
   dosTime = 0;
@@ -247,40 +250,47 @@ void zip_set_timedate(double rDate){
 }
 
 /*
-** Append a single file to a growing ZIP archive.
+** Hand the part of the ZIP archive built so far to the output routine,
+** if there is one, so that only one file is held in memory at a time.
+*/
+static void zip_flush(Archive *p){
+  if( p->xOut && blob_size(&body)>0 ){
+    p->xOut(blob_buffer(&body), blob_size(&body));
+    nSent += blob_size(&body);
+    blob_reset(&body);
+  }
+}
+
+/*
+** Write the entry for one file or directory into the ZIP archive.
 **
-** pFile is the file to be appended.  zName is the name
-** that the file should be saved as.
+** zName is the name of the entry.  pCompr is the deflate-compressed
+** content of a file of nByte bytes with checksum iCRC, or is empty for
+** a directory or an empty file.
 */
-static void zip_add_file_to_zip(
+static void zip_write_entry(
   Archive *p,
-  const char *zName, 
-  const Blob *pFile, 
-  int mPerm
+  const char *zName,
+  int isDir,
+  int mPerm,
+  int nByte,
+  int iCRC,
+  Blob *pCompr
 ){
-  z_stream stream;
   int nameLen;
-  int toOut = 0;
-  int iStart;
-  int iCRC = 0;
-  int nByte = 0;
+  int iStart;                /* Offset of the header in the archive */
   int nByteCompr = 0;
-  int nBlob;                 /* Size of the blob */
   int iMethod;               /* Compression method. */
   int iMode = 0644;          /* Access permissions */
-  char *z;
   char zHdr[30];
   char zExTime[13];
   char zBuf[100];
-  char zOutBuf[100000];
 
   /* Fill in as much of the header as we know.
   */
   nameLen = (int)strlen(zName);
-  if( nameLen==0 ) return;
-  nBlob = pFile ? blob_size(pFile) : 0;
-  if( pFile ){ /* This is a file, possibly empty... */
-    iMethod = (nBlob>0) ? 8 : 0; /* Cannot compress zero bytes. */
+  if( !isDir ){ /* This is a file, possibly empty... */
+    iMethod = (nByte>0) ? 8 : 0; /* Cannot compress zero bytes. */
     switch( mPerm ){
       case PERM_LNK:   iMode = 0120755;   break;
       case PERM_EXE:   iMode = 0100755;   break;
@@ -290,6 +300,11 @@ static void zip_add_file_to_zip(
     iMethod = 0;
     iMode = 040755;
   }
+  if( nByte>0 ){
+    nByteCompr = blob_size(pCompr);
+  }else{
+    iCRC = 0;
+  }
   memset(zHdr, 0, sizeof(zHdr));
   put32(&zHdr[0], 0x04034b50);
   put16(&zHdr[4], 0x000a);
@@ -297,6 +312,9 @@ static void zip_add_file_to_zip(
   put16(&zHdr[8], iMethod);
   put16(&zHdr[10], dosTime);
   put16(&zHdr[12], dosDate);
+  put32(&zHdr[14], iCRC);
+  put32(&zHdr[18], nByteCompr);
+  put32(&zHdr[22], nByte);
   put16(&zHdr[26], nameLen);
   put16(&zHdr[28], 13);
 
@@ -307,49 +325,14 @@ static void zip_add_file_to_zip(
   put32(&zExTime[9], unixTime);
 
 
-  /* Write the header and filename.
+  /* Write the header, filename and compressed file.
   */
-  iStart = blob_size(&body);
+  iStart = nSent + blob_size(&body);
   blob_append(&body, zHdr, 30);
   blob_append(&body, zName, nameLen);
   blob_append(&body, zExTime, 13);
-
-  if( nBlob>0 ){
-    /* Write the compressed file.  Compute the CRC as we progress.
-    */
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
-    stream.opaque = 0;
-    stream.avail_in = blob_size(pFile);
-    stream.next_in = (unsigned char*)blob_buffer(pFile);
-    stream.avail_out = sizeof(zOutBuf);
-    stream.next_out = (unsigned char*)zOutBuf;
-    deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
-    iCRC = crc32(0, stream.next_in, stream.avail_in);
-    while( stream.avail_in>0 ){
-      deflate(&stream, 0);
-      toOut = sizeof(zOutBuf) - stream.avail_out;
-      blob_append(&body, zOutBuf, toOut);
-      stream.avail_out = sizeof(zOutBuf);
-      stream.next_out = (unsigned char*)zOutBuf;
-    }
-    do{
-      stream.avail_out = sizeof(zOutBuf);
-      stream.next_out = (unsigned char*)zOutBuf;
-      deflate(&stream, Z_FINISH);
-      toOut = sizeof(zOutBuf) - stream.avail_out;
-      blob_append(&body, zOutBuf, toOut);
-    }while( stream.avail_out==0 );
-    nByte = stream.total_in;
-    nByteCompr = stream.total_out;
-    deflateEnd(&stream);
-
-    /* Go back and write the header, now that we know the compressed file size.
-    */
-    z = &blob_buffer(&body)[iStart];
-    put32(&z[14], iCRC);
-    put32(&z[18], nByteCompr);
-    put32(&z[22], nByte);
+  if( nByteCompr>0 ){
+    blob_append(&body, blob_buffer(pCompr), nByteCompr);
   }
 
   /* Make an entry in the tables of contents
@@ -377,6 +360,202 @@ static void zip_add_file_to_zip(
   put16(&zExTime[2], 5);
   blob_append(&toc, zExTime, 9);
   nEntry++;
+  zip_flush(p);
+}
+
+/*
+** When the deflate worker pool is running, files are queued here, in
+** archive order, until their compressed content comes back from the
+** workers.  Directories and empty files are queued too, if they follow
+** a file that is still being compressed.
+*/
+typedef struct ZipPending ZipPending;
+struct ZipPending {
+  char *zName;        /* Name of the entry */
+  int isDir;          /* True for a directory */
+  int mPerm;          /* Permissions of a file */
+  int nByte;          /* Size of the file content */
+  int iCRC;           /* Checksum of the file content */
+  int bStored;        /* True if compressed content is in stored */
+  Blob stored;        /* Compressed content not made by the workers */
+};
+static ZipPending *aPend;    /* Queued entries */
+static int nPend;            /* Number of entries in aPend[] */
+static int nPendAlloc;       /* Space allocated for aPend[] */
+
+/*
+** Write queued entries into the archive.  If bAll is false, stop before
+** the second entry that needs a result from the worker pool, so that
+** exactly one worker becomes free.
+*/
+static void zip_write_pending(Archive *p, int bAll){
+  int i;
+  int nCollect = 0;
+  Blob compr;
+  blob_zero(&compr);
+  for(i=0; i<nPend; i++){
+    ZipPending *pEntry = &aPend[i];
+    if( pEntry->bStored ){
+      compr = pEntry->stored;
+      blob_zero(&pEntry->stored);
+    }else if( pEntry->nByte>0 ){
+      if( nCollect && !bAll ) break;
+      deflate_pool_collect(&compr);
+      nCollect++;
+    }
+    zip_write_entry(p, pEntry->zName, pEntry->isDir, pEntry->mPerm,
+                    pEntry->nByte, pEntry->iCRC, &compr);
+    blob_reset(&compr);
+    fossil_free(pEntry->zName);
+  }
+  nPend -= i;
+  memmove(aPend, &aPend[i], nPend*sizeof(aPend[0]));
+}
+
+/*
+** Queue an entry behind the files being compressed by the workers.
+** If pStored is not NULL, it is the compressed content of the file and
+** this routine takes it over.
+*/
+static void zip_add_pending(
+  const char *zName,
+  int isDir,
+  int mPerm,
+  int nByte,
+  int iCRC,
+  Blob *pStored
+){
+  if( nPend>=nPendAlloc ){
+    nPendAlloc = nPendAlloc*2 + 20;
+    aPend = fossil_realloc(aPend, nPendAlloc*sizeof(aPend[0]));
+  }
+  aPend[nPend].zName = fossil_strdup(zName);
+  aPend[nPend].isDir = isDir;
+  aPend[nPend].mPerm = mPerm;
+  aPend[nPend].nByte = nByte;
+  aPend[nPend].iCRC = iCRC;
+  aPend[nPend].bStored = pStored!=0;
+  if( pStored ){
+    aPend[nPend].stored = *pStored;
+    blob_zero(pStored);
+  }else{
+    blob_zero(&aPend[nPend].stored);
+  }
+  nPend++;
+}
+
+/*
+** Append a single file to a growing ZIP archive.
+**
+** pFile is the file to be appended.  zName is the name
+** that the file should be saved as.
+*/
+static void zip_add_file_to_zip(
+  Archive *p,
+  const char *zName, 
+  const Blob *pFile, 
+  int mPerm
+){
+  int nByte = pFile ? blob_size(pFile) : 0;
+  int iCRC = 0;
+
+  if( zName[0]==0 ) return;
+  if( nByte>0 ){
+    iCRC = crc32(0, (unsigned char*)blob_buffer(pFile), nByte);
+  }
+  if( deflate_pool_size()==0 ){
+    Blob compr;
+    blob_zero(&compr);
+    if( nByte>0 ) gzip_deflate_raw(blob_buffer(pFile), nByte, 1, &compr);
+    zip_write_entry(p, zName, pFile==0, mPerm, nByte, iCRC, &compr);
+    blob_reset(&compr);
+    return;
+  }
+  if( nByte>0 ){
+    if( deflate_pool_full() ) zip_write_pending(p, 0);
+    deflate_pool_submit(blob_buffer(pFile), nByte, 1);
+  }else if( nPend==0 ){
+    zip_write_entry(p, zName, pFile==0, mPerm, 0, 0, 0);
+    return;
+  }
+  zip_add_pending(zName, pFile==0, mPerm, nByte, iCRC, 0);
+}
+
+/*
+** Add artifact rid to a ZIP archive as the file zName, reusing the
+** deflate stream in which the repository stores the artifact instead of
+** compressing its content again.  Only the CRC is computed, by inflating
+** the stream a piece at a time.
+**
+** Return false, having added nothing, if the artifact is stored as a
+** delta, is empty, or its stored form cannot be used.  The caller then
+** adds the file in the ordinary way.
+*/
+static int zip_add_stored_file(
+  Archive *p,
+  const char *zName,
+  int rid,
+  int mPerm
+){
+  Blob stored;               /* Artifact as stored: size, then zlib stream */
+  Blob compr;                /* The raw deflate stream within stored */
+  const unsigned char *a;
+  int n;
+  unsigned int nByte;        /* Size of the artifact */
+  int iCRC = 0;
+  int rc;
+  z_stream stream;
+  char *zOutBuf;
+
+  if( !content_get_stored(rid, &stored) ) return 0;
+  a = (const unsigned char*)blob_buffer(&stored);
+  n = blob_size(&stored);
+
+  /* The stored form is the size as a 4-byte big-endian integer followed
+  ** by a zlib stream: a 2-byte header without a preset dictionary, the
+  ** raw deflate stream and a 4-byte Adler-32 checksum */
+  if( n<10 || (a[4]&0x0f)!=Z_DEFLATED || (a[5]&0x20)!=0
+   || ((a[4]<<8)|a[5])%31!=0
+  ){
+    blob_reset(&stored);
+    return 0;
+  }
+  nByte = ((unsigned)a[0]<<24) | (a[1]<<16) | (a[2]<<8) | a[3];
+  if( nByte==0 || nByte>0x7fffffff ){
+    blob_reset(&stored);
+    return 0;
+  }
+
+  /* Inflate the stream to compute the CRC, and to make sure that the raw
+  ** deflate stream ends where the Adler-32 checksum begins */
+  memset(&stream, 0, sizeof(stream));
+  inflateInit2(&stream, -MAX_WBITS);
+  stream.next_in = (unsigned char*)&a[6];
+  stream.avail_in = n - 10;
+  zOutBuf = fossil_malloc(65536);
+  do{
+    stream.next_out = (unsigned char*)zOutBuf;
+    stream.avail_out = 65536;
+    rc = inflate(&stream, Z_NO_FLUSH);
+    iCRC = crc32(iCRC, (unsigned char*)zOutBuf, 65536 - stream.avail_out);
+  }while( rc==Z_OK );
+  fossil_free(zOutBuf);
+  inflateEnd(&stream);
+  if( rc!=Z_STREAM_END || stream.avail_in!=0 || stream.total_out!=nByte ){
+    blob_reset(&stored);
+    return 0;
+  }
+
+  blob_init(&compr, (const char*)&a[6], n-10);
+  if( nPend>0 ){
+    Blob copy;
+    blob_copy(&copy, &compr);
+    zip_add_pending(zName, 0, mPerm, nByte, iCRC, &copy);
+  }else{
+    zip_write_entry(p, zName, 0, mPerm, nByte, iCRC, &compr);
+  }
+  blob_reset(&stored);
+  return 1;
 }
 
 static void zip_add_file_to_sqlar(
@@ -528,7 +707,8 @@ static void free_archive(Archive *p){
 }
 
 /*
-** Write the ZIP archive into the given BLOB.
+** Write the ZIP archive into the given BLOB, or finish sending it
+** to the output routine.
 */
 static void zip_close(Archive *p){
   int i;
@@ -537,9 +717,10 @@ static void zip_close(Archive *p){
     int iTocEnd;
     char zBuf[30];
 
-    iTocStart = blob_size(&body);
+    zip_write_pending(p, 1);
+    iTocStart = nSent + blob_size(&body);
     blob_append(&body, blob_buffer(&toc), blob_size(&toc));
-    iTocEnd = blob_size(&body);
+    iTocEnd = nSent + blob_size(&body);
 
     memset(zBuf, 0, sizeof(zBuf));
     put32(&zBuf[0], 0x06054b50);
@@ -552,8 +733,12 @@ static void zip_close(Archive *p){
     put16(&zBuf[20], 0);
     blob_append(&body, zBuf, 22);
     blob_reset(&toc);
-    *(p->pBlob) = body;
-    blob_zero(&body);
+    if( p->xOut ){
+      zip_flush(p);
+    }else{
+      *(p->pBlob) = body;
+      blob_zero(&body);
+    }
   }else{
     if( p->db ) sqlite3_exec(p->db, "COMMIT", 0, 0, 0);
     free_archive(p);
@@ -612,6 +797,13 @@ void filezip_cmd(void){
 ** If the RID object does not exist in the repository, then
 ** pZip is zeroed.
 **
+** If pZip is NULL, the archive is handed to xOut as it is built, such as
+** cache_spool_and_send() to stream it as the reply to the current
+** request, or cache_spool_write() to only spool it for the cache.  A ZIP
+** archive then holds only one file of the check-in in memory at a time.
+** An SQLAR archive is a database that is assembled by SQLite, so it is
+** still built in memory and handed to xOut when complete.
+**
 ** zDir is a "synthetic" subdirectory which all zipped files get
 ** added to as part of the zip file. It may be 0 or an empty string,
 ** in which case it is ignored. The intention is to create a zip which
@@ -622,7 +814,8 @@ void filezip_cmd(void){
 static void zip_of_checkin(
   int eType,          /* Type of archive (ZIP or SQLAR) */
   int rid,            /* The RID of the checkin to build the archive from */
-  Blob *pZip,         /* Write the archive content into this blob */
+  Blob *pZip,         /* Write the archive content into this blob, or NULL */
+  void (*xOut)(const char*,int),  /* Or hand the archive to this routine */
   const char *zDir,   /* Top-level directory of the archive */
   Glob *pInclude,     /* Only include files that match this pattern */
   Glob *pExclude      /* Exclude files that match this pattern */
@@ -631,14 +824,21 @@ static void zip_of_checkin(
   Manifest *pManifest;
   ManifestFile *pFile;
   Blob filename;
+  Blob sqlar;
   int nPrefix;
 
   Archive sArchive;
   memset(&sArchive, 0, sizeof(Archive));
   sArchive.eType = eType;
-  sArchive.pBlob = pZip;
+  if( pZip ){
+    sArchive.pBlob = pZip;
+  }else if( eType==ARCHIVE_ZIP ){
+    sArchive.xOut = xOut;
+  }else{
+    sArchive.pBlob = &sqlar;
+  }
   blob_zero(&sArchive.tmp);
-  blob_zero(pZip);
+  if( sArchive.pBlob ) blob_zero(sArchive.pBlob);
 
   content_get(rid, &mfile);
   if( blob_size(&mfile)==0 ){
@@ -647,6 +847,9 @@ static void zip_of_checkin(
   blob_set_dynamic(&hash, rid_to_uuid(rid));
   blob_zero(&filename);
   zip_open();
+  if( eType==ARCHIVE_ZIP ){
+    deflate_pool_start(db_get_int("archive-jobs", 1));
+  }
 
   if( zDir && zDir[0] ){
     blob_appendf(&filename, "%s/", zDir);
@@ -712,13 +915,18 @@ static void zip_of_checkin(
       if( glob_match(pExclude, pFile->zName) ) continue;
       fid = uuid_to_rid(pFile->zUuid, 0);
       if( fid ){
-        content_get(fid, &file);
+        int mPerm = manifest_file_mperm(pFile);
         blob_resize(&filename, nPrefix);
         blob_append(&filename, pFile->zName, -1);
         zName = blob_str(&filename);
         zip_add_folders(&sArchive, zName);
-        zip_add_file(&sArchive, zName, &file, manifest_file_mperm(pFile));
-        blob_reset(&file);
+        if( eType!=ARCHIVE_ZIP
+         || !zip_add_stored_file(&sArchive, zName, fid, mPerm)
+        ){
+          content_get(fid, &file);
+          zip_add_file(&sArchive, zName, &file, mPerm);
+          blob_reset(&file);
+        }
       }
     }
   }
@@ -727,6 +935,11 @@ static void zip_of_checkin(
   blob_reset(&filename);
   blob_reset(&hash);
   zip_close(&sArchive);
+  deflate_pool_stop();
+  if( pZip==0 && eType==ARCHIVE_SQLAR ){
+    xOut(blob_buffer(&sqlar), blob_size(&sqlar));
+    blob_reset(&sqlar);
+  }
 }
 
 /*
@@ -772,7 +985,7 @@ static void archive_cmd(int eType){
        db_get("project-name", "unnamed"), rid, rid
     );
   }
-  zip_of_checkin(eType, rid, &zip, zName, pInclude, pExclude);
+  zip_of_checkin(eType, rid, &zip, 0, zName, pInclude, pExclude);
   glob_free(pInclude);
   glob_free(pExclude);
   blob_write_to_file(&zip, g.argv[3]);
@@ -876,10 +1089,8 @@ void baseline_zip_page(void){
   int nName, nRid;
   const char *zInclude;         /* The in= query parameter */
   const char *zExclude;         /* The ex= query parameter */
-  Blob cacheKey;                /* The key to cache */
   Glob *pInclude = 0;           /* The compiled in= glob pattern */
   Glob *pExclude = 0;           /* The compiled ex= glob pattern */
-  Blob zip;                     /* ZIP archive accumulated here */
   int eType = ARCHIVE_ZIP;      /* Type of archive to generate */
   char *zType;                  /* Human-readable archive type */
 
@@ -938,12 +1149,7 @@ void baseline_zip_page(void){
   if( nRid==0 && nName>10 ) zName[10] = 0;
 
   /* Compute a unique key for the cache entry based on query parameters */
-  blob_init(&cacheKey, 0, 0);
-  blob_appendf(&cacheKey, "/%s/%z", g.zPath, rid_to_uuid(rid));
-  blob_appendf(&cacheKey, "/%q", zName);
-  if( zInclude ) blob_appendf(&cacheKey, ",in=%Q", zInclude);
-  if( zExclude ) blob_appendf(&cacheKey, ",ex=%Q", zExclude);
-  zKey = blob_str(&cacheKey);
+  zKey = cache_archive_key(g.zPath, rid, zName, zInclude, zExclude);
   etag_check(ETAG_HASH, zKey);
 
   if( P("debug")!=0 ){
@@ -971,21 +1177,37 @@ void baseline_zip_page(void){
     style_footer();
     return;
   }
-  blob_zero(&zip);
-  if( cache_read(&zip, zKey)==0 ){
-    zip_of_checkin(eType, rid, &zip, zName, pInclude, pExclude);
-    cache_write(&zip, zKey);
+  if( eType==ARCHIVE_ZIP ){
+    cgi_set_content_type("application/zip");
+  }else{
+    cgi_set_content_type("application/sqlar");
+  }
+  if( cache_send(zKey)==0 ){
+    cgi_stream_begin(-1);
+    cache_spool_begin(zKey);
+    zip_of_checkin(eType, rid, 0, cache_spool_and_send, zName,
+                   pInclude, pExclude);
+    cache_spool_finish();
   }
   glob_free(pInclude);
   glob_free(pExclude);
   fossil_free(zName);
   fossil_free(zRid);
+  fossil_free(zKey);
   g.zOpenRevision = 0;
-  blob_reset(&cacheKey);
-  cgi_set_content(&zip);
-  if( eType==ARCHIVE_ZIP ){
-    cgi_set_content_type("application/zip");
-  }else{
-    cgi_set_content_type("application/sqlar");
+}
+
+/*
+** Build the ZIP archive of check-in rid with top-level directory zName
+** into the cache, as /zip would build it, unless the cache already holds
+** it.  This is used by the backoffice to prepare release downloads.
+*/
+void zip_pregenerate(int rid, const char *zName){
+  char *zKey = cache_archive_key("zip", rid, zName, 0, 0);
+  if( !cache_contains(zKey) ){
+    cache_spool_begin(zKey);
+    zip_of_checkin(ARCHIVE_ZIP, rid, 0, cache_spool_write, zName, 0, 0);
+    cache_spool_finish();
   }
+  fossil_free(zKey);
 }
@@ -269,12 +269,15 @@ proc get_all_settings {} {
       access-log \
       admin-log \
       allow-symlinks \
+      archive-jobs \
+      archive-tag-glob \
       auto-captcha \
       auto-hyperlink \
       auto-shun \
       autosync \
       autosync-tries \
       binary-glob \
+      cache-size \
       case-sensitive \
       clean-glob \
       clearsign \
@@ -291,6 +294,7 @@ proc get_all_settings {} {
       exec-rel-paths \
       gdiff-command \
       gmerge-command \
+      graph-cache-rows \
       hash-digits \
       http-port \
       https-login \
@@ -299,14 +303,18 @@ proc get_all_settings {} {
       localauth \
       main-branch \
       manifest \
+      manifest-cache-size \
       max-loadavg \
       max-upload \
+      mmap-size \
       mtime-changes \
       pgp-command \
       proxy \
       relative-paths \
       repo-cksum \
+      search-jobs \
       self-register \
+      sql-profile \
       ssh-command \
       ssl-ca-location \
       ssl-identity \